@@ -0,0 +1,36 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+/// @file Declares the benchmarks of the epoll module
+
+#ifndef EPOLL_BENCHMARK_H__
+#define EPOLL_BENCHMARK_H__
+
+#include <common.h>
+
+// compare SpscRing against SpscQueue
+int RunSpscBenchmark(int argc, char* argv[]);
+
+// compare the delimiter scanning kernels
+int RunScanBenchmark(int argc, char* argv[]);
+
+// compare the checksum kernels
+int RunChecksumBenchmark(int argc, char* argv[]);
+
+// load the loopback HTTP server with pipelined keep-alive requests
+int RunHttpBenchmark(int argc, char* argv[]);
+
+// load the loopback RPC server with many calls in flight per connection
+int RunRpcBenchmark(int argc, char* argv[]);
+
+// compare the handler temporaries on the heap against the scratch arena
+int RunScratchBenchmark(int argc, char* argv[]);
+
+// replay a traffic capture against the server at its pace or at max
+int RunReplayBenchmark(int argc, char* argv[]);
+
+#endif // EPOLL_BENCHMARK_H__
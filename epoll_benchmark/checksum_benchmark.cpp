@@ -0,0 +1,50 @@
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+
+#include <benchmark.h>
+#include <checksum.h>
+
+typedef uint32_t (*ChecksumFunction)(uint32_t, const uint8_t*, size_t);
+
+static void RunChecksum(const char* name, ChecksumFunction checksum,
+  const std::vector<uint8_t>& buffer, int rounds) {
+  uint32_t result = 0;
+  int64_t start = GetCurrentMicroseconds();
+  for (int i = 0; i < rounds; ++i) {
+    result = checksum(result, buffer.data(), buffer.size());
+  }
+  int64_t elapsed = GetCurrentMicroseconds() - start;
+  double bytes = static_cast<double>(buffer.size()) * rounds;
+  std::cout << name << " size " << buffer.size() << ": "
+    << bytes / elapsed / 1000 << " GB/s (" << result << ")" << std::endl;
+}
+
+// usage: checksum [total megabytes]
+int RunChecksumBenchmark(int argc, char* argv[]) {
+  int64_t total = 1024;
+  if (argc >= 1) {
+    total = atoi(argv[0]);
+  }
+  total *= 1024 * 1024;
+  const int sizes[] = { 64, 1024, 64 * 1024 };
+  for (size_t i = 0; i < ARRAYSIZE(sizes); ++i) {
+    std::vector<uint8_t> buffer(sizes[i]);
+    for (size_t j = 0; j < buffer.size(); ++j) {
+      buffer[j] = static_cast<uint8_t>(rand());
+    }
+    int rounds = static_cast<int>(total / sizes[i]);
+    RunChecksum("crc32c slice-by-8", Crc32cSliceBy8, buffer, rounds);
+    RunChecksum("byte sum scalar", ByteSumScalar, buffer, rounds);
+#ifdef EPOLL_SCAN_X86
+    if (SupportSse42()) {
+      RunChecksum("crc32c sse4.2", Crc32cSse42, buffer, rounds);
+    }
+    RunChecksum("byte sum sse2", ByteSumSse2, buffer, rounds);
+    if (SupportAvx2()) {
+      RunChecksum("byte sum avx2", ByteSumAvx2, buffer, rounds);
+    }
+#endif
+  }
+  return 0;
+}
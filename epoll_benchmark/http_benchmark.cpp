@@ -0,0 +1,244 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark.h>
+#include <http_codec.h>
+#include <tcp_server.h>
+
+namespace {
+
+const char kResponseBody[] = "{\"status\":\"ok\"}";
+
+// answers every request with a small JSON body
+class BenchmarkHttpHandler : public HttpHandler {
+ public:
+  BenchmarkHttpHandler()
+    : ok_(200, "OK", "application/json")
+    , not_found_(404, "Not Found", nullptr) {
+  }
+
+  virtual int OnRequest(TCPSession* session, const HttpRequest& request) {
+    if (!request.target.Equals("/health") && !request.target.Equals("/")) {
+      return not_found_.Send(session, request, nullptr, 0);
+    }
+    return ok_.Send(session, request,
+      reinterpret_cast<const uint8_t*>(kResponseBody),
+      sizeof(kResponseBody) - 1);
+  }
+
+ private:
+  HttpResponseHeader ok_;
+  HttpResponseHeader not_found_;
+};
+
+// one keep-alive connection sending the pipelined requests in rounds
+struct HttpConnection {
+  int socket;
+  // the responses still expected in the current round
+  int waiting;
+  int64_t round_start;
+  std::string received;
+};
+
+struct HttpClientResult {
+  uint64_t requests;
+  uint64_t errors;
+  std::vector<int64_t> latencies;
+};
+
+// Counts the complete responses at the front of the received data,
+// they have no chunked body
+int ConsumeResponses(std::string* received, int limit) {
+  int count = 0;
+  size_t offset = 0;
+  while (count < limit) {
+    size_t head = received->find("\r\n\r\n", offset);
+    if (std::string::npos == head) {
+      break;
+    }
+    size_t length = 0;
+    size_t field = received->find("Content-Length: ", offset);
+    if (field != std::string::npos && field < head) {
+      length = strtoul(received->c_str() + field + 16, nullptr, 10);
+    }
+    if (received->size() < head + 4 + length) {
+      break;
+    }
+    offset = head + 4 + length;
+    ++count;
+  }
+  received->erase(0, offset);
+  return count;
+}
+
+int Connect(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) {
+    return -1;
+  }
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = inet_addr("127.0.0.1");
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address),
+    sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+  int flag = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  return fd;
+}
+
+void RunClient(int port, int connections, int pipeline, int64_t end_time,
+  HttpClientResult* result) {
+  std::string request = "GET /health HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  std::string batch;
+  for (int i = 0; i < pipeline; ++i) {
+    batch += request;
+  }
+  int epoll = epoll_create1(EPOLL_CLOEXEC);
+  std::vector<HttpConnection> conns(connections);
+  for (int i = 0; i < connections; ++i) {
+    conns[i].socket = Connect(port);
+    conns[i].waiting = 0;
+    if (conns[i].socket < 0) {
+      ++result->errors;
+      continue;
+    }
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &conns[i];
+    epoll_ctl(epoll, EPOLL_CTL_ADD, conns[i].socket, &event);
+  }
+  // send the first round on every connection
+  for (int i = 0; i < connections; ++i) {
+    if (conns[i].socket < 0) continue;
+    conns[i].round_start = GetCurrentMicroseconds();
+    conns[i].waiting = pipeline;
+    if (write(conns[i].socket, batch.data(), batch.size()) !=
+      static_cast<ssize_t>(batch.size())) {
+      ++result->errors;
+    }
+  }
+  epoll_event events[64];
+  char buffer[16384];
+  while (GetCurrentMicroseconds() < end_time) {
+    int count = epoll_wait(epoll, events, 64, 100);
+    for (int i = 0; i < count; ++i) {
+      HttpConnection* conn = static_cast<HttpConnection*>(events[i].data.ptr);
+      ssize_t size = read(conn->socket, buffer, sizeof(buffer));
+      if (size <= 0) {
+        ++result->errors;
+        epoll_ctl(epoll, EPOLL_CTL_DEL, conn->socket, nullptr);
+        continue;
+      }
+      conn->received.append(buffer, size);
+      int done = ConsumeResponses(&conn->received, conn->waiting);
+      conn->waiting -= done;
+      result->requests += done;
+      if (conn->waiting > 0) {
+        continue;
+      }
+      int64_t now = GetCurrentMicroseconds();
+      result->latencies.push_back(now - conn->round_start);
+      conn->round_start = now;
+      conn->waiting = pipeline;
+      if (write(conn->socket, batch.data(), batch.size()) !=
+        static_cast<ssize_t>(batch.size())) {
+        ++result->errors;
+      }
+    }
+  }
+  for (int i = 0; i < connections; ++i) {
+    if (conns[i].socket >= 0) close(conns[i].socket);
+  }
+  close(epoll);
+}
+
+}  // namespace
+
+// usage: http [connections] [threads] [seconds] [pipeline] [port]
+int RunHttpBenchmark(int argc, char* argv[]) {
+  int connections = argc >= 1 ? atoi(argv[0]) : 64;
+  int threads = argc >= 2 ? atoi(argv[1]) : 2;
+  int seconds = argc >= 3 ? atoi(argv[2]) : 5;
+  int pipeline = argc >= 4 ? atoi(argv[3]) : 1;
+  int port = argc >= 5 ? atoi(argv[4]) : 8890;
+  if (connections < threads || threads <= 0 || pipeline <= 0) {
+    std::cout << "invalid arguments" << std::endl;
+    return 1;
+  }
+
+  BenchmarkHttpHandler handler;
+  MessageParserOptions options;
+  options.framing = MESSAGE_FRAMING_HTTP;
+  options.http_handler = &handler;
+  std::shared_ptr<TCPServer> server(new TCPServer());
+  server->set_message_parser_options(options);
+  if (server->InitServer("127.0.0.1", port, 2) != 0 ||
+    server->StartServer() != 0) {
+    std::cout << "start server failed" << std::endl;
+    return 1;
+  }
+
+  std::cout << "running " << seconds << "s, " << threads << " threads, "
+    << connections << " connections, pipeline " << pipeline << std::endl;
+  std::vector<HttpClientResult> results(threads);
+  std::vector<std::thread> clients;
+  int64_t start = GetCurrentMicroseconds();
+  int64_t end_time = start + static_cast<int64_t>(seconds) * 1000000;
+  for (int i = 0; i < threads; ++i) {
+    int count = connections / threads + (i < connections % threads ? 1 : 0);
+    results[i].requests = 0;
+    results[i].errors = 0;
+    clients.push_back(std::thread(RunClient, port, count, pipeline,
+      end_time, &results[i]));
+  }
+  for (size_t i = 0; i < clients.size(); ++i) {
+    clients[i].join();
+  }
+  double elapsed = static_cast<double>(GetCurrentMicroseconds() - start)
+    / 1000000;
+  server->StopServer();
+
+  uint64_t requests = 0;
+  uint64_t errors = 0;
+  std::vector<int64_t> latencies;
+  for (int i = 0; i < threads; ++i) {
+    requests += results[i].requests;
+    errors += results[i].errors;
+    latencies.insert(latencies.end(), results[i].latencies.begin(),
+      results[i].latencies.end());
+  }
+  std::sort(latencies.begin(), latencies.end());
+  if (!latencies.empty()) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < latencies.size(); ++i) {
+      sum += latencies[i];
+    }
+    std::cout << "round latency (us): avg "
+      << sum / static_cast<int64_t>(latencies.size())
+      << ", p50 " << latencies[latencies.size() / 2]
+      << ", p99 " << latencies[latencies.size() * 99 / 100]
+      << ", max " << latencies.back() << std::endl;
+  }
+  std::cout << requests << " requests in " << elapsed << "s, "
+    << errors << " errors" << std::endl;
+  std::cout << "requests/sec: " << requests / elapsed << std::endl;
+  return 0;
+}
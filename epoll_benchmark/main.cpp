@@ -0,0 +1,34 @@
+#include <string.h>
+#include <iostream>
+#include <benchmark.h>
+
+struct Benchmark {
+  const char* name;
+  int (*run)(int argc, char* argv[]);
+};
+
+static const Benchmark kBenchmarks[] = {
+  { "spsc", RunSpscBenchmark },
+  { "scan", RunScanBenchmark },
+  { "checksum", RunChecksumBenchmark },
+  { "scratch", RunScratchBenchmark },
+  { "http", RunHttpBenchmark },
+  { "rpc", RunRpcBenchmark },
+  { "replay", RunReplayBenchmark },
+};
+
+int main(int argc, char* argv[])
+{
+  if (argc >= 2) {
+    for (size_t i = 0; i < ARRAYSIZE(kBenchmarks); ++i) {
+      if (strcmp(argv[1], kBenchmarks[i].name) == 0) {
+        return kBenchmarks[i].run(argc - 2, argv + 2);
+      }
+    }
+  }
+  std::cout << "usage: " << argv[0] << " <benchmark> [options]" << std::endl;
+  for (size_t i = 0; i < ARRAYSIZE(kBenchmarks); ++i) {
+    std::cout << "  " << kBenchmarks[i].name << std::endl;
+  }
+  return 1;
+}
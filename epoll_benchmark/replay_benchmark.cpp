@@ -0,0 +1,419 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <benchmark.h>
+#include <traffic_capture.h>
+
+namespace {
+
+// the time to wait for the responses after the last step, microseconds
+const int64_t kDrainTime = 2000000;
+
+enum ReplayStepType {
+  REPLAY_STEP_OPEN,
+  REPLAY_STEP_DATA,
+  REPLAY_STEP_CLOSE
+};
+
+// one action of the client, the data is in the mapped capture
+struct ReplayStep {
+  int64_t time;
+  ReplayStepType type;
+  const uint8_t* data;
+  int size;
+  // the response bytes captured until the next data
+  int64_t response_size;
+  // the time to the first response byte in the capture, -1 for none
+  int64_t latency;
+};
+
+// the response bytes expected before the latency of a data step is known
+struct LatencyProbe {
+  int64_t received_mark;
+  int64_t send_time;
+};
+
+struct ReplaySession {
+  std::vector<ReplayStep> steps;
+  size_t next_step;
+  int socket;
+  bool closing;
+  int64_t expected;
+  int64_t received;
+  std::deque<LatencyProbe> probes;
+};
+
+// the step of a session in the schedule
+struct ReplayEvent {
+  int64_t time;
+  size_t session;
+  size_t step;
+
+  bool operator<(const ReplayEvent& other) const {
+    return time < other.time;
+  }
+};
+
+struct ReplayResult {
+  uint64_t requests;
+  uint64_t sent_bytes;
+  uint64_t received_bytes;
+  uint64_t expected_bytes;
+  uint64_t errors;
+  std::vector<int64_t> original_latencies;
+  std::vector<int64_t> latencies;
+};
+
+int Connect(const char* host, int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) {
+    return -1;
+  }
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = inet_addr(host);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address),
+    sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+  int flag = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  return fd;
+}
+
+// Builds the steps of every session from the capture, the records of a
+// session are ordered by their time as they may come from several
+// service threads
+int LoadCapture(CaptureReader* reader, std::vector<ReplaySession>* sessions) {
+  std::unordered_map<uint64_t, std::vector<const CaptureRecord*>> records;
+  std::vector<uint64_t> order;
+  const CaptureRecord* record = nullptr;
+  const uint8_t* data = nullptr;
+  while (reader->Next(&record, &data)) {
+    std::vector<const CaptureRecord*>& list = records[record->session_id];
+    if (list.empty()) {
+      order.push_back(record->session_id);
+    }
+    list.push_back(record);
+  }
+  for (size_t i = 0; i < order.size(); ++i) {
+    std::vector<const CaptureRecord*>& list = records[order[i]];
+    std::stable_sort(list.begin(), list.end(),
+      [](const CaptureRecord* a, const CaptureRecord* b) {
+        return a->time < b->time;
+      });
+    ReplaySession session;
+    session.next_step = 0;
+    session.socket = -1;
+    session.closing = false;
+    session.expected = 0;
+    session.received = 0;
+    // the sessions opened before the capture started are opened with
+    // their first record
+    if (list[0]->type != CAPTURE_RECORD_OPEN) {
+      ReplayStep open = { list[0]->time, REPLAY_STEP_OPEN, nullptr, 0, 0, -1 };
+      session.steps.push_back(open);
+    }
+    for (size_t j = 0; j < list.size(); ++j) {
+      const CaptureRecord* current = list[j];
+      const uint8_t* payload =
+        reinterpret_cast<const uint8_t*>(current) + sizeof(CaptureRecord);
+      ReplayStep step = { current->time, REPLAY_STEP_DATA, payload,
+        static_cast<int>(current->size), 0, -1 };
+      if (CAPTURE_RECORD_OPEN == current->type) {
+        step.type = REPLAY_STEP_OPEN;
+        step.size = 0;
+      } else if (CAPTURE_RECORD_CLOSE == current->type) {
+        step.type = REPLAY_STEP_CLOSE;
+      } else if (CAPTURE_RECORD_SEND == current->type) {
+        // the response of the last data
+        if (!session.steps.empty()) {
+          ReplayStep& last = session.steps.back();
+          if (REPLAY_STEP_DATA == last.type && last.latency < 0) {
+            last.latency = current->time - last.time;
+          }
+          last.response_size += current->size;
+        }
+        continue;
+      }
+      session.steps.push_back(step);
+    }
+    if (session.steps.back().type != REPLAY_STEP_CLOSE) {
+      ReplayStep close = { session.steps.back().time, REPLAY_STEP_CLOSE,
+        nullptr, 0, 0, -1 };
+      session.steps.push_back(close);
+    }
+    sessions->push_back(session);
+  }
+  return 0;
+}
+
+void CloseSession(int epoll, ReplaySession* session) {
+  if (session->socket >= 0) {
+    epoll_ctl(epoll, EPOLL_CTL_DEL, session->socket, nullptr);
+    close(session->socket);
+    session->socket = -1;
+  }
+  session->closing = false;
+}
+
+// Runs the step of the session, a close waits for the responses
+void ExecuteStep(int epoll, const char* host, int port,
+  ReplaySession* session, const ReplayStep& step, ReplayResult* result) {
+  if (REPLAY_STEP_OPEN == step.type) {
+    session->socket = Connect(host, port);
+    if (session->socket < 0) {
+      ++result->errors;
+      return;
+    }
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = session;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, session->socket, &event);
+  } else if (REPLAY_STEP_DATA == step.type) {
+    if (session->socket < 0) {
+      return;
+    }
+    if (write(session->socket, step.data, step.size) != step.size) {
+      ++result->errors;
+      return;
+    }
+    ++result->requests;
+    result->sent_bytes += step.size;
+    result->expected_bytes += step.response_size;
+    if (step.response_size > 0) {
+      LatencyProbe probe = { session->expected, GetCurrentMicroseconds() };
+      session->probes.push_back(probe);
+      session->expected += step.response_size;
+      if (step.latency >= 0) {
+        result->original_latencies.push_back(step.latency);
+      }
+    }
+  } else {
+    session->closing = true;
+    if (session->received >= session->expected) {
+      CloseSession(epoll, session);
+    }
+  }
+}
+
+// Reads the responses, returns false when the session was closed
+bool ReadResponses(int epoll, ReplaySession* session, ReplayResult* result) {
+  char buffer[65536];
+  ssize_t size = read(session->socket, buffer, sizeof(buffer));
+  if (size <= 0) {
+    if (session->received < session->expected) {
+      ++result->errors;
+    }
+    CloseSession(epoll, session);
+    return false;
+  }
+  session->received += size;
+  result->received_bytes += size;
+  int64_t now = GetCurrentMicroseconds();
+  while (!session->probes.empty() &&
+    session->received > session->probes.front().received_mark) {
+    result->latencies.push_back(now - session->probes.front().send_time);
+    session->probes.pop_front();
+  }
+  if (session->closing && session->received >= session->expected) {
+    CloseSession(epoll, session);
+    return false;
+  }
+  return true;
+}
+
+// whether all the sessions ran their steps and were closed
+bool Finished(const std::vector<ReplaySession>& sessions) {
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    if (sessions[i].socket >= 0 ||
+      sessions[i].next_step < sessions[i].steps.size()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Runs the steps of the session until it waits for responses
+void Advance(int epoll, const char* host, int port, ReplaySession* session,
+  ReplayResult* result) {
+  while (session->next_step < session->steps.size() &&
+    session->received >= session->expected) {
+    const ReplayStep& step = session->steps[session->next_step++];
+    ExecuteStep(epoll, host, port, session, step, result);
+    if (REPLAY_STEP_OPEN == step.type && session->socket < 0) {
+      session->next_step = session->steps.size();
+    }
+  }
+}
+
+// Replays at the captured pace divided by the speed, the steps are sent
+// on time whatever the responses
+void ReplayTimed(int epoll, const char* host, int port, double speed,
+  std::vector<ReplaySession>* sessions, ReplayResult* result) {
+  std::vector<ReplayEvent> events;
+  for (size_t i = 0; i < sessions->size(); ++i) {
+    for (size_t j = 0; j < (*sessions)[i].steps.size(); ++j) {
+      ReplayEvent event = { (*sessions)[i].steps[j].time, i, j };
+      events.push_back(event);
+    }
+  }
+  std::stable_sort(events.begin(), events.end());
+  int64_t origin = events.empty() ? 0 : events[0].time;
+  int64_t start = GetCurrentMicroseconds();
+  size_t next = 0;
+  int64_t end_time = 0;
+  epoll_event ready[64];
+  for (;;) {
+    int64_t now = GetCurrentMicroseconds();
+    while (next < events.size() && start + static_cast<int64_t>(
+      (events[next].time - origin) / speed) <= now) {
+      ReplaySession* session = &(*sessions)[events[next].session];
+      ExecuteStep(epoll, host, port, session,
+        session->steps[events[next].step], result);
+      session->next_step = events[next].step + 1;
+      ++next;
+    }
+    int timeout = 100;
+    if (next < events.size()) {
+      int64_t due = start + static_cast<int64_t>(
+        (events[next].time - origin) / speed);
+      timeout = static_cast<int>((due - now) / 1000);
+    } else if (Finished(*sessions)) {
+      break;
+    } else if (0 == end_time) {
+      end_time = now + kDrainTime;
+    } else if (now > end_time) {
+      break;
+    }
+    int count = epoll_wait(epoll, ready, 64, timeout > 0 ? timeout : 0);
+    for (int i = 0; i < count; ++i) {
+      ReadResponses(epoll, static_cast<ReplaySession*>(ready[i].data.ptr),
+        result);
+    }
+  }
+}
+
+// Replays as fast as the server answers, a session sends its next data
+// once the captured responses of the former one arrived
+void ReplayMax(int epoll, const char* host, int port,
+  std::vector<ReplaySession>* sessions, ReplayResult* result) {
+  for (size_t i = 0; i < sessions->size(); ++i) {
+    Advance(epoll, host, port, &(*sessions)[i], result);
+  }
+  int64_t last_progress = GetCurrentMicroseconds();
+  epoll_event ready[64];
+  while (GetCurrentMicroseconds() - last_progress < kDrainTime) {
+    int count = epoll_wait(epoll, ready, 64, 100);
+    for (int i = 0; i < count; ++i) {
+      ReplaySession* session =
+        static_cast<ReplaySession*>(ready[i].data.ptr);
+      if (ReadResponses(epoll, session, result)) {
+        Advance(epoll, host, port, session, result);
+      }
+      last_progress = GetCurrentMicroseconds();
+    }
+    if (Finished(*sessions)) {
+      break;
+    }
+  }
+}
+
+void PrintLatencies(const char* name, std::vector<int64_t>* latencies) {
+  if (latencies->empty()) {
+    std::cout << name << ": none" << std::endl;
+    return;
+  }
+  std::sort(latencies->begin(), latencies->end());
+  int64_t sum = 0;
+  for (size_t i = 0; i < latencies->size(); ++i) {
+    sum += (*latencies)[i];
+  }
+  std::cout << name << " (us): avg "
+    << sum / static_cast<int64_t>(latencies->size())
+    << ", p50 " << (*latencies)[latencies->size() / 2]
+    << ", p99 " << (*latencies)[latencies->size() * 99 / 100]
+    << ", max " << latencies->back() << std::endl;
+}
+
+}  // namespace
+
+// usage: replay <capture> [speed] [port] [host], speed 0 for max
+int RunReplayBenchmark(int argc, char* argv[]) {
+  if (argc < 1) {
+    std::cout << "usage: replay <capture> [speed] [port] [host]" << std::endl;
+    return 1;
+  }
+  double speed = argc >= 2 ? atof(argv[1]) : 1;
+  int port = argc >= 3 ? atoi(argv[2]) : 8888;
+  const char* host = argc >= 4 ? argv[3] : "127.0.0.1";
+  if (speed < 0) {
+    std::cout << "invalid arguments" << std::endl;
+    return 1;
+  }
+  CaptureReader reader;
+  if (reader.Open(argv[0]) != 0) {
+    std::cout << "open capture failed" << std::endl;
+    return 1;
+  }
+  std::vector<ReplaySession> sessions;
+  LoadCapture(&reader, &sessions);
+  int64_t first = 0;
+  int64_t last = 0;
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    int64_t begin = sessions[i].steps.front().time;
+    int64_t end = sessions[i].steps.back().time;
+    first = (0 == i || begin < first) ? begin : first;
+    last = end > last ? end : last;
+  }
+  double captured = static_cast<double>(last - first) / 1000000;
+  std::cout << "replaying " << sessions.size() << " sessions of "
+    << captured << "s at " << (0 == speed ? std::string("max") :
+    std::to_string(speed) + "x") << " speed" << std::endl;
+
+  ReplayResult result;
+  result.requests = 0;
+  result.sent_bytes = 0;
+  result.received_bytes = 0;
+  result.expected_bytes = 0;
+  result.errors = 0;
+  int epoll = epoll_create1(EPOLL_CLOEXEC);
+  int64_t start = GetCurrentMicroseconds();
+  if (0 == speed) {
+    ReplayMax(epoll, host, port, &sessions, &result);
+  } else {
+    ReplayTimed(epoll, host, port, speed, &sessions, &result);
+  }
+  double elapsed = static_cast<double>(GetCurrentMicroseconds() - start)
+    / 1000000;
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    CloseSession(epoll, &sessions[i]);
+  }
+  close(epoll);
+
+  std::cout << result.requests << " requests in " << elapsed << "s, "
+    << result.errors << " errors" << std::endl;
+  std::cout << "requests/sec: " << result.requests / elapsed
+    << ", sent MB/sec: " << result.sent_bytes / elapsed / 1000000
+    << std::endl;
+  std::cout << "response bytes: " << result.received_bytes << " of "
+    << result.expected_bytes << " captured" << std::endl;
+  PrintLatencies("captured service time", &result.original_latencies);
+  PrintLatencies("replayed latency", &result.latencies);
+  return 0;
+}
@@ -0,0 +1,244 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <benchmark.h>
+#include <rpc.h>
+#include <tcp_server.h>
+#include <tcp_service.h>
+#include <tcp_session.h>
+
+namespace {
+
+const uint16_t kEchoMethod = 1;
+const uint16_t kSwapMethod = 2;
+
+// answers at once with the request payload
+class EchoHandler : public RpcHandler {
+ public:
+  virtual int OnCall(TCPSession* session, const RpcCall& call,
+    const uint8_t* data, int size) {
+    return RpcRespond(session->service(), call, RPC_STATUS_OK, data, size);
+  }
+};
+
+// keeps every other call of a session and answers it after the next one,
+// so the responses are out of order
+class SwapHandler : public RpcHandler {
+ public:
+  virtual int OnCall(TCPSession* session, const RpcCall& call,
+    const uint8_t* data, int size) {
+    // the sessions of a service are served by its thread only
+    thread_local std::unordered_map<uint64_t, RpcCall> kept;
+    std::unordered_map<uint64_t, RpcCall>::iterator it =
+      kept.find(call.session.session_id);
+    if (it == kept.end()) {
+      kept[call.session.session_id] = call;
+      return 0;
+    }
+    RpcCall previous = it->second;
+    kept.erase(it);
+    CHECK_RESULT(RpcRespond(session->service(), call, RPC_STATUS_OK,
+      data, size));
+    return RpcRespond(session->service(), previous, RPC_STATUS_OK,
+      nullptr, 0);
+  }
+};
+
+struct RpcConnection {
+  int socket;
+  uint64_t next_correlation;
+  std::unordered_set<uint64_t> outstanding;
+  std::string received;
+};
+
+struct RpcClientResult {
+  uint64_t calls;
+  uint64_t out_of_order;
+  uint64_t errors;
+};
+
+int Connect(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) {
+    return -1;
+  }
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = inet_addr("127.0.0.1");
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address),
+    sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+  int flag = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  return fd;
+}
+
+// sends count requests in one write
+bool SendCalls(RpcConnection* conn, uint16_t method, int count) {
+  std::string batch;
+  const char payload[] = "0123456789abcdef";
+  for (int i = 0; i < count; ++i) {
+    RpcHeader header;
+    memset(&header, 0, sizeof(header));
+    header.size = sizeof(payload) - 1;
+    header.method = method;
+    header.type = RPC_FRAME_REQUEST;
+    header.timeout = 1000;
+    header.correlation = conn->next_correlation++;
+    conn->outstanding.insert(header.correlation);
+    batch.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    batch.append(payload, header.size);
+  }
+  return write(conn->socket, batch.data(), batch.size()) ==
+    static_cast<ssize_t>(batch.size());
+}
+
+void RunClient(int port, int connections, int depth, uint16_t method,
+  int64_t end_time, RpcClientResult* result) {
+  int epoll = epoll_create1(EPOLL_CLOEXEC);
+  std::vector<RpcConnection> conns(connections);
+  for (int i = 0; i < connections; ++i) {
+    conns[i].socket = Connect(port);
+    conns[i].next_correlation = 1;
+    if (conns[i].socket < 0) {
+      ++result->errors;
+      continue;
+    }
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &conns[i];
+    epoll_ctl(epoll, EPOLL_CTL_ADD, conns[i].socket, &event);
+    if (!SendCalls(&conns[i], method, depth)) {
+      ++result->errors;
+    }
+  }
+  epoll_event events[64];
+  char buffer[65536];
+  while (GetCurrentMicroseconds() < end_time) {
+    int count = epoll_wait(epoll, events, 64, 100);
+    for (int i = 0; i < count; ++i) {
+      RpcConnection* conn = static_cast<RpcConnection*>(events[i].data.ptr);
+      ssize_t size = read(conn->socket, buffer, sizeof(buffer));
+      if (size <= 0) {
+        ++result->errors;
+        epoll_ctl(epoll, EPOLL_CTL_DEL, conn->socket, nullptr);
+        continue;
+      }
+      conn->received.append(buffer, size);
+      size_t offset = 0;
+      int done = 0;
+      uint64_t last = 0;
+      RpcHeader header;
+      while (conn->received.size() - offset >= sizeof(header)) {
+        memcpy(&header, conn->received.data() + offset, sizeof(header));
+        if (conn->received.size() - offset < sizeof(header) + header.size) {
+          break;
+        }
+        offset += sizeof(header) + header.size;
+        if (header.status != RPC_STATUS_OK ||
+          conn->outstanding.erase(header.correlation) != 1) {
+          ++result->errors;
+        }
+        if (header.correlation < last) {
+          ++result->out_of_order;
+        }
+        last = header.correlation;
+        ++done;
+      }
+      conn->received.erase(0, offset);
+      result->calls += done;
+      // keep the depth of the calls in flight, in pairs for the swapping
+      int missing = depth - static_cast<int>(conn->outstanding.size());
+      if (missing >= 2 && !SendCalls(conn, method, missing & ~1)) {
+        ++result->errors;
+      }
+    }
+  }
+  for (int i = 0; i < connections; ++i) {
+    if (conns[i].socket >= 0) close(conns[i].socket);
+  }
+  close(epoll);
+}
+
+}  // namespace
+
+// usage: rpc [connections] [threads] [seconds] [depth] [swap] [port]
+int RunRpcBenchmark(int argc, char* argv[]) {
+  int connections = argc >= 1 ? atoi(argv[0]) : 8;
+  int threads = argc >= 2 ? atoi(argv[1]) : 2;
+  int seconds = argc >= 3 ? atoi(argv[2]) : 5;
+  int depth = argc >= 4 ? atoi(argv[3]) : 256;
+  bool swap = argc >= 5 && atoi(argv[4]) != 0;
+  int port = argc >= 6 ? atoi(argv[5]) : 8892;
+  if (connections < threads || threads <= 0 || depth < 2) {
+    std::cout << "invalid arguments" << std::endl;
+    return 1;
+  }
+  depth &= ~1;
+
+  EchoHandler echo;
+  SwapHandler swapper;
+  RpcDispatcher dispatcher;
+  dispatcher.Register(kEchoMethod, &echo);
+  dispatcher.Register(kSwapMethod, &swapper);
+  MessageParserOptions options;
+  options.framing = MESSAGE_FRAMING_RPC;
+  options.rpc_dispatcher = &dispatcher;
+  std::shared_ptr<TCPServer> server(new TCPServer());
+  server->set_message_parser_options(options);
+  if (server->InitServer("127.0.0.1", port, 2) != 0 ||
+    server->StartServer() != 0) {
+    std::cout << "start server failed" << std::endl;
+    return 1;
+  }
+
+  std::cout << "running " << seconds << "s, " << threads << " threads, "
+    << connections << " connections, " << depth << " calls in flight, "
+    << (swap ? "swapped" : "echo") << " responses" << std::endl;
+  std::vector<RpcClientResult> results(threads);
+  std::vector<std::thread> clients;
+  int64_t start = GetCurrentMicroseconds();
+  int64_t end_time = start + static_cast<int64_t>(seconds) * 1000000;
+  for (int i = 0; i < threads; ++i) {
+    int count = connections / threads + (i < connections % threads ? 1 : 0);
+    memset(&results[i], 0, sizeof(results[i]));
+    clients.push_back(std::thread(RunClient, port, count, depth,
+      swap ? kSwapMethod : kEchoMethod, end_time, &results[i]));
+  }
+  for (size_t i = 0; i < clients.size(); ++i) {
+    clients[i].join();
+  }
+  double elapsed = static_cast<double>(GetCurrentMicroseconds() - start)
+    / 1000000;
+  server->StopServer();
+
+  RpcClientResult total;
+  memset(&total, 0, sizeof(total));
+  for (int i = 0; i < threads; ++i) {
+    total.calls += results[i].calls;
+    total.out_of_order += results[i].out_of_order;
+    total.errors += results[i].errors;
+  }
+  std::cout << total.calls << " calls in " << elapsed << "s, "
+    << total.out_of_order << " out of order, "
+    << total.errors << " errors" << std::endl;
+  std::cout << "calls/sec: " << total.calls / elapsed << std::endl;
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+
+#include <benchmark.h>
+#include <delimiter_scanner.h>
+
+typedef int (*ScanFunction)(const uint8_t*, int, uint8_t);
+
+// the pipelined batch, lines of random length ending with \r\n
+static void FillLines(std::vector<uint8_t>* buffer, int line_size) {
+  size_t size = buffer->size();
+  size_t offset = 0;
+  while (offset < size) {
+    size_t length = line_size / 2 + rand() % (line_size + 1);
+    for (size_t i = 0; i < length && offset < size; ++i) {
+      (*buffer)[offset++] = static_cast<uint8_t>('a' + rand() % 26);
+    }
+    if (offset < size) (*buffer)[offset++] = '\r';
+    if (offset < size) (*buffer)[offset++] = '\n';
+  }
+}
+
+static int ScanMemchr(const uint8_t* data, int size, uint8_t delimiter) {
+  const void* found = memchr(data, delimiter, size);
+  return nullptr == found ? size
+    : static_cast<int>(static_cast<const uint8_t*>(found) - data);
+}
+
+// split the buffer into all its lines, returns the line count
+static int ScanLines(ScanFunction scan, const std::vector<uint8_t>& buffer) {
+  const uint8_t* data = buffer.data();
+  int size = static_cast<int>(buffer.size());
+  int offset = 0;
+  int lines = 0;
+  while (offset < size) {
+    offset += scan(data + offset, size - offset, '\n') + 1;
+    ++lines;
+  }
+  return lines;
+}
+
+static void RunScan(const char* name, ScanFunction scan,
+  const std::vector<uint8_t>& buffer, int line_size, int rounds) {
+  int lines = 0;
+  int64_t start = GetCurrentMicroseconds();
+  for (int i = 0; i < rounds; ++i) {
+    lines += ScanLines(scan, buffer);
+  }
+  int64_t elapsed = GetCurrentMicroseconds() - start;
+  double bytes = static_cast<double>(buffer.size()) * rounds;
+  std::cout << name << " line " << line_size << ": "
+    << bytes / elapsed / 1000 << " GB/s, "
+    << lines / rounds << " lines per batch" << std::endl;
+}
+
+// usage: scan [batch size] [rounds]
+int RunScanBenchmark(int argc, char* argv[]) {
+  int batch_size = 64 * 1024;
+  int rounds = 20000;
+  if (argc >= 1) {
+    batch_size = atoi(argv[0]);
+  }
+  if (argc >= 2) {
+    rounds = atoi(argv[1]);
+  }
+  std::vector<uint8_t> buffer(batch_size);
+  const int line_sizes[] = { 16, 64, 256, 4096 };
+  for (size_t i = 0; i < ARRAYSIZE(line_sizes); ++i) {
+    FillLines(&buffer, line_sizes[i]);
+    RunScan("scalar", FindDelimiterScalar, buffer, line_sizes[i], rounds);
+    RunScan("memchr", ScanMemchr, buffer, line_sizes[i], rounds);
+#ifdef EPOLL_SCAN_X86
+    RunScan("sse2", FindDelimiterSse2, buffer, line_sizes[i], rounds);
+    if (SupportAvx2()) {
+      RunScan("avx2", FindDelimiterAvx2, buffer, line_sizes[i], rounds);
+    }
+#endif
+  }
+  return 0;
+}
@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <benchmark.h>
+#include <scratch_arena.h>
+
+// a form of the fields as "name=value&..."
+static std::string MakeForm(int fields) {
+  std::string form;
+  for (int i = 0; i < fields; ++i) {
+    if (i > 0) {
+      form += '&';
+    }
+    form += "field" + std::to_string(i) + "=";
+    form.append(16 + rand() % 48, static_cast<char>('a' + rand() % 26));
+  }
+  return form;
+}
+
+// decode the form into the fields and build the response of them, as a
+// handler would, returns the response size
+template <class String, class Vector>
+static size_t HandleForm(const std::string& form) {
+  Vector fields;
+  size_t offset = 0;
+  while (offset < form.size()) {
+    size_t end = form.find('&', offset);
+    if (std::string::npos == end) {
+      end = form.size();
+    }
+    size_t equal = form.find('=', offset);
+    if (std::string::npos == equal || equal > end) {
+      equal = end;
+    }
+    fields.push_back(typename Vector::value_type(
+      String(form.data() + offset, equal - offset),
+      String(form.data() + equal + (equal < end ? 1 : 0),
+        end - equal - (equal < end ? 1 : 0))));
+    offset = end + 1;
+  }
+  String response("{");
+  for (size_t i = 0; i < fields.size(); ++i) {
+    response += i > 0 ? ",\"" : "\"";
+    response += fields[i].first;
+    response += "\":\"";
+    response += fields[i].second;
+    response += "\"";
+  }
+  response += "}";
+  return response.size();
+}
+
+typedef std::vector<std::pair<std::string, std::string>> HeapFields;
+typedef ScratchVector<std::pair<ScratchString, ScratchString>> ScratchFields;
+
+template <class String, class Vector>
+static void RunHandler(const char* name, const std::string& form,
+  ScratchArena* arena, int rounds) {
+  size_t size = 0;
+  int64_t start = GetCurrentMicroseconds();
+  for (int i = 0; i < rounds; ++i) {
+    size += HandleForm<String, Vector>(form);
+    ScratchArena::EndMessage();
+  }
+  int64_t elapsed = GetCurrentMicroseconds() - start;
+  std::cout << name << ": " << elapsed * 1000.0 / rounds << " ns per message, "
+    << size / rounds << " bytes per response";
+  if (nullptr != arena) {
+    ScratchArenaStats stats = arena->stats();
+    std::cout << ", " << stats.chunk_allocations << " chunks, peak "
+      << stats.peak_bytes << " bytes";
+  }
+  std::cout << std::endl;
+}
+
+// usage: scratch [fields] [rounds]
+int RunScratchBenchmark(int argc, char* argv[]) {
+  int fields = 16;
+  int rounds = 1000000;
+  if (argc >= 1) {
+    fields = atoi(argv[0]);
+  }
+  if (argc >= 2) {
+    rounds = atoi(argv[1]);
+  }
+  std::string form = MakeForm(fields);
+  RunHandler<std::string, HeapFields>("heap", form, nullptr, rounds);
+  ScratchArena arena;
+  arena.set_reset_policy(SCRATCH_RESET_MESSAGE);
+  ScratchArena::set_current(&arena);
+  RunHandler<ScratchString, ScratchFields>("scratch", form, &arena, rounds);
+  ScratchArena::set_current(nullptr);
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <iostream>
+#include <thread>
+
+#include <benchmark.h>
+#include <spsc_queue.h>
+#include <spsc_ring.h>
+
+// the item has the size of the pipe message
+struct SpscItem {
+  uint64_t sequence;
+  uint8_t payload[24];
+};
+
+static const int kQueueGranularity = 256;
+static const int kRingCapacity = 4096;
+static const int kMaxBatch = 256;
+
+typedef SpscQueue<SpscItem, kQueueGranularity> BenchmarkQueue;
+typedef SpscRing<SpscItem, kRingCapacity> BenchmarkRing;
+
+// write one item at a time and flush every batch items
+template <typename Queue>
+static void ProduceItems(Queue* queue, uint64_t count, int batch) {
+  SpscItem item;
+  int pending = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    item.sequence = i;
+    while (queue->Write(item, false) != 0) {
+      queue->Flush();
+      std::this_thread::yield();
+    }
+    if (++pending == batch) {
+      queue->Flush();
+      pending = 0;
+    }
+  }
+  queue->Flush();
+}
+
+// read one item at a time, returns false when the order was broken
+template <typename Queue>
+static bool ConsumeItems(Queue* queue, uint64_t count) {
+  SpscItem item;
+  for (uint64_t i = 0; i < count; ++i) {
+    while (!queue->Read(&item)) {
+      std::this_thread::yield();
+    }
+    if (item.sequence != i) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void ProduceBatches(BenchmarkRing* ring, uint64_t count, int batch) {
+  SpscItem items[kMaxBatch];
+  uint64_t sequence = 0;
+  while (sequence < count) {
+    int size = static_cast<int>(
+      count - sequence < static_cast<uint64_t>(batch) ? count - sequence : batch);
+    for (int i = 0; i < size; ++i) {
+      items[i].sequence = sequence + i;
+    }
+    int written = 0;
+    while (written < size) {
+      written += ring->WriteBatch(items + written, size - written);
+      ring->Flush();
+      if (written < size) {
+        std::this_thread::yield();
+      }
+    }
+    sequence += size;
+  }
+}
+
+static bool ConsumeBatches(BenchmarkRing* ring, uint64_t count, int batch) {
+  SpscItem items[kMaxBatch];
+  uint64_t sequence = 0;
+  while (sequence < count) {
+    int size = ring->ReadBatch(items, batch);
+    if (0 == size) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (int i = 0; i < size; ++i) {
+      if (items[i].sequence != sequence++) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static void Report(const char* name, int batch, uint64_t count,
+  int64_t elapsed, bool ordered) {
+  double seconds = static_cast<double>(elapsed) / 1000000;
+  std::cout << name << " batch " << batch << ": "
+    << static_cast<double>(count) / seconds / 1000000 << " M items/s, "
+    << static_cast<double>(elapsed) * 1000 / count << " ns/item"
+    << (ordered ? "" : " (ORDER BROKEN)") << std::endl;
+}
+
+template <typename Queue>
+static void RunSingle(const char* name, uint64_t count, int batch) {
+  Queue queue;
+  if (queue.Init() != 0) {
+    return;
+  }
+  bool ordered = false;
+  int64_t start = GetCurrentMicroseconds();
+  std::thread consumer([&]() { ordered = ConsumeItems(&queue, count); });
+  ProduceItems(&queue, count, batch);
+  consumer.join();
+  Report(name, batch, count, GetCurrentMicroseconds() - start, ordered);
+}
+
+static void RunBatch(uint64_t count, int batch) {
+  BenchmarkRing ring;
+  if (ring.Init() != 0) {
+    return;
+  }
+  bool ordered = false;
+  int64_t start = GetCurrentMicroseconds();
+  std::thread consumer([&]() {
+    ordered = ConsumeBatches(&ring, count, batch);
+  });
+  ProduceBatches(&ring, count, batch);
+  consumer.join();
+  Report("SpscRing WriteBatch/ReadBatch", batch, count,
+    GetCurrentMicroseconds() - start, ordered);
+}
+
+// usage: spsc [item count]
+int RunSpscBenchmark(int argc, char* argv[]) {
+  uint64_t count = 10000000;
+  if (argc >= 1) {
+    count = strtoull(argv[0], nullptr, 10);
+  }
+  const int batches[] = { 1, 16, 256 };
+  for (size_t i = 0; i < ARRAYSIZE(batches); ++i) {
+    RunSingle<BenchmarkQueue>("SpscQueue Write/Read", count, batches[i]);
+    RunSingle<BenchmarkRing>("SpscRing Write/Read", count, batches[i]);
+    RunBatch(count, batches[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,220 @@
+#include <load_generator.h>
+
+#include <deque>
+#include <thread>
+#include <unordered_map>
+#include <logging.h>
+#include <tcp_server.h>
+#include <tcp_session.h>
+
+/// The load of one IO service, all its members are touched on the service
+/// thread only, until the service stopped
+class LoadWorker : public ServiceTimer {
+ public:
+  LoadWorker(const LoadOptions& options, int index, int64_t start_time)
+    : options_(options)
+    , start_time_(start_time)
+    , end_time_(start_time + options.seconds * 1000000LL)
+    , next_time_(start_time)
+    , scheduled_(0)
+    , next_connection_(0) {
+    double rate = options.rate / options.threads;
+    interval_ = rate > 0 ? 1000000 / rate : 0;
+    connection_count_ = options.connections / options.threads +
+      (index < options.connections % options.threads ? 1 : 0);
+    request_.assign(options.message_size, 'x');
+    request_.back() = '\n';
+  }
+
+  // open the connections and schedule the first request
+  void Start(TCPService* service) {
+    for (int i = 0; i < connection_count_; ++i) {
+      TCPSession* session = nullptr;
+      if (service->Connect(options_.address, &session) != 0) {
+        EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_WARN, 1,
+          "connect failed, errno: {}", errno);
+        continue;
+      }
+      Connection connection;
+      connection.handle = session->handle();
+      connection.closed = false;
+      sessions_[session->session_id()] = connections_.size();
+      connections_.push_back(connection);
+    }
+    if (interval_ > 0 && !connections_.empty()) {
+      service->ScheduleTimer(this, next_time_);
+    }
+  }
+
+  // send the requests due, the late ones are sent at once with their
+  // intended time kept
+  virtual int64_t OnTimer(TCPService* service, int64_t now) {
+    while (next_time_ <= now) {
+      if (next_time_ >= end_time_) {
+        return 0;
+      }
+      Send(service, next_time_);
+      ++scheduled_;
+      next_time_ = start_time_ + static_cast<int64_t>(scheduled_ * interval_);
+    }
+    return next_time_ < end_time_ ? next_time_ : 0;
+  }
+
+  // the answers come back in order on every connection
+  void OnResponse(TCPSession* session, int64_t now) {
+    std::unordered_map<uint64_t, size_t>::iterator it =
+      sessions_.find(session->session_id());
+    if (it == sessions_.end()) {
+      return;
+    }
+    std::deque<int64_t>& intended = connections_[it->second].intended;
+    if (intended.empty()) {
+      return;
+    }
+    result_.latency.Record(now - intended.front());
+    intended.pop_front();
+    ++result_.completed;
+  }
+
+  // count the requests left without their answers
+  void Finish() {
+    for (size_t i = 0; i < connections_.size(); ++i) {
+      result_.unanswered += connections_[i].intended.size();
+    }
+  }
+
+  const LoadResult& result() const {
+    return result_;
+  }
+
+ private:
+  struct Connection {
+    SessionHandle handle;
+    // the intended send times of the requests waiting for their answers
+    std::deque<int64_t> intended;
+    bool closed;
+  };
+
+  // send the request on the next connection alive
+  void Send(TCPService* service, int64_t intended) {
+    for (size_t i = 0; i < connections_.size(); ++i) {
+      Connection& connection = connections_[next_connection_];
+      next_connection_ = (next_connection_ + 1) % connections_.size();
+      if (connection.closed) {
+        continue;
+      }
+      if (service->SendTo(connection.handle, &request_[0],
+        static_cast<int>(request_.size())) != 0) {
+        // the session has stopped, its requests would never be answered
+        connection.closed = true;
+        result_.unanswered += connection.intended.size();
+        connection.intended.clear();
+        continue;
+      }
+      connection.intended.push_back(intended);
+      ++result_.sent;
+      return;
+    }
+    ++result_.errors;
+  }
+
+  const LoadOptions& options_;
+  int64_t start_time_;
+  int64_t end_time_;
+  // the intended time of the next request
+  int64_t next_time_;
+  // the microseconds between two requests of this worker
+  double interval_;
+  uint64_t scheduled_;
+  int connection_count_;
+  size_t next_connection_;
+  std::vector<Connection> connections_;
+  // the connection of every session id
+  std::unordered_map<uint64_t, size_t> sessions_;
+  std::vector<uint8_t> request_;
+  LoadResult result_;
+  // Disable copying of LoadWorker
+  DISALLOW_CONSTRUCTORS(LoadWorker);
+};
+
+namespace {
+
+// the worker of the service thread
+thread_local LoadWorker* current_worker = nullptr;
+
+}  // namespace
+
+LoadGenerator::LoadGenerator(const LoadOptions& options)
+  : options_(options)
+  , start_time_(0) {
+}
+
+LoadGenerator::~LoadGenerator() {
+}
+
+int LoadGenerator::Run(LoadResult* result) {
+  if (options_.threads <= 0 || options_.connections < options_.threads ||
+    options_.message_size < 1) {
+    return EPOLL_INVALID;
+  }
+  std::shared_ptr<TCPServer> client(new TCPServer());
+  CHECK_RESULT(client->InitClient(options_.threads));
+  MessageParserOptions parser_options;
+  parser_options.framing = MESSAGE_FRAMING_DELIMITER;
+  parser_options.delimiter = '\n';
+  if (options_.message_size > parser_options.max_message_size) {
+    parser_options.max_message_size = options_.message_size;
+  }
+  parser_options.handler = this;
+  client->set_message_parser_options(parser_options);
+  client->set_service_listener(this);
+  start_time_ = GetCurrentMicroseconds() + kWarmupTime;
+  CHECK_RESULT(client->StartServer());
+
+  int64_t end_time = start_time_ + options_.seconds * 1000000LL + kDrainTime;
+  int64_t now = GetCurrentMicroseconds();
+  if (end_time > now) {
+    std::this_thread::sleep_for(std::chrono::microseconds(end_time - now));
+  }
+  client->StopServer();
+
+  // the service threads have exited
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    const LoadResult& worker = workers_[i]->result();
+    result->sent += worker.sent;
+    result->completed += worker.completed;
+    result->errors += worker.errors;
+    result->unanswered += worker.unanswered;
+    result->latency.Merge(worker.latency);
+  }
+  workers_.clear();
+  return 0;
+}
+
+void LoadGenerator::OnServiceStart(TCPService* service) {
+  LoadWorker* worker = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    worker = new LoadWorker(options_, static_cast<int>(workers_.size()),
+      start_time_);
+    workers_.emplace_back(worker);
+  }
+  current_worker = worker;
+  worker->Start(service);
+}
+
+void LoadGenerator::OnServiceStop(TCPService* /*service*/) {
+  if (nullptr != current_worker) {
+    current_worker->Finish();
+    current_worker = nullptr;
+  }
+}
+
+int LoadGenerator::OnMessage(TCPSession* session, const uint8_t* /*data*/,
+  int /*size*/) {
+  if (nullptr != current_worker) {
+    current_worker->OnResponse(session, GetCurrentMicroseconds());
+  }
+  return 0;
+}
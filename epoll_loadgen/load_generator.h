@@ -0,0 +1,103 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+/// @file Defines the open-loop load generator
+
+#ifndef EPOLL_LOAD_GENERATOR_H__
+#define EPOLL_LOAD_GENERATOR_H__
+
+#include <netinet/in.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <histogram.h>
+#include <message_parser.h>
+#include <tcp_service.h>
+
+/// The load to generate
+struct LoadOptions {
+  sockaddr_in address;
+  // the requests per second of all the threads
+  double rate;
+  int threads;
+  // the connections of all the threads, spread evenly
+  int connections;
+  int seconds;
+  // the size of a request with its delimiter, the server echoes it
+  int message_size;
+
+  LoadOptions()
+    : rate(1000)
+    , threads(2)
+    , connections(16)
+    , seconds(10)
+    , message_size(64) {
+    address.sin_family = AF_INET;
+    address.sin_port = htons(8888);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  }
+};
+
+/// The figures of a run, merged from all the threads
+struct LoadResult {
+  // the requests written, and those answered
+  uint64_t sent;
+  uint64_t completed;
+  // the requests which found no connection alive
+  uint64_t errors;
+  // the requests still waiting for their answers at the end
+  uint64_t unanswered;
+  // the microseconds from the intended send time to the answer
+  Histogram latency;
+
+  LoadResult()
+    : sent(0)
+    , completed(0)
+    , errors(0)
+    , unanswered(0) {
+  }
+};
+
+class LoadWorker;
+
+/// This class sends the requests at a fixed rate whatever the response
+/// times, through the IO services of a TCPServer running as a client.
+/// Every request has its intended send time on the schedule, the latency
+/// is measured from that time rather than from the actual write, so the
+/// stalls of the server or of the generator itself are counted for all
+/// the requests they delayed instead of being hidden by a closed loop.
+class LoadGenerator : public ServiceListener, public MessageHandler {
+ public:
+  explicit LoadGenerator(const LoadOptions& options);
+  virtual ~LoadGenerator();
+
+  // Runs the load for the duration, returns nonzero when the client
+  // could not start
+  int Run(LoadResult* result);
+
+ private:
+  // the time for the connections to be established before the schedule
+  // starts, in microseconds
+  static const int64_t kWarmupTime = 200000;
+  // the time to wait for the answers after the schedule ended
+  static const int64_t kDrainTime = 1000000;
+
+  virtual void OnServiceStart(TCPService* service);
+
+  virtual void OnServiceStop(TCPService* service);
+
+  virtual int OnMessage(TCPSession* session, const uint8_t* data, int size);
+
+  LoadOptions options_;
+  int64_t start_time_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<LoadWorker>> workers_;
+  // Disable copying of LoadGenerator
+  DISALLOW_CONSTRUCTORS(LoadGenerator);
+};
+
+#endif // EPOLL_LOAD_GENERATOR_H__
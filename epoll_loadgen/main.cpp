@@ -0,0 +1,103 @@
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <load_generator.h>
+#include <tcp_server.h>
+#include <tcp_session.h>
+
+namespace {
+
+// The handler of the echo server, it answers every line with itself
+class EchoHandler : public MessageHandler {
+ public:
+  virtual int OnMessage(TCPSession* session, const uint8_t* data, int size) {
+    return session->SendMessage(data, size);
+  }
+};
+
+// usage: serve [port] [threads]
+int RunServe(int argc, char* argv[]) {
+  int port = argc >= 1 ? atoi(argv[0]) : 8888;
+  int threads = argc >= 2 ? atoi(argv[1]) : 2;
+  EchoHandler handler;
+  MessageParserOptions options;
+  options.framing = MESSAGE_FRAMING_DELIMITER;
+  options.delimiter = '\n';
+  options.handler = &handler;
+  std::shared_ptr<TCPServer> server(new TCPServer());
+  server->set_message_parser_options(options);
+  if (server->InitServer("0.0.0.0", port, threads) != 0 ||
+    server->StartServer() != 0) {
+    std::cout << "start server failed!" << std::endl;
+    return 1;
+  }
+  std::cout << "echo server on port " << port << ", input q exit."
+    << std::endl;
+  std::string line;
+  while (std::getline(std::cin, line) && line != "q") {
+    // wait for exit
+  }
+  server->StopServer();
+  return 0;
+}
+
+// usage: run <rate> [threads] [connections] [seconds] [size] [port] [host]
+int RunLoad(int argc, char* argv[]) {
+  if (argc < 1) {
+    std::cout << "usage: run <rate> [threads] [connections] [seconds] "
+      "[size] [port] [host]" << std::endl;
+    return 1;
+  }
+  LoadOptions options;
+  options.rate = atof(argv[0]);
+  options.threads = argc >= 2 ? atoi(argv[1]) : options.threads;
+  options.connections = argc >= 3 ? atoi(argv[2]) : options.connections;
+  options.seconds = argc >= 4 ? atoi(argv[3]) : options.seconds;
+  options.message_size = argc >= 5 ? atoi(argv[4]) : options.message_size;
+  options.address.sin_port = htons(argc >= 6 ? atoi(argv[5]) : 8888);
+  options.address.sin_addr.s_addr =
+    inet_addr(argc >= 7 ? argv[6] : "127.0.0.1");
+  std::cout << "sending " << options.rate << " requests/sec of "
+    << options.message_size << " bytes for " << options.seconds
+    << "s over " << options.connections << " connections and "
+    << options.threads << " threads" << std::endl;
+
+  LoadResult result;
+  if (LoadGenerator(options).Run(&result) != 0) {
+    std::cout << "invalid arguments" << std::endl;
+    return 1;
+  }
+  std::cout << result.sent << " requests sent, " << result.completed
+    << " answered, " << result.unanswered << " unanswered, "
+    << result.errors << " without connection" << std::endl;
+  std::cout << "achieved requests/sec: "
+    << static_cast<double>(result.sent) / options.seconds << std::endl;
+  const Histogram& latency = result.latency;
+  std::cout << "latency from the intended send time (us):" << std::endl;
+  std::cout << "  min " << latency.min() << ", mean " << latency.mean()
+    << ", max " << latency.max() << std::endl;
+  const double kPercentiles[] = { 50, 90, 99, 99.9, 99.99 };
+  for (size_t i = 0; i < ARRAYSIZE(kPercentiles); ++i) {
+    std::cout << "  p" << kPercentiles[i] << " "
+      << latency.Percentile(kPercentiles[i]) << std::endl;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  if (argc >= 2 && strcmp(argv[1], "run") == 0) {
+    return RunLoad(argc - 2, argv + 2);
+  }
+  if (argc >= 2 && strcmp(argv[1], "serve") == 0) {
+    return RunServe(argc - 2, argv + 2);
+  }
+  std::cout << "usage: " << argv[0] << " run <rate> [threads] [connections] "
+    "[seconds] [size] [port] [host]" << std::endl;
+  std::cout << "       " << argv[0] << " serve [port] [threads]" << std::endl;
+  return 1;
+}
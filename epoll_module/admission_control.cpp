@@ -0,0 +1,188 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <admission_control.h>
+
+namespace {
+
+// the burst of the bucket, one second of the rate by default
+double NormalizeBurst(double rate, double burst) {
+  if (burst >= 1) {
+    return burst;
+  }
+  return rate > 1 ? rate : 1;
+}
+
+}  // namespace
+
+bool AdmissionControl::TokenBucket::Refill(double rate, double burst,
+  int64_t now) {
+  if (now > last_time) {
+    tokens += rate * static_cast<double>(now - last_time) / 1000000;
+    if (tokens > burst) {
+      tokens = burst;
+    }
+    last_time = now;
+  }
+  return tokens >= 1;
+}
+
+AdmissionControl::AdmissionControl(const AdmissionOptions& options)
+  : options_(options)
+  , tracking_(options.max_connections_per_ip > 0 ||
+    options.ip_connection_rate > 0)
+  , mask_(0)
+  , shift_(32)
+  , connections_(0)
+  , accepted_(0)
+  , rejected_connections_(0)
+  , rejected_ip_connections_(0)
+  , rejected_ip_rate_(0)
+  , rejected_rate_(0)
+  , untracked_(0) {
+  options_.connection_burst = NormalizeBurst(options_.connection_rate,
+    options_.connection_burst);
+  options_.ip_connection_burst = NormalizeBurst(options_.ip_connection_rate,
+    options_.ip_connection_burst);
+  bucket_.Reset(options_.connection_burst, GetCurrentMicroseconds());
+  if (tracking_) {
+    uint32_t size = 2;
+    shift_ = 31;
+    while (size < static_cast<uint32_t>(options_.ip_table_size) &&
+      size < 0x40000000u) {
+      size <<= 1;
+      --shift_;
+    }
+    options_.ip_table_size = static_cast<int>(size);
+    mask_ = size - 1;
+    slots_.reset(new Slot[size]);
+    for (uint32_t i = 0; i < size; ++i) {
+      slots_[i].ip.store(0, std::memory_order_relaxed);
+      slots_[i].connections.store(0, std::memory_order_relaxed);
+      slots_[i].bucket.Reset(0, 0);
+    }
+  }
+}
+
+AdmissionControl::Slot* AdmissionControl::FindOrInsert(uint32_t ip,
+  int64_t now) {
+  Slot* free_slot = nullptr;
+  uint32_t index = Hash(ip);
+  for (int i = 0; i < kMaxProbes; ++i) {
+    Slot* slot = &slots_[(index + i) & mask_];
+    uint32_t key = slot->ip.load(std::memory_order_relaxed);
+    if (key == ip) {
+      return slot;
+    }
+    if (0 == key) {
+      // the source is not behind a slot never used
+      if (nullptr == free_slot) {
+        free_slot = slot;
+      }
+      break;
+    }
+    // a source without connections could be forgotten once its bucket
+    // has refilled, it would start again with a full bucket
+    if (nullptr == free_slot &&
+      slot->connections.load(std::memory_order_relaxed) == 0 &&
+      (options_.ip_connection_rate <= 0 ||
+      (slot->bucket.Refill(options_.ip_connection_rate,
+      options_.ip_connection_burst, now) &&
+      slot->bucket.tokens >= options_.ip_connection_burst))) {
+      free_slot = slot;
+    }
+  }
+  if (nullptr != free_slot) {
+    free_slot->bucket.Reset(options_.ip_connection_burst, now);
+    free_slot->ip.store(ip, std::memory_order_release);
+  }
+  return free_slot;
+}
+
+AdmissionResult AdmissionControl::Admit(const sockaddr_in& address,
+  int64_t now, bool* tracked) {
+  *tracked = false;
+  if (options_.max_connections > 0 &&
+    connections_.load(std::memory_order_relaxed) >= options_.max_connections) {
+    return Reject(ADMISSION_REJECTED_CONNECTIONS, &rejected_connections_);
+  }
+  Slot* slot = nullptr;
+  if (tracking_) {
+    slot = FindOrInsert(address.sin_addr.s_addr, now);
+    if (nullptr == slot) {
+      untracked_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      if (options_.max_connections_per_ip > 0 &&
+        slot->connections.load(std::memory_order_relaxed) >=
+        options_.max_connections_per_ip) {
+        return Reject(ADMISSION_REJECTED_IP_CONNECTIONS,
+          &rejected_ip_connections_);
+      }
+      if (options_.ip_connection_rate > 0 &&
+        !slot->bucket.Refill(options_.ip_connection_rate,
+        options_.ip_connection_burst, now)) {
+        return Reject(ADMISSION_REJECTED_IP_RATE, &rejected_ip_rate_);
+      }
+    }
+  }
+  // the server bucket is checked last, so that an abusive source would not
+  // use up the tokens of the others
+  if (options_.connection_rate > 0) {
+    if (!bucket_.Refill(options_.connection_rate,
+      options_.connection_burst, now)) {
+      return Reject(ADMISSION_REJECTED_RATE, &rejected_rate_);
+    }
+    bucket_.tokens -= 1;
+  }
+  if (nullptr != slot) {
+    if (options_.ip_connection_rate > 0) {
+      slot->bucket.tokens -= 1;
+    }
+    slot->connections.fetch_add(1, std::memory_order_relaxed);
+    *tracked = true;
+  }
+  connections_.fetch_add(1, std::memory_order_relaxed);
+  accepted_.fetch_add(1, std::memory_order_relaxed);
+  return ADMISSION_ACCEPTED;
+}
+
+void AdmissionControl::Release(const sockaddr_in& address, bool tracked) {
+  connections_.fetch_sub(1, std::memory_order_relaxed);
+  if (!tracked) {
+    return;
+  }
+  // the slot of a source with connections is never reused, the probing
+  // finds it
+  uint32_t ip = address.sin_addr.s_addr;
+  uint32_t index = Hash(ip);
+  for (int i = 0; i < kMaxProbes; ++i) {
+    Slot* slot = &slots_[(index + i) & mask_];
+    uint32_t key = slot->ip.load(std::memory_order_acquire);
+    if (key == ip) {
+      slot->connections.fetch_sub(1, std::memory_order_release);
+      return;
+    }
+    if (0 == key) {
+      return;
+    }
+  }
+}
+
+AdmissionStats AdmissionControl::stats() const {
+  AdmissionStats result;
+  result.connections = connections_.load(std::memory_order_relaxed);
+  result.accepted = accepted_.load(std::memory_order_relaxed);
+  result.rejected_connections =
+    rejected_connections_.load(std::memory_order_relaxed);
+  result.rejected_ip_connections =
+    rejected_ip_connections_.load(std::memory_order_relaxed);
+  result.rejected_ip_rate = rejected_ip_rate_.load(std::memory_order_relaxed);
+  result.rejected_rate = rejected_rate_.load(std::memory_order_relaxed);
+  result.untracked = untracked_.load(std::memory_order_relaxed);
+  return result;
+}
@@ -0,0 +1,165 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the admission control of the accepted connections.
+
+#ifndef EPOLL_ADMISSION_CONTROL_H__
+#define EPOLL_ADMISSION_CONTROL_H__
+
+#include <netinet/in.h>
+#include <atomic>
+#include <memory>
+#include <common.h>
+
+enum AdmissionResult {
+  ADMISSION_ACCEPTED,
+  ADMISSION_REJECTED_CONNECTIONS,     // the server has too many connections
+  ADMISSION_REJECTED_IP_CONNECTIONS,  // the source has too many connections
+  ADMISSION_REJECTED_IP_RATE,         // the source connects too fast
+  ADMISSION_REJECTED_RATE             // the server is connected too fast
+};
+
+/// The limits of the accepted connections, 0 for no limit
+struct AdmissionOptions {
+  // the max connections of the server
+  int max_connections;
+  // the max connections of one source address
+  int max_connections_per_ip;
+  // the new connections per second of the server, and the burst allowed
+  // above the rate, the burst defaults to one second of the rate
+  double connection_rate;
+  double connection_burst;
+  // the new connections per second of one source address, and the burst
+  double ip_connection_rate;
+  double ip_connection_burst;
+  // the slots of the source address table, rounded up to a power of two.
+  // The sources beyond the table are only limited by the server limits
+  int ip_table_size;
+
+  AdmissionOptions()
+    : max_connections(0)
+    , max_connections_per_ip(0)
+    , connection_rate(0)
+    , connection_burst(0)
+    , ip_connection_rate(0)
+    , ip_connection_burst(0)
+    , ip_table_size(65536) {
+  }
+
+  bool enabled() const {
+    return max_connections > 0 || max_connections_per_ip > 0 ||
+      connection_rate > 0 || ip_connection_rate > 0;
+  }
+};
+
+/// The counters of the admission control
+struct AdmissionStats {
+  // the admitted connections still open
+  int connections;
+  uint64_t accepted;
+  uint64_t rejected_connections;
+  uint64_t rejected_ip_connections;
+  uint64_t rejected_ip_rate;
+  uint64_t rejected_rate;
+  // the admitted connections whose source found no slot in the table
+  uint64_t untracked;
+};
+
+/// The connection admission of the server. Admit is called on the listen
+/// thread right after accepting, before any session exists, the refused
+/// sockets are closed at once. Release is called on the service threads
+/// when an admitted connection closed.
+///
+/// The sources are kept in an open addressing table of IPv4 addresses.
+/// Only the listen thread writes the keys and the token buckets; the
+/// connection counts are atomic to be released by the service threads.
+/// The slots are never emptied, a slot without connections and with a
+/// full bucket is reused by another source, so that a probing release
+/// never misses its key. A connection admitted while its source found
+/// no slot is not tracked, its release leaves the count of a slot taken
+/// by the source later alone.
+class AdmissionControl {
+ public:
+  explicit AdmissionControl(const AdmissionOptions& options);
+
+  // Decide on the connection from the address, now in microseconds.
+  // The admitted connection should be released when it closed, tracked
+  // tells whether it was counted on its source
+  AdmissionResult Admit(const sockaddr_in& address, int64_t now,
+    bool* tracked);
+
+  // Release an admitted connection with the tracked flag of its Admit,
+  // could be called from any thread
+  void Release(const sockaddr_in& address, bool tracked);
+
+  AdmissionStats stats() const;
+
+  const AdmissionOptions& options() const {
+    return options_;
+  }
+
+ private:
+  // the max slots probed for a source
+  static const int kMaxProbes = 32;
+
+  // the token bucket, refilled on taking
+  struct TokenBucket {
+    double tokens;
+    int64_t last_time;
+
+    void Reset(double burst, int64_t now) {
+      tokens = burst;
+      last_time = now;
+    }
+
+    // refill the tokens for the time passed, returns whether one is left
+    bool Refill(double rate, double burst, int64_t now);
+  };
+
+  struct Slot {
+    // the source address in network order, 0 for a slot never used
+    std::atomic<uint32_t> ip;
+    std::atomic<int> connections;
+    TokenBucket bucket;
+  };
+
+  // the home slot of the source
+  uint32_t Hash(uint32_t ip) const {
+    return (ip * 2654435761u) >> shift_;
+  }
+
+  // the slot of the source, a free slot is taken for a new source,
+  // nullptr when the probed slots are all busy
+  Slot* FindOrInsert(uint32_t ip, int64_t now);
+
+  AdmissionResult Reject(AdmissionResult result,
+    std::atomic<uint64_t>* counter) {
+    counter->fetch_add(1, std::memory_order_relaxed);
+    return result;
+  }
+
+  AdmissionOptions options_;
+  // whether the sources are tracked
+  bool tracking_;
+  std::unique_ptr<Slot[]> slots_;
+  uint32_t mask_;
+  int shift_;
+  // the server bucket
+  TokenBucket bucket_;
+  std::atomic<int> connections_;
+  std::atomic<uint64_t> accepted_;
+  std::atomic<uint64_t> rejected_connections_;
+  std::atomic<uint64_t> rejected_ip_connections_;
+  std::atomic<uint64_t> rejected_ip_rate_;
+  std::atomic<uint64_t> rejected_rate_;
+  std::atomic<uint64_t> untracked_;
+  // Disable copying of AdmissionControl
+  DISALLOW_CONSTRUCTORS(AdmissionControl);
+};
+
+#endif // EPOLL_ADMISSION_CONTROL_H__
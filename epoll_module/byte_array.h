@@ -13,12 +13,14 @@
 #include <common.h>
 
 #include <vector>
+#include <checksum.h>
 #include <memory_allocator.h>
 
 class ByteArray {
  public:
   ByteArray()
-    : size_(0) {
+    : offset_(0)
+    , size_(0) {
     // nothing
   }
   ~ByteArray() {
@@ -27,58 +29,62 @@ class ByteArray {
 
   void Write(const uint8_t* buffer, int size) {
     if (0 == size) return;
-    allocator_.Ensure(size_ + size);
-    memcpy(allocator_.memory() + size_, buffer, size);
+    Reserve(size);
+    memcpy(allocator_.memory() + offset_ + size_, buffer, size);
     size_ += size;
   }
 
   void Write(uint8_t byte) {
-    allocator_.Ensure(size_ + 1);
-    allocator_.memory()[size_] = byte;
+    Reserve(1);
+    allocator_.memory()[offset_ + size_] = byte;
     size_ += 1;
   }
 
   uint8_t* Increment(int added) {
-    allocator_.Ensure(size_ + added);
+    Reserve(added);
     int old_size = size_;
     size_ += added;
-    return allocator_.memory() + old_size;
+    return allocator_.memory() + offset_ + old_size;
   }
 
+  // Removes the size bytes from the front, it only moves the read cursor
   void Shrink(int size) {
-    memmove(begin(), begin() + size, size_ - size);
+    if (size >= size_) {
+      Clear();
+      return;
+    }
+    offset_ += size;
     size_ -= size;
   }
 
   void Clear() {
+    offset_ = 0;
     size_ = 0;
   }
 
+  // Exchanges the content with the other byte array without copying
+  void Swap(ByteArray* other) {
+    allocator_.Swap(&other->allocator_);
+    int offset = offset_;
+    int size = size_;
+    offset_ = other->offset_;
+    size_ = other->size_;
+    other->offset_ = offset;
+    other->size_ = size;
+  }
+
   uint32_t CalculateSum() {
-    uint32_t result = 0;
-    uint8_t* buf = allocator_.memory();
-    int length = size_;
-    while (length > 8) {
-      result += buf[0];
-      result += buf[1];
-      result += buf[2];
-      result += buf[3];
-      result += buf[4];
-      result += buf[5];
-      result += buf[6];
-      result += buf[7];
-      length -= 8;
-      buf += 8;
-    }
-    for (int i = 0; i < length; ++i) {
-      result += buf[i];
-    }
-    return result;
+    return ByteSum(0, allocator_.memory() + offset_, size_);
+  }
+
+  // the CRC32C continued from the crc of the previous segments
+  uint32_t CalculateCrc32c(uint32_t crc = 0) const {
+    return Crc32c(crc, allocator_.memory() + offset_, size_);
   }
 
   const uint8_t* begin() const {
     if (0 == size_) return nullptr;
-    return allocator_.memory();
+    return allocator_.memory() + offset_;
   }
 
   const uint8_t* end() const {
@@ -88,7 +94,7 @@ class ByteArray {
 
   uint8_t* begin() {
     if (0 == size_) return nullptr;
-    return allocator_.memory();
+    return allocator_.memory() + offset_;
   }
 
   int size() const {
@@ -96,7 +102,20 @@ class ByteArray {
   }
 
  private:
+  // Ensures the space of the added bytes after the content. The consumed
+  // front is reclaimed only when the content is not larger than it, so
+  // every byte is moved at most once per consumed byte.
+  void Reserve(int added) {
+    if (offset_ > 0 && offset_ >= size_) {
+      memmove(allocator_.memory(), allocator_.memory() + offset_, size_);
+      offset_ = 0;
+    }
+    allocator_.Ensure(offset_ + size_ + added);
+  }
+
   MemoryAllocator allocator_;
+  // the read cursor
+  int offset_;
   // the data size
   int size_;
 
@@ -0,0 +1,224 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <checksum.h>
+
+#include <string.h>
+#ifdef EPOLL_SCAN_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// the reflected Castagnoli polynomial
+const uint32_t kCrc32cPolynomial = 0x82f63b78;
+
+// The slice-by-8 tables, table[k][b] is the crc of the byte b followed by
+// k zero bytes
+struct Crc32cTables {
+  uint32_t table[8][256];
+
+  Crc32cTables() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int j = 0; j < 8; ++j) {
+        crc = (crc >> 1) ^ (kCrc32cPolynomial & (0 - (crc & 1)));
+      }
+      table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (int k = 1; k < 8; ++k) {
+        table[k][i] = (table[k - 1][i] >> 8) ^
+          table[0][table[k - 1][i] & 0xff];
+      }
+    }
+  }
+};
+
+const Crc32cTables crc32c_tables;
+
+}  // namespace
+
+uint32_t Crc32cSliceBy8(uint32_t crc, const uint8_t* data, size_t size) {
+  const uint32_t (*table)[256] = crc32c_tables.table;
+  crc = ~crc;
+  while (size >= 8) {
+    uint32_t low;
+    uint32_t high;
+    memcpy(&low, data, 4);
+    memcpy(&high, data + 4, 4);
+    low ^= crc;
+    crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^
+      table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+      table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^
+      table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+    data += 8;
+    size -= 8;
+  }
+  while (size-- > 0) {
+    crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xff];
+  }
+  return ~crc;
+}
+
+uint32_t ByteSumScalar(uint32_t sum, const uint8_t* data, size_t size) {
+  while (size >= 8) {
+    sum += data[0];
+    sum += data[1];
+    sum += data[2];
+    sum += data[3];
+    sum += data[4];
+    sum += data[5];
+    sum += data[6];
+    sum += data[7];
+    size -= 8;
+    data += 8;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+#ifdef EPOLL_SCAN_X86
+
+__attribute__((target("sse4.2")))
+uint32_t Crc32cSse42(uint32_t crc, const uint8_t* data, size_t size) {
+  crc = ~crc;
+#ifdef __x86_64__
+  uint64_t crc64 = crc;
+  while (size >= 8) {
+    uint64_t value;
+    memcpy(&value, data, 8);
+    crc64 = _mm_crc32_u64(crc64, value);
+    data += 8;
+    size -= 8;
+  }
+  crc = static_cast<uint32_t>(crc64);
+#endif
+  while (size >= 4) {
+    uint32_t value;
+    memcpy(&value, data, 4);
+    crc = _mm_crc32_u32(crc, value);
+    data += 4;
+    size -= 4;
+  }
+  while (size-- > 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+  }
+  return ~crc;
+}
+
+__attribute__((target("sse2")))
+uint32_t ByteSumSse2(uint32_t sum, const uint8_t* data, size_t size) {
+  // psadbw against zero sums 8 bytes into each 64 bits lane
+  const __m128i zero = _mm_setzero_si128();
+  __m128i total = _mm_setzero_si128();
+  while (size >= 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    total = _mm_add_epi64(total, _mm_sad_epu8(block, zero));
+    data += 16;
+    size -= 16;
+  }
+  total = _mm_add_epi64(total, _mm_unpackhi_epi64(total, total));
+  sum += static_cast<uint32_t>(_mm_cvtsi128_si32(total));
+  return ByteSumScalar(sum, data, size);
+}
+
+__attribute__((target("avx2")))
+uint32_t ByteSumAvx2(uint32_t sum, const uint8_t* data, size_t size) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i total = _mm256_setzero_si256();
+  while (size >= 32) {
+    __m256i block = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(data));
+    total = _mm256_add_epi64(total, _mm256_sad_epu8(block, zero));
+    data += 32;
+    size -= 32;
+  }
+  __m128i half = _mm_add_epi64(_mm256_castsi256_si128(total),
+    _mm256_extracti128_si256(total, 1));
+  half = _mm_add_epi64(half, _mm_unpackhi_epi64(half, half));
+  sum += static_cast<uint32_t>(_mm_cvtsi128_si32(half));
+  return ByteSumSse2(sum, data, size);
+}
+
+bool SupportSse42() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2") != 0;
+}
+
+#endif
+
+namespace {
+
+typedef uint32_t (*ChecksumFunction)(uint32_t, const uint8_t*, size_t);
+
+ChecksumFunction SelectCrc32c() {
+#ifdef EPOLL_SCAN_X86
+  if (SupportSse42()) {
+    return Crc32cSse42;
+  }
+#endif
+  return Crc32cSliceBy8;
+}
+
+ChecksumFunction SelectByteSum() {
+#ifdef EPOLL_SCAN_X86
+  if (SupportAvx2()) {
+    return ByteSumAvx2;
+  }
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    return ByteSumSse2;
+  }
+#endif
+  return ByteSumScalar;
+}
+
+const ChecksumFunction crc32c = SelectCrc32c();
+const ChecksumFunction byte_sum = SelectByteSum();
+
+const char kHexDigits[] = "0123456789abcdef";
+
+}  // namespace
+
+uint32_t Crc32c(uint32_t crc, const uint8_t* data, size_t size) {
+  return crc32c(crc, data, size);
+}
+
+uint32_t ByteSum(uint32_t sum, const uint8_t* data, size_t size) {
+  return byte_sum(sum, data, size);
+}
+
+void FormatCrc32c(uint32_t crc, char* text) {
+  for (int i = kCrc32cTextSize - 1; i >= 0; --i) {
+    text[i] = kHexDigits[crc & 0xf];
+    crc >>= 4;
+  }
+}
+
+bool ParseCrc32c(const uint8_t* text, uint32_t* crc) {
+  uint32_t result = 0;
+  for (int i = 0; i < kCrc32cTextSize; ++i) {
+    uint8_t c = text[i];
+    uint32_t digit = 0;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      return false;
+    }
+    result = (result << 4) | digit;
+  }
+  *crc = result;
+  return true;
+}
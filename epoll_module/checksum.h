@@ -0,0 +1,43 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the CRC32C and the byte sum checksums.
+
+#ifndef EPOLL_CHECKSUM_H__
+#define EPOLL_CHECKSUM_H__
+
+#include <stddef.h>
+#include <common.h>
+#include <delimiter_scanner.h>
+
+/// Updates the CRC32C (Castagnoli) of the data, crc is the result over
+/// the previous segments or 0 for the first one, so a segmented buffer is
+/// checked by feeding its segments in order. The kernel is selected once
+/// by the CPU features, SSE4.2 or slice-by-8.
+uint32_t Crc32c(uint32_t crc, const uint8_t* data, size_t size);
+
+/// Updates the sum of the bytes, it is weaker than the CRC but cheaper.
+uint32_t ByteSum(uint32_t sum, const uint8_t* data, size_t size);
+
+// the hex text of the crc, 8 characters without the terminator
+static const int kCrc32cTextSize = 8;
+void FormatCrc32c(uint32_t crc, char* text);
+// returns false when the text is not 8 hex characters
+bool ParseCrc32c(const uint8_t* text, uint32_t* crc);
+
+// The kernels, exposed for the benchmark
+uint32_t Crc32cSliceBy8(uint32_t crc, const uint8_t* data, size_t size);
+uint32_t ByteSumScalar(uint32_t sum, const uint8_t* data, size_t size);
+#ifdef EPOLL_SCAN_X86
+uint32_t Crc32cSse42(uint32_t crc, const uint8_t* data, size_t size);
+uint32_t ByteSumSse2(uint32_t sum, const uint8_t* data, size_t size);
+uint32_t ByteSumAvx2(uint32_t sum, const uint8_t* data, size_t size);
+bool SupportSse42();
+#endif
+
+#endif // EPOLL_CHECKSUM_H__
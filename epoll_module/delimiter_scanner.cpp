@@ -0,0 +1,102 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <delimiter_scanner.h>
+
+#ifdef EPOLL_SCAN_X86
+#include <immintrin.h>
+#endif
+
+int FindDelimiterScalar(const uint8_t* data, int size, uint8_t delimiter) {
+  for (int i = 0; i < size; ++i) {
+    if (data[i] == delimiter) {
+      return i;
+    }
+  }
+  return size;
+}
+
+#ifdef EPOLL_SCAN_X86
+
+__attribute__((target("sse2")))
+int FindDelimiterSse2(const uint8_t* data, int size, uint8_t delimiter) {
+  const __m128i pattern = _mm_set1_epi8(static_cast<char>(delimiter));
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(data + i));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + FindDelimiterScalar(data + i, size - i, delimiter);
+}
+
+__attribute__((target("avx2")))
+int FindDelimiterAvx2(const uint8_t* data, int size, uint8_t delimiter) {
+  const __m256i pattern = _mm256_set1_epi8(static_cast<char>(delimiter));
+  int i = 0;
+  // two blocks per step, the masks are only extracted on a hit
+  for (; i + 64 <= size; i += 64) {
+    __m256i low = _mm256_cmpeq_epi8(_mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(data + i)), pattern);
+    __m256i high = _mm256_cmpeq_epi8(_mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(data + i + 32)), pattern);
+    if (!_mm256_testz_si256(_mm256_or_si256(low, high),
+      _mm256_or_si256(low, high))) {
+      uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(low));
+      if (mask != 0) {
+        return i + __builtin_ctz(mask);
+      }
+      mask = static_cast<uint32_t>(_mm256_movemask_epi8(high));
+      return i + 32 + __builtin_ctz(mask);
+    }
+  }
+  for (; i + 32 <= size; i += 32) {
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(data + i)), pattern)));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + FindDelimiterSse2(data + i, size - i, delimiter);
+}
+
+bool SupportAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+}
+
+#endif
+
+namespace {
+
+typedef int (*FindDelimiterFunction)(const uint8_t*, int, uint8_t);
+
+FindDelimiterFunction SelectFindDelimiter() {
+#ifdef EPOLL_SCAN_X86
+  if (SupportAvx2()) {
+    return FindDelimiterAvx2;
+  }
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    return FindDelimiterSse2;
+  }
+#endif
+  return FindDelimiterScalar;
+}
+
+const FindDelimiterFunction find_delimiter = SelectFindDelimiter();
+
+}  // namespace
+
+int FindDelimiter(const uint8_t* data, int size, uint8_t delimiter) {
+  return find_delimiter(data, size, delimiter);
+}
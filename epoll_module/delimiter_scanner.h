@@ -0,0 +1,33 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the vectorized scanning of the message delimiters.
+
+#ifndef EPOLL_DELIMITER_SCANNER_H__
+#define EPOLL_DELIMITER_SCANNER_H__
+
+#include <common.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define EPOLL_SCAN_X86
+#endif
+
+/// Returns the offset of the first byte equal to the delimiter, or size
+/// when there is none. The kernel is selected once by the CPU features,
+/// AVX2 scans 64 bytes and SSE2 scans 16 bytes per step.
+int FindDelimiter(const uint8_t* data, int size, uint8_t delimiter);
+
+// The kernels, exposed for the benchmark
+int FindDelimiterScalar(const uint8_t* data, int size, uint8_t delimiter);
+#ifdef EPOLL_SCAN_X86
+int FindDelimiterSse2(const uint8_t* data, int size, uint8_t delimiter);
+int FindDelimiterAvx2(const uint8_t* data, int size, uint8_t delimiter);
+bool SupportAvx2();
+#endif
+
+#endif // EPOLL_DELIMITER_SCANNER_H__
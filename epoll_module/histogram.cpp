@@ -0,0 +1,105 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <histogram.h>
+
+#include <limits>
+
+Histogram::Histogram()
+  : buckets_(kBucketCount, 0)
+  , count_(0)
+  , min_(std::numeric_limits<int64_t>::max())
+  , max_(0)
+  , sum_(0) {
+}
+
+int Histogram::BucketOf(uint64_t value) {
+  if (value < static_cast<uint64_t>(kSubBucketCount)) {
+    return static_cast<int>(value);
+  }
+  // the value keeps its kSubBucketBits highest bits
+  int shift = 63 - __builtin_clzll(value) - (kSubBucketBits - 1);
+  return shift * kSubBucketHalfCount + static_cast<int>(value >> shift);
+}
+
+int64_t Histogram::BucketHighest(int bucket) {
+  if (bucket < kSubBucketCount) {
+    return bucket;
+  }
+  int shift = bucket / kSubBucketHalfCount - 1;
+  uint64_t mantissa = bucket - shift * kSubBucketHalfCount;
+  uint64_t highest = ((mantissa + 1) << shift) - 1;
+  if (highest > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  return static_cast<int64_t>(highest);
+}
+
+void Histogram::Record(int64_t value) {
+  Record(value, 1);
+}
+
+void Histogram::Record(int64_t value, uint64_t count) {
+  if (value < 0) {
+    value = 0;
+  }
+  buckets_[BucketOf(value)] += count;
+  count_ += count;
+  sum_ += value * static_cast<int64_t>(count);
+  if (value < min_) {
+    min_ = value;
+  }
+  if (value > max_) {
+    max_ = value;
+  }
+}
+
+void Histogram::Merge(const Histogram& other) {
+  for (int i = 0; i < kBucketCount; ++i) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  if (other.min_ < min_) {
+    min_ = other.min_;
+  }
+  if (other.max_ > max_) {
+    max_ = other.max_;
+  }
+}
+
+void Histogram::Reset() {
+  buckets_.assign(kBucketCount, 0);
+  count_ = 0;
+  min_ = std::numeric_limits<int64_t>::max();
+  max_ = 0;
+  sum_ = 0;
+}
+
+int64_t Histogram::Percentile(double percentile) const {
+  if (0 == count_) {
+    return 0;
+  }
+  // the rank of the value, the highest value for 100
+  uint64_t rank = static_cast<uint64_t>(percentile / 100 * count_ + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  if (rank > count_) {
+    rank = count_;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < kBucketCount; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      int64_t highest = BucketHighest(i);
+      return highest < max_ ? highest : max_;
+    }
+  }
+  return max_;
+}
@@ -0,0 +1,79 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the log-linear histogram of the latencies.
+
+#ifndef EPOLL_HISTOGRAM_H__
+#define EPOLL_HISTOGRAM_H__
+
+#include <vector>
+#include <common.h>
+
+/// This class counts the values into log-linear buckets as the HDR
+/// histograms do: every power of two is split into the same count of
+/// linear buckets, so the relative error is bounded whatever the value.
+/// A histogram is owned by one thread, those of several threads are
+/// merged once they stopped recording.
+class Histogram {
+ public:
+  // the linear buckets of a power of two are 2^(kSubBucketBits - 1), the
+  // values are kept within 1/64 of their magnitude
+  static const int kSubBucketBits = 7;
+  static const int kSubBucketCount = 1 << kSubBucketBits;
+  static const int kSubBucketHalfCount = kSubBucketCount / 2;
+  static const int kBucketCount =
+    (64 - kSubBucketBits + 2) * kSubBucketHalfCount;
+
+  Histogram();
+
+  // Counts the value, the negative values are counted as 0
+  void Record(int64_t value);
+
+  // Counts the value several times
+  void Record(int64_t value, uint64_t count);
+
+  // Adds the counts of the other histogram
+  void Merge(const Histogram& other);
+
+  void Reset();
+
+  // the highest value of the bucket where the percentile falls, 0 when
+  // empty
+  int64_t Percentile(double percentile) const;
+
+  uint64_t count() const {
+    return count_;
+  }
+
+  int64_t min() const {
+    return 0 == count_ ? 0 : min_;
+  }
+
+  int64_t max() const {
+    return max_;
+  }
+
+  double mean() const {
+    return 0 == count_ ? 0 : static_cast<double>(sum_) / count_;
+  }
+
+ private:
+  // the bucket of the value
+  static int BucketOf(uint64_t value);
+
+  // the highest value of the bucket
+  static int64_t BucketHighest(int bucket);
+
+  std::vector<uint64_t> buckets_;
+  uint64_t count_;
+  int64_t min_;
+  int64_t max_;
+  int64_t sum_;
+};
+
+#endif // EPOLL_HISTOGRAM_H__
@@ -0,0 +1,313 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <http_codec.h>
+
+#include <string.h>
+#include <delimiter_scanner.h>
+#include <tcp_session.h>
+
+namespace {
+
+// the max content length accepted, larger bodies are rejected before
+// being buffered
+const int64_t kMaxContentLength = 0x7fffffff;
+
+char ToLower(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+HttpView Trim(const char* begin, const char* end) {
+  while (begin < end && (*begin == ' ' || *begin == '\t')) ++begin;
+  while (end > begin && (end[-1] == ' ' || end[-1] == '\t')) --end;
+  HttpView view = { begin, static_cast<int>(end - begin) };
+  return view;
+}
+
+// Finds the end of the line starting at the offset, returns the offset
+// of the \n or -1 when the line is incomplete. The line ends at the \r if
+// there is one.
+int FindLine(const char* data, int size, int offset, int* line_end) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  int found = offset + FindDelimiter(bytes + offset, size - offset, '\n');
+  if (found == size) {
+    return -1;
+  }
+  *line_end = (found > offset && data[found - 1] == '\r') ? found - 1 : found;
+  return found;
+}
+
+bool ParseDecimal(const HttpView& view, int64_t* value) {
+  if (0 == view.size) return false;
+  int64_t result = 0;
+  for (int i = 0; i < view.size; ++i) {
+    char c = view.data[i];
+    if (c < '0' || c > '9' || result > kMaxContentLength) {
+      return false;
+    }
+    result = result * 10 + (c - '0');
+  }
+  *value = result;
+  return result <= kMaxContentLength;
+}
+
+// the value of a hex digit, or -1
+int HexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c = ToLower(c);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// whether the comma separated header value has the token
+bool HasToken(const HttpView& value, const char* token) {
+  const char* begin = value.data;
+  const char* end = value.data + value.size;
+  while (begin < end) {
+    const char* comma = begin;
+    while (comma < end && *comma != ',') ++comma;
+    if (Trim(begin, comma).EqualsIgnoreCase(token)) {
+      return true;
+    }
+    begin = comma + 1;
+  }
+  return false;
+}
+
+}  // namespace
+
+bool HttpView::Equals(const char* text) const {
+  return static_cast<int>(strlen(text)) == size &&
+    memcmp(data, text, size) == 0;
+}
+
+bool HttpView::EqualsIgnoreCase(const char* text) const {
+  for (int i = 0; i < size; ++i) {
+    if ('\0' == text[i] || ToLower(data[i]) != ToLower(text[i])) {
+      return false;
+    }
+  }
+  return '\0' == text[size];
+}
+
+const HttpView* HttpRequest::FindHeader(const char* name) const {
+  for (int i = 0; i < header_count; ++i) {
+    if (headers[i].name.EqualsIgnoreCase(name)) {
+      return &headers[i].value;
+    }
+  }
+  return nullptr;
+}
+
+int HttpParser::Parse(const uint8_t* data, int size, HttpRequest* request) {
+  const char* text = reinterpret_cast<const char*>(data);
+  int64_t content_length = 0;
+  bool chunked = false;
+  int head = ParseHead(text, size, request, &content_length, &chunked);
+  if (head <= 0) {
+    return head;
+  }
+  if (chunked) {
+    int body = ParseChunked(text + head, size - head);
+    if (body <= 0) {
+      return body;
+    }
+    request->body.data = reinterpret_cast<const char*>(body_.begin());
+    request->body.size = body_.size();
+    return head + body;
+  }
+  if (size - head < content_length) {
+    return 0;
+  }
+  request->body.data = text + head;
+  request->body.size = static_cast<int>(content_length);
+  return head + static_cast<int>(content_length);
+}
+
+int HttpParser::ParseHead(const char* data, int size, HttpRequest* request,
+  int64_t* content_length, bool* chunked) {
+  // the request line, METHOD SP target SP HTTP/1.x
+  int line_end = 0;
+  int found = FindLine(data, size, 0, &line_end);
+  if (found < 0) {
+    return 0;
+  }
+  const char* line = data;
+  const char* end = data + line_end;
+  const char* space = static_cast<const char*>(memchr(line, ' ', end - line));
+  if (nullptr == space || space == line) {
+    return EPOLL_INVALID;
+  }
+  request->method.data = line;
+  request->method.size = static_cast<int>(space - line);
+  const char* target = space + 1;
+  space = static_cast<const char*>(memchr(target, ' ', end - target));
+  if (nullptr == space || space == target || end - space != 9 ||
+    memcmp(space + 1, "HTTP/1.", 7) != 0 ||
+    (space[8] != '0' && space[8] != '1')) {
+    return EPOLL_INVALID;
+  }
+  request->target.data = target;
+  request->target.size = static_cast<int>(space - target);
+  request->minor_version = space[8] - '0';
+  request->header_count = 0;
+  request->body.data = nullptr;
+  request->body.size = 0;
+
+  // the header lines until an empty line
+  bool close = false;
+  bool keep_alive = false;
+  *content_length = 0;
+  *chunked = false;
+  int offset = found + 1;
+  for (;;) {
+    found = FindLine(data, size, offset, &line_end);
+    if (found < 0) {
+      return 0;
+    }
+    if (line_end == offset) {
+      offset = found + 1;
+      break;
+    }
+    line = data + offset;
+    end = data + line_end;
+    const char* colon = static_cast<const char*>(memchr(line, ':', end - line));
+    if (nullptr == colon || colon == line ||
+      request->header_count == HttpRequest::kMaxHeaders) {
+      return EPOLL_INVALID;
+    }
+    HttpHeader& header = request->headers[request->header_count++];
+    header.name.data = line;
+    header.name.size = static_cast<int>(colon - line);
+    header.value = Trim(colon + 1, end);
+    if (header.name.EqualsIgnoreCase("content-length")) {
+      if (!ParseDecimal(header.value, content_length)) {
+        return EPOLL_INVALID;
+      }
+    } else if (header.name.EqualsIgnoreCase("transfer-encoding")) {
+      *chunked = HasToken(header.value, "chunked");
+    } else if (header.name.EqualsIgnoreCase("connection")) {
+      close = HasToken(header.value, "close");
+      keep_alive = HasToken(header.value, "keep-alive");
+    }
+    offset = found + 1;
+  }
+  request->keep_alive = request->minor_version == 1 ? !close : keep_alive;
+  return offset;
+}
+
+int HttpParser::ParseChunked(const char* data, int size) {
+  body_.Clear();
+  int offset = 0;
+  int line_end = 0;
+  for (;;) {
+    // the chunk size line, the extensions after ; are ignored
+    int found = FindLine(data, size, offset, &line_end);
+    if (found < 0) {
+      return 0;
+    }
+    int64_t chunk_size = 0;
+    int digits = 0;
+    for (int i = offset; i < line_end; ++i, ++digits) {
+      int value = HexValue(data[i]);
+      if (value < 0) {
+        break;
+      }
+      chunk_size = chunk_size * 16 + value;
+      if (chunk_size > kMaxContentLength) {
+        return EPOLL_INVALID;
+      }
+    }
+    if (0 == digits) {
+      return EPOLL_INVALID;
+    }
+    offset = found + 1;
+    if (0 == chunk_size) {
+      break;
+    }
+    if (size - offset < chunk_size + 2) {
+      return 0;
+    }
+    body_.Write(reinterpret_cast<const uint8_t*>(data + offset),
+      static_cast<int>(chunk_size));
+    offset += static_cast<int>(chunk_size);
+    if (data[offset] != '\r' || data[offset + 1] != '\n') {
+      return EPOLL_INVALID;
+    }
+    offset += 2;
+  }
+  // the trailers until an empty line
+  for (;;) {
+    int found = FindLine(data, size, offset, &line_end);
+    if (found < 0) {
+      return 0;
+    }
+    bool empty = line_end == offset;
+    offset = found + 1;
+    if (empty) {
+      return offset;
+    }
+  }
+}
+
+HttpResponseHeader::HttpResponseHeader(int status, const char* reason,
+  const char* content_type) {
+  prefix_ = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n";
+  prefix_ += "Server: epoll_module\r\n";
+  if (content_type != nullptr) {
+    prefix_ += "Content-Type: ";
+    prefix_ += content_type;
+    prefix_ += "\r\n";
+  }
+  prefix_ += "Content-Length: ";
+}
+
+int HttpResponseHeader::Send(TCPSession* session, const uint8_t* body,
+  int size, bool keep_alive, int minor_version) const {
+  static const char kKeepAlive[] = "\r\n\r\n";
+  // the connections of HTTP/1.0 are closed unless told otherwise
+  static const char kKeepAlive10[] = "\r\nConnection: keep-alive\r\n\r\n";
+  static const char kClose[] = "\r\nConnection: close\r\n\r\n";
+  // the content length and the end of the headers
+  char tail[64];
+  char digits[16];
+  int count = 0;
+  unsigned int length = static_cast<unsigned int>(size);
+  do {
+    digits[count++] = static_cast<char>('0' + length % 10);
+    length /= 10;
+  } while (length > 0);
+  int tail_size = 0;
+  while (count > 0) {
+    tail[tail_size++] = digits[--count];
+  }
+  const char* end = kClose;
+  int end_size = static_cast<int>(sizeof(kClose) - 1);
+  if (keep_alive && 0 == minor_version) {
+    end = kKeepAlive10;
+    end_size = static_cast<int>(sizeof(kKeepAlive10) - 1);
+  } else if (keep_alive) {
+    end = kKeepAlive;
+    end_size = static_cast<int>(sizeof(kKeepAlive) - 1);
+  }
+  memcpy(tail + tail_size, end, end_size);
+  tail_size += end_size;
+
+  CHECK_RESULT(session->Send(
+    reinterpret_cast<const uint8_t*>(prefix_.data()),
+    static_cast<int>(prefix_.size())));
+  CHECK_RESULT(session->Send(reinterpret_cast<const uint8_t*>(tail),
+    tail_size));
+  if (size > 0) {
+    CHECK_RESULT(session->Send(body, size));
+  }
+  if (!keep_alive) {
+    session->ShutdownAfterSend();
+  }
+  return 0;
+}
@@ -0,0 +1,120 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the HTTP/1.1 request parser and the response writer.
+
+#ifndef EPOLL_HTTP_CODEC_H__
+#define EPOLL_HTTP_CODEC_H__
+
+#include <string>
+#include <common.h>
+#include <byte_array.h>
+
+class TCPSession;
+
+/// A view into the received bytes, it is not terminated
+struct HttpView {
+  const char* data;
+  int size;
+
+  bool Equals(const char* text) const;
+  // compare ignoring the case of the letters
+  bool EqualsIgnoreCase(const char* text) const;
+};
+
+struct HttpHeader {
+  HttpView name;
+  HttpView value;
+};
+
+/// The parsed request, the views point into the receive buffer or the
+/// reassembly buffer of the parser and they are only valid during the
+/// handler call
+struct HttpRequest {
+  static const int kMaxHeaders = 32;
+
+  HttpView method;
+  HttpView target;
+  // the x of HTTP/1.x
+  int minor_version;
+  HttpHeader headers[kMaxHeaders];
+  int header_count;
+  // the body, decoded if it was chunked
+  HttpView body;
+  // whether the connection should be kept after the response
+  bool keep_alive;
+
+  // Returns nullptr when the header is not found
+  const HttpView* FindHeader(const char* name) const;
+};
+
+/// The handler of the HTTP requests
+class HttpHandler {
+ public:
+  // Default empty virtual destructor
+  virtual ~HttpHandler() {}
+  // Get called for every request in the order of receiving, the response
+  // should be sent before returning so that the responses of pipelined
+  // requests keep their order. Returns nonzero to stop the session.
+  virtual int OnRequest(TCPSession* session, const HttpRequest& request) = 0;
+};
+
+/// The incremental request parser of a session
+class HttpParser {
+ public:
+  HttpParser() {}
+
+  // Parses a request at the front of the data. Returns the size of the
+  // request, 0 when it is incomplete, or EPOLL_INVALID when it is
+  // malformed. The data is parsed again from the front when more bytes
+  // arrived.
+  int Parse(const uint8_t* data, int size, HttpRequest* request);
+
+ private:
+  // Parses the headers, returns the size up to the body
+  int ParseHead(const char* data, int size, HttpRequest* request,
+    int64_t* content_length, bool* chunked);
+
+  // Decodes the chunked body into body_, returns the size of the
+  // chunked body
+  int ParseChunked(const char* data, int size);
+
+  // the decoded chunked body
+  ByteArray body_;
+  // Disable copying of HttpParser
+  DISALLOW_CONSTRUCTORS(HttpParser);
+};
+
+/// The pre-serialized status line and headers of a response, the
+/// content length and the connection header are appended per response
+class HttpResponseHeader {
+ public:
+  HttpResponseHeader(int status, const char* reason,
+    const char* content_type);
+
+  // Sends the response, the session would be shut down after the
+  // response was written when the connection should not be kept. The
+  // HTTP/1.0 clients are told when their connection is kept
+  int Send(TCPSession* session, const uint8_t* body, int size,
+    bool keep_alive, int minor_version = 1) const;
+
+  // Sends the response to the request, kept as the request asked
+  int Send(TCPSession* session, const HttpRequest& request,
+    const uint8_t* body, int size) const {
+    return Send(session, body, size, request.keep_alive,
+      request.minor_version);
+  }
+
+ private:
+  // the serialized headers before the content length
+  std::string prefix_;
+  // Disable copying of HttpResponseHeader
+  DISALLOW_CONSTRUCTORS(HttpResponseHeader);
+};
+
+#endif // EPOLL_HTTP_CODEC_H__
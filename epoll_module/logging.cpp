@@ -0,0 +1,344 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <logging.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <spsc_ring.h>
+
+std::atomic<int> Logger::level_(LOG_LEVEL_INFO);
+
+namespace {
+
+const int kLogRingCapacity = 1024;
+const int kLogReadBatch = 64;
+// the wait of the idle logging thread, the writers wake it up when they
+// fill an empty ring, it only bounds the release of the closed rings
+const int kLogIdleWait = 50;            // millisecond
+const size_t kLogOutputSize = 64 * 1024;
+
+const char* kLogLevelNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+// The ring of one thread, it is released by the logging thread after the
+// owner thread exited and the ring was drained
+struct LogBuffer {
+  SpscRing<LogRecord, kLogRingCapacity> ring;
+  std::atomic<uint64_t> dropped;
+  std::atomic<bool> closed;
+
+  LogBuffer() : dropped(0), closed(false) {}
+};
+
+// The logging thread and the rings of all the threads
+class LogCore {
+ public:
+  LogCore()
+    : stopped_(false)
+    , wakeup_(false)
+    , flush_requested_(0)
+    , flush_completed_(0)
+    , dropped_(0)
+    , output_size_(0) {
+  }
+
+  ~LogCore() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    condition_.notify_all();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    for (size_t i = 0; i < buffers_.size(); ++i) {
+      delete buffers_[i];
+    }
+  }
+
+  LogBuffer* Register() {
+    LogBuffer* buffer = new (std::nothrow) LogBuffer();
+    if (nullptr == buffer || buffer->ring.Init() != 0) {
+      delete buffer;
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!thread_.joinable()) {
+      thread_ = std::thread([this]() { Run(); });
+    }
+    buffers_.push_back(buffer);
+    // the new ring is read from the next round
+    wakeup_ = true;
+    condition_.notify_all();
+    return buffer;
+  }
+
+  // wake up the logging thread, a record was flushed to a drained ring
+  void Wake() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wakeup_ = true;
+    }
+    condition_.notify_all();
+  }
+
+  void Flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!thread_.joinable()) {
+      return;
+    }
+    uint64_t request = ++flush_requested_;
+    condition_.notify_all();
+    condition_.wait(lock, [&]() { return flush_completed_ >= request; });
+  }
+
+  uint64_t dropped() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t dropped = dropped_;
+    for (size_t i = 0; i < buffers_.size(); ++i) {
+      dropped += buffers_[i]->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+  }
+
+ private:
+  void Run() {
+    std::vector<LogBuffer*> buffers;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      bool stopped = stopped_;
+      uint64_t request = flush_requested_;
+      buffers = buffers_;
+      wakeup_ = false;
+      lock.unlock();
+
+      // read closed before draining, so the records written before the
+      // owner exited are all drained
+      std::vector<bool> closed(buffers.size());
+      for (size_t i = 0; i < buffers.size(); ++i) {
+        closed[i] = buffers[i]->closed.load(std::memory_order_acquire);
+      }
+      bool written = false;
+      for (size_t i = 0; i < buffers.size(); ++i) {
+        written |= Drain(buffers[i]);
+      }
+      WriteOutput();
+
+      lock.lock();
+      ReleaseClosed(buffers, closed);
+      if (flush_completed_ < request) {
+        flush_completed_ = request;
+        condition_.notify_all();
+      }
+      if (stopped) {
+        return;
+      }
+      if (!written && !wakeup_ && flush_requested_ == request && !stopped_) {
+        condition_.wait_for(lock, std::chrono::milliseconds(kLogIdleWait));
+      }
+    }
+  }
+
+  void ReleaseClosed(const std::vector<LogBuffer*>& buffers,
+    const std::vector<bool>& closed) {
+    for (size_t i = 0; i < buffers.size(); ++i) {
+      if (!closed[i]) {
+        continue;
+      }
+      for (size_t j = 0; j < buffers_.size(); ++j) {
+        if (buffers_[j] == buffers[i]) {
+          dropped_ += buffers[i]->dropped.load(std::memory_order_relaxed);
+          buffers_[j] = buffers_.back();
+          buffers_.pop_back();
+          delete buffers[i];
+          break;
+        }
+      }
+    }
+  }
+
+  bool Drain(LogBuffer* buffer) {
+    LogRecord records[kLogReadBatch];
+    bool written = false;
+    for (;;) {
+      int count = buffer->ring.ReadBatch(records, kLogReadBatch);
+      if (0 == count) {
+        break;
+      }
+      for (int i = 0; i < count; ++i) {
+        Format(records[i]);
+      }
+      written = true;
+    }
+    return written;
+  }
+
+  void Format(const LogRecord& record) {
+    char line[1024];
+    time_t seconds = static_cast<time_t>(record.time / 1000000);
+    struct tm now;
+    localtime_r(&seconds, &now);
+    const char* file = strrchr(record.file, '/');
+    file = nullptr == file ? record.file : file + 1;
+    int size = snprintf(line, sizeof(line),
+      "%04d-%02d-%02d %02d:%02d:%02d.%06d %s %s:%d ",
+      now.tm_year + 1900, now.tm_mon + 1, now.tm_mday,
+      now.tm_hour, now.tm_min, now.tm_sec,
+      static_cast<int>(record.time % 1000000),
+      kLogLevelNames[record.level], file, record.line);
+    if (size < 0) {
+      return;
+    }
+    int limit = static_cast<int>(sizeof(line)) - 1;
+    int arg = 0;
+    for (const char* p = record.format; *p && size < limit; ++p) {
+      if ('{' == p[0] && '}' == p[1] && arg < record.arg_count) {
+        size += FormatArg(record, arg++, line + size, limit - size);
+        ++p;
+      } else {
+        line[size++] = *p;
+      }
+    }
+    if (size > limit) {
+      size = limit;
+    }
+    line[size++] = '\n';
+    Append(line, size);
+  }
+
+  int FormatArg(const LogRecord& record, int arg, char* buffer, int size) {
+    int rst = 0;
+    switch (record.arg_types[arg]) {
+    case LogRecord::ARG_INT:
+      rst = snprintf(buffer, size, "%lld",
+        static_cast<long long>(record.args[arg].i));
+      break;
+    case LogRecord::ARG_UINT:
+      rst = snprintf(buffer, size, "%llu",
+        static_cast<unsigned long long>(record.args[arg].u));
+      break;
+    case LogRecord::ARG_DOUBLE:
+      rst = snprintf(buffer, size, "%g", record.args[arg].d);
+      break;
+    case LogRecord::ARG_POINTER:
+      rst = snprintf(buffer, size, "%p", record.args[arg].p);
+      break;
+    case LogRecord::ARG_TEXT: {
+      uint64_t text = record.args[arg].u;
+      rst = snprintf(buffer, size, "%.*s", static_cast<int>(text >> 32),
+        record.text + static_cast<uint32_t>(text));
+      break;
+    }
+    default:
+      break;
+    }
+    if (rst < 0) {
+      return 0;
+    }
+    return rst < size ? rst : size - 1;
+  }
+
+  void Append(const char* line, int size) {
+    if (output_size_ + size > kLogOutputSize) {
+      WriteOutput();
+    }
+    memcpy(output_ + output_size_, line, size);
+    output_size_ += size;
+  }
+
+  void WriteOutput() {
+    if (0 == output_size_) {
+      return;
+    }
+    fwrite(output_, 1, output_size_, stdout);
+    fflush(stdout);
+    output_size_ = 0;
+  }
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::thread thread_;
+  std::vector<LogBuffer*> buffers_;
+  bool stopped_;
+  // a ring got records after it was drained, or a ring was registered
+  bool wakeup_;
+  uint64_t flush_requested_;
+  uint64_t flush_completed_;
+  // the records dropped by the released rings
+  uint64_t dropped_;
+  // the formatted records, only used by the logging thread
+  char output_[kLogOutputSize];
+  size_t output_size_;
+};
+
+LogCore& GetLogCore() {
+  static LogCore core;
+  return core;
+}
+
+// Marks the ring closed when the owner thread exits
+struct LogBufferHolder {
+  LogBuffer* buffer;
+
+  LogBufferHolder() : buffer(nullptr) {}
+
+  ~LogBufferHolder() {
+    if (buffer != nullptr) {
+      buffer->closed.store(true, std::memory_order_release);
+    }
+  }
+};
+
+thread_local LogBufferHolder log_buffer_holder;
+
+}  // namespace
+
+uint64_t Logger::dropped() {
+  return GetLogCore().dropped();
+}
+
+void Logger::Flush() {
+  GetLogCore().Flush();
+}
+
+void Logger::CaptureText(LogRecord* record, const char* text, size_t size) {
+  size_t offset = record->text_size;
+  size_t available = LogRecord::kTextSize - offset;
+  if (size > available) {
+    size = available;
+  }
+  memcpy(record->text + offset, text, size);
+  record->text_size = static_cast<uint8_t>(offset + size);
+  record->arg_types[record->arg_count] = LogRecord::ARG_TEXT;
+  record->args[record->arg_count].u =
+    (static_cast<uint64_t>(size) << 32) | offset;
+}
+
+void Logger::Commit(const LogRecord& record) {
+  LogBuffer* buffer = log_buffer_holder.buffer;
+  if (nullptr == buffer) {
+    // the logging thread is started by the first registration
+    buffer = GetLogCore().Register();
+    if (nullptr == buffer) {
+      return;
+    }
+    log_buffer_holder.buffer = buffer;
+  }
+  if (buffer->ring.Write(record, false) != 0) {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // the logging thread sleeps once it drained the rings
+  if (!buffer->ring.Flush()) {
+    GetLogCore().Wake();
+  }
+}
@@ -0,0 +1,219 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the asynchronous logging.
+
+#ifndef EPOLL_LOGGING_H__
+#define EPOLL_LOGGING_H__
+
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+#include <common.h>
+
+enum LogLevel {
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARN,
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_OFF
+};
+
+// The levels below it are compiled out
+#ifndef EPOLL_LOG_LEVEL
+#define EPOLL_LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/// The record of one log call. The arguments are captured in binary and
+/// formatted by the logging thread, the format string should be a string
+/// literal using {} as the placeholders of the arguments.
+struct LogRecord {
+  static const int kMaxArgs = 8;
+  static const int kTextSize = 64;
+
+  enum ArgType {
+    ARG_INT,
+    ARG_UINT,
+    ARG_DOUBLE,
+    ARG_POINTER,
+    ARG_TEXT                // copied to text, value is the offset
+  };
+
+  int64_t time;
+  const char* format;
+  const char* file;
+  int line;
+  uint8_t level;
+  uint8_t arg_count;
+  uint8_t text_size;
+  uint8_t arg_types[kMaxArgs];
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const void* p;
+  } args[kMaxArgs];
+  char text[kTextSize];
+};
+
+/// The asynchronous logger. Every thread writes its records to its own
+/// lock-free ring registered on the first log call, a background thread
+/// formats and writes them. A log call never blocks, the record is dropped
+/// when the ring of the thread is full.
+class Logger {
+ public:
+  // the run time level, the records below it are discarded
+  static LogLevel level() {
+    return static_cast<LogLevel>(level_.load(std::memory_order_relaxed));
+  }
+
+  static void set_level(LogLevel level) {
+    level_.store(level, std::memory_order_relaxed);
+  }
+
+  // the count of the records dropped as the rings were full
+  static uint64_t dropped();
+
+  // write out all the records logged so far, the caller blocks until done
+  static void Flush();
+
+  template <typename... Args>
+  static void Log(LogLevel level, const char* file, int line,
+    const char* format, const Args&... args) {
+    LogRecord record;
+    record.time = GetCurrentMicroseconds();
+    record.format = format;
+    record.file = file;
+    record.line = line;
+    record.level = static_cast<uint8_t>(level);
+    record.arg_count = 0;
+    record.text_size = 0;
+    Capture(&record, args...);
+    Commit(record);
+  }
+
+ private:
+  static void Capture(LogRecord* /*record*/) {}
+
+  template <typename T, typename... Args>
+  static void Capture(LogRecord* record, const T& arg,
+    const Args&... args) {
+    if (record->arg_count < LogRecord::kMaxArgs) {
+      CaptureArg(record, arg);
+      ++record->arg_count;
+    }
+    Capture(record, args...);
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value &&
+    std::is_signed<T>::value>::type
+  CaptureArg(LogRecord* record, const T& arg) {
+    record->arg_types[record->arg_count] = LogRecord::ARG_INT;
+    record->args[record->arg_count].i = arg;
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value &&
+    !std::is_signed<T>::value>::type
+  CaptureArg(LogRecord* record, const T& arg) {
+    record->arg_types[record->arg_count] = LogRecord::ARG_UINT;
+    record->args[record->arg_count].u = arg;
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_enum<T>::value>::type
+  CaptureArg(LogRecord* record, const T& arg) {
+    record->arg_types[record->arg_count] = LogRecord::ARG_INT;
+    record->args[record->arg_count].i = static_cast<int64_t>(arg);
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_floating_point<T>::value>::type
+  CaptureArg(LogRecord* record, const T& arg) {
+    record->arg_types[record->arg_count] = LogRecord::ARG_DOUBLE;
+    record->args[record->arg_count].d = arg;
+  }
+
+  template <typename T>
+  static void CaptureArg(LogRecord* record, T* const& arg) {
+    record->arg_types[record->arg_count] = LogRecord::ARG_POINTER;
+    record->args[record->arg_count].p = arg;
+  }
+
+  // the strings are copied as they may not outlive the record
+  static void CaptureArg(LogRecord* record, const char* const& arg) {
+    CaptureText(record, arg, strlen(arg));
+  }
+
+  static void CaptureArg(LogRecord* record, char* const& arg) {
+    CaptureText(record, arg, strlen(arg));
+  }
+
+  template <size_t N>
+  static void CaptureArg(LogRecord* record, const char (&arg)[N]) {
+    CaptureText(record, arg, strlen(arg));
+  }
+
+  static void CaptureText(LogRecord* record, const char* text, size_t size);
+
+  // queue the record to the ring of the calling thread
+  static void Commit(const LogRecord& record);
+
+  static std::atomic<int> level_;
+};
+
+/// The per call site rate limiter, it allows at most limit records per
+/// second
+class LogRateLimiter {
+ public:
+  explicit LogRateLimiter(int limit)
+    : limit_(limit)
+    , window_(0)
+    , count_(0) {
+  }
+
+  bool Allow() {
+    int64_t window = GetCurrentMicroseconds() / 1000000;
+    if (window_.load(std::memory_order_relaxed) != window) {
+      window_.store(window, std::memory_order_relaxed);
+      count_.store(0, std::memory_order_relaxed);
+    }
+    return count_.fetch_add(1, std::memory_order_relaxed) < limit_;
+  }
+
+ private:
+  int limit_;
+  std::atomic<int64_t> window_;
+  std::atomic<int> count_;
+};
+
+#define EPOLL_LOG(LEVEL, ...) \
+  do { \
+    if ((LEVEL) >= EPOLL_LOG_LEVEL && (LEVEL) >= Logger::level()) { \
+      Logger::Log((LEVEL), __FILE__, __LINE__, __VA_ARGS__); \
+    } \
+  } while (0)
+
+// Log at most LIMIT records per second from this call site
+#define EPOLL_LOG_RATE_LIMITED(LEVEL, LIMIT, ...) \
+  do { \
+    if ((LEVEL) >= EPOLL_LOG_LEVEL && (LEVEL) >= Logger::level()) { \
+      static LogRateLimiter log_rate_limiter((LIMIT)); \
+      if (log_rate_limiter.Allow()) { \
+        Logger::Log((LEVEL), __FILE__, __LINE__, __VA_ARGS__); \
+      } \
+    } \
+  } while (0)
+
+#define LOG_DEBUG(...) EPOLL_LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) EPOLL_LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) EPOLL_LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) EPOLL_LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif // EPOLL_LOGGING_H__
@@ -1,23 +1,100 @@
+#include <stdlib.h>
+#include <string.h>
 #include <iostream>
+#include <vector>
 #include <tcp_server.h>
+#include <tracing.h>
+
+namespace {
+
+void PrintHistogram(const char* name, const Histogram& histogram) {
+  std::cout << name << ": count " << histogram.count() << ", p50 "
+    << histogram.Percentile(50) << ", p99 " << histogram.Percentile(99)
+    << ", p99.9 " << histogram.Percentile(99.9) << ", max "
+    << histogram.max() << " us" << std::endl;
+}
+
+void PrintTopSessions(TCPServer* server, TransportOrder order, int count) {
+  std::vector<TransportStats> sessions;
+  server->TopSessions(order, count > 0 ? count : 10, &sessions);
+  std::string text;
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    FormatTransportStats(sessions[i], &text);
+    std::cout << text << std::endl;
+  }
+}
+
+}  // namespace
 
 int main(int argc, char* argv[])
 {
   std::shared_ptr<TCPServer> server(new TCPServer());
-  if (server->InitServer("0.0.0.0", 8888, 2) != 0) {
+  // "inline" accepts and serves the connections on one thread
+  bool inline_mode = argc >= 2 && strcmp(argv[1], "inline") == 0;
+  int rst = inline_mode ? server->InitInline("0.0.0.0", 8888) :
+    server->InitServer("0.0.0.0", 8888, 2);
+  if (rst != 0) {
     std::cout << "init server failed!" << std::endl;
     return 0;
   }
+  // "affinity" keeps the connections of a source address on one service
+  if (argc >= 2 && strcmp(argv[1], "affinity") == 0) {
+    server->set_placement_policy(
+      CreatePlacementPolicy(PLACEMENT_POLICY_AFFINITY));
+  }
+  // report the loop iterations longer than 100ms
+  server->set_stall_threshold(100000);
+  // sample the transport of every session once per second
+  server->set_transport_sample_interval(1000000);
   if (server->StartServer() != 0) {
     std::cout << "start server failed!" << std::endl;
     return 0;
   }
   std::string line;
-  std::cout << "input q exit." << std::endl;
+  std::cout << "input q exit, + add service, - retire service, "
+    "c <file> start capture, s stop capture, t <n> trace one of n "
+    "messages, d <file> dump traces, l loop stats, w <n> sessions with the "
+    "deepest queues, r <n> sessions with the slowest rtt." << std::endl;
   while (true) {
     std::getline(std::cin, line);
     if (line == "q") {
       break;
+    } else if (line == "+") {
+      server->AddService();
+      std::cout << "services: " << server->service_count() << std::endl;
+    } else if (line == "-") {
+      server->RetireService();
+      std::cout << "services: " << server->service_count() << std::endl;
+    } else if (line.compare(0, 2, "c ") == 0) {
+      if (server->StartCapture(line.c_str() + 2) != 0) {
+        std::cout << "start capture failed!" << std::endl;
+      }
+    } else if (line == "s") {
+      server->StopCapture();
+      std::cout << "captured: " << server->capture()->written_bytes()
+        << " bytes, dropped: " << server->capture()->dropped_bytes()
+        << " bytes" << std::endl;
+    } else if (line.compare(0, 2, "t ") == 0) {
+      Tracer::set_sample_interval(atoi(line.c_str() + 2));
+    } else if (line.compare(0, 2, "d ") == 0) {
+      if (Tracer::DumpToFile(line.c_str() + 2) != 0) {
+        std::cout << "dump traces failed!" << std::endl;
+      }
+    } else if (line == "l") {
+      EventLoopStats stats = server->loop_stats();
+      PrintHistogram("wait", stats.wait);
+      PrintHistogram("dispatch", stats.dispatch);
+      PrintHistogram("timers", stats.timers);
+      PrintHistogram("check_alive", stats.check_alive);
+      PrintHistogram("iteration", stats.iteration);
+      std::cout << "stalls: " << server->stall_watchdog()->stall_count()
+        << std::endl;
+    } else if (line.compare(0, 2, "w ") == 0) {
+      PrintTopSessions(server.get(), TRANSPORT_ORDER_QUEUE_DEPTH,
+        atoi(line.c_str() + 2));
+    } else if (line.compare(0, 2, "r ") == 0) {
+      PrintTopSessions(server.get(), TRANSPORT_ORDER_RTT,
+        atoi(line.c_str() + 2));
     }
   }
   server->StopServer();
@@ -13,9 +13,11 @@
 
 #include <common.h>
 #include <memory.h>
+#include <memory_arena.h>
 
 /// This is a helper class used to allocate memory, it may increase memory 
-/// size by 50% at least at a time
+/// size by 50% at least at a time. The memory comes from the arena of the
+/// thread if there is one
 class MemoryAllocator {
  public:
   MemoryAllocator() 
@@ -23,7 +25,7 @@ class MemoryAllocator {
     , memory_(nullptr) {}
   ~MemoryAllocator() {
     if (memory_) {
-      free(memory_);
+      ArenaFree(memory_);
       memory_ = nullptr;
     }
   }
@@ -32,7 +34,7 @@ class MemoryAllocator {
   /// the allocated memory
   void* Ensure(int capacity) {
     if (nullptr == memory_) {
-      memory_ = malloc(capacity);
+      memory_ = ArenaAllocate(capacity);
       capacity_ = capacity;
       memset(memory_, 0, capacity_);
       return memory_;
@@ -41,13 +43,23 @@ class MemoryAllocator {
       int size = capacity_ * 3 / 2;
       int old_capacity = capacity_;
       capacity_ = capacity > size ? capacity : size;
-      memory_ = realloc(memory_, capacity_);
+      memory_ = ArenaReallocate(memory_, capacity_);
       memset(reinterpret_cast<uint8_t*>(memory_) + old_capacity, 0, 
         capacity_ - old_capacity);
     }
     return memory_;
   }
 
+  /// Exchanges the memory with the other allocator
+  void Swap(MemoryAllocator* other) {
+    void* memory = memory_;
+    int capacity = capacity_;
+    memory_ = other->memory_;
+    capacity_ = other->capacity_;
+    other->memory_ = memory;
+    other->capacity_ = capacity;
+  }
+
   uint8_t* memory() {
     return reinterpret_cast<uint8_t*>(memory_);
   }
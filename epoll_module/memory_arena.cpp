@@ -0,0 +1,271 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <memory_arena.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <logging.h>
+
+namespace {
+
+// the alignment of the transparent huge pages
+const size_t kHugePageSize = 2 << 20;
+
+// the owner arena of the thread
+thread_local MemoryArena* current_arena = nullptr;
+
+// the header right before every block
+struct BlockHeader {
+  // the arena of the block, nullptr for the heap
+  MemoryArena* arena;
+  uint64_t capacity;
+};
+
+BlockHeader* HeaderOf(const void* memory) {
+  return reinterpret_cast<BlockHeader*>(const_cast<uint8_t*>(
+    reinterpret_cast<const uint8_t*>(memory) - sizeof(BlockHeader)));
+}
+
+// the class of the size, kClassCount when it is too large
+int SizeClass(size_t size) {
+  if (size <= (1u << MemoryArena::kMinClassShift)) {
+    return 0;
+  }
+  int shift = 64 - __builtin_clzll(size - 1);
+  if (shift > MemoryArena::kMaxClassShift) {
+    return MemoryArena::kClassCount;
+  }
+  return shift - MemoryArena::kMinClassShift;
+}
+
+size_t ClassSize(int size_class) {
+  return static_cast<size_t>(1) << (size_class + MemoryArena::kMinClassShift);
+}
+
+}  // namespace
+
+MemoryArena::MemoryArena(MemoryArenaType type)
+  : type_(type)
+  , remote_free_(nullptr)
+  , region_begin_(nullptr)
+  , region_end_(nullptr)
+  , mapped_bytes_(0)
+  , hugetlb_bytes_(0)
+  , thp_bytes_(0)
+  , used_bytes_(0)
+  , heap_allocations_(0) {
+  memset(free_lists_, 0, sizeof(free_lists_));
+}
+
+MemoryArena::~MemoryArena() {
+  for (size_t i = 0; i < regions_.size(); ++i) {
+    munmap(regions_[i], kRegionSize);
+  }
+}
+
+MemoryArena* MemoryArena::current() {
+  return current_arena;
+}
+
+void MemoryArena::set_current(MemoryArena* arena) {
+  current_arena = arena;
+}
+
+void* MemoryArena::Allocate(size_t size) {
+  int size_class = SizeClass(size);
+  if (size_class == kClassCount) {
+    heap_allocations_.store(heap_allocations_.load(
+      std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  if (nullptr == free_lists_[size_class]) {
+    DrainRemote();
+  }
+  void* memory = free_lists_[size_class];
+  if (nullptr != memory) {
+    free_lists_[size_class] = free_lists_[size_class]->next;
+  } else {
+    memory = Carve(size_class);
+    if (nullptr == memory) {
+      heap_allocations_.store(heap_allocations_.load(
+        std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+  }
+  used_bytes_.store(used_bytes_.load(std::memory_order_relaxed) +
+    ClassSize(size_class) + kHeaderSpace, std::memory_order_relaxed);
+  return memory;
+}
+
+void MemoryArena::FreeLocal(void* memory, int size_class) {
+  FreeBlock* block = reinterpret_cast<FreeBlock*>(memory);
+  block->next = free_lists_[size_class];
+  free_lists_[size_class] = block;
+  used_bytes_.store(used_bytes_.load(std::memory_order_relaxed) -
+    ClassSize(size_class) - kHeaderSpace, std::memory_order_relaxed);
+}
+
+void MemoryArena::FreeRemote(void* memory) {
+  FreeBlock* block = reinterpret_cast<FreeBlock*>(memory);
+  block->next = remote_free_.load(std::memory_order_relaxed);
+  while (!remote_free_.compare_exchange_weak(block->next, block,
+    std::memory_order_release, std::memory_order_relaxed)) {
+    // retry with the new head
+  }
+}
+
+void MemoryArena::DrainRemote() {
+  FreeBlock* block = remote_free_.exchange(nullptr, std::memory_order_acquire);
+  while (nullptr != block) {
+    FreeBlock* next = block->next;
+    FreeLocal(block, SizeClass(HeaderOf(block)->capacity));
+    block = next;
+  }
+}
+
+void* MemoryArena::Carve(int size_class) {
+  size_t block_size = kHeaderSpace + ClassSize(size_class);
+  if (static_cast<size_t>(region_end_ - region_begin_) < block_size) {
+    // keep the rest of the region as smaller blocks
+    for (int i = size_class - 1; i >= 0; --i) {
+      while (static_cast<size_t>(region_end_ - region_begin_) >=
+        kHeaderSpace + ClassSize(i)) {
+        FreeBlock* block = reinterpret_cast<FreeBlock*>(Carve(i));
+        block->next = free_lists_[i];
+        free_lists_[i] = block;
+      }
+    }
+    if (!MapRegion()) {
+      return nullptr;
+    }
+  }
+  uint8_t* memory = region_begin_ + kHeaderSpace;
+  region_begin_ += block_size;
+  BlockHeader* header = HeaderOf(memory);
+  header->arena = this;
+  header->capacity = ClassSize(size_class);
+  return memory;
+}
+
+bool MemoryArena::MapRegion() {
+  void* memory = MAP_FAILED;
+  if (MEMORY_ARENA_HUGETLB == type_) {
+    memory = mmap(nullptr, kRegionSize, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (MAP_FAILED == memory) {
+      EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_WARN, 1,
+        "no reserved huge pages, errno: {}, using transparent ones", errno);
+    } else {
+      hugetlb_bytes_.store(hugetlb_bytes_.load(std::memory_order_relaxed) +
+        kRegionSize, std::memory_order_relaxed);
+    }
+  }
+  if (MAP_FAILED == memory) {
+    // map one huge page more to align the region on a huge page
+    size_t size = kRegionSize + kHugePageSize;
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == mapped) {
+      return false;
+    }
+    uint8_t* begin = reinterpret_cast<uint8_t*>(mapped);
+    uint8_t* aligned = reinterpret_cast<uint8_t*>(
+      (reinterpret_cast<uintptr_t>(begin) + kHugePageSize - 1) &
+      ~(kHugePageSize - 1));
+    if (aligned > begin) {
+      munmap(begin, aligned - begin);
+    }
+    size_t tail = (begin + size) - (aligned + kRegionSize);
+    if (tail > 0) {
+      munmap(aligned + kRegionSize, tail);
+    }
+    memory = aligned;
+    if (madvise(memory, kRegionSize, MADV_HUGEPAGE) == 0) {
+      thp_bytes_.store(thp_bytes_.load(std::memory_order_relaxed) +
+        kRegionSize, std::memory_order_relaxed);
+    } else {
+      EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_WARN, 1,
+        "no transparent huge pages, errno: {}", errno);
+    }
+  }
+  region_begin_ = reinterpret_cast<uint8_t*>(memory);
+  region_end_ = region_begin_ + kRegionSize;
+  regions_.push_back(region_begin_);
+  mapped_bytes_.store(mapped_bytes_.load(std::memory_order_relaxed) +
+    kRegionSize, std::memory_order_relaxed);
+  return true;
+}
+
+MemoryArenaStats MemoryArena::stats() const {
+  MemoryArenaStats result;
+  result.mapped_bytes = mapped_bytes_.load(std::memory_order_relaxed);
+  result.hugetlb_bytes = hugetlb_bytes_.load(std::memory_order_relaxed);
+  result.thp_bytes = thp_bytes_.load(std::memory_order_relaxed);
+  result.used_bytes = used_bytes_.load(std::memory_order_relaxed);
+  result.heap_allocations =
+    heap_allocations_.load(std::memory_order_relaxed);
+  return result;
+}
+
+void* ArenaAllocate(size_t size) {
+  if (nullptr != current_arena) {
+    void* memory = current_arena->Allocate(size);
+    if (nullptr != memory) {
+      return memory;
+    }
+  }
+  void* block = nullptr;
+  if (posix_memalign(&block, MemoryArena::kHeaderSpace,
+    MemoryArena::kHeaderSpace + size) != 0) {
+    return nullptr;
+  }
+  uint8_t* memory = reinterpret_cast<uint8_t*>(block) +
+    MemoryArena::kHeaderSpace;
+  BlockHeader* header = HeaderOf(memory);
+  header->arena = nullptr;
+  header->capacity = size;
+  return memory;
+}
+
+void ArenaFree(void* memory) {
+  if (nullptr == memory) {
+    return;
+  }
+  BlockHeader* header = HeaderOf(memory);
+  MemoryArena* arena = header->arena;
+  if (nullptr == arena) {
+    free(reinterpret_cast<uint8_t*>(memory) - MemoryArena::kHeaderSpace);
+  } else if (arena == current_arena) {
+    arena->FreeLocal(memory, SizeClass(header->capacity));
+  } else {
+    arena->FreeRemote(memory);
+  }
+}
+
+size_t ArenaCapacity(const void* memory) {
+  return HeaderOf(memory)->capacity;
+}
+
+void* ArenaReallocate(void* memory, size_t size) {
+  if (nullptr == memory) {
+    return ArenaAllocate(size);
+  }
+  size_t capacity = HeaderOf(memory)->capacity;
+  if (capacity >= size) {
+    return memory;
+  }
+  void* result = ArenaAllocate(size);
+  if (nullptr != result) {
+    memcpy(result, memory, capacity);
+    ArenaFree(memory);
+  }
+  return result;
+}
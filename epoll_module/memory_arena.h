@@ -0,0 +1,133 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the huge page arena of the service memory.
+
+#ifndef EPOLL_MEMORY_ARENA_H__
+#define EPOLL_MEMORY_ARENA_H__
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include <common.h>
+
+enum MemoryArenaType {
+  MEMORY_ARENA_NONE,      // the heap
+  MEMORY_ARENA_HUGETLB,   // the reserved huge pages, else as MEMORY_ARENA_THP
+  MEMORY_ARENA_THP        // the transparent huge pages, else the normal pages
+};
+
+/// The usage of an arena
+struct MemoryArenaStats {
+  // the mapped bytes, and the parts of them backed by huge pages
+  uint64_t mapped_bytes;
+  uint64_t hugetlb_bytes;
+  uint64_t thp_bytes;
+  // the bytes of the blocks handed out, a block freed by another thread
+  // is counted until its owner took it back
+  uint64_t used_bytes;
+  // the allocations too large for the arena, served by the heap
+  uint64_t heap_allocations;
+};
+
+/// This class carves the memory of one service thread out of large
+/// mappings backed by huge pages, so that the sessions and their buffers
+/// are packed into a few TLB entries instead of being scattered over the
+/// heap. The blocks are kept on the free lists of power of two classes,
+/// the mappings are only released with the arena.
+///
+/// Only the owner thread allocates, the blocks could be freed by any
+/// thread: those freed by the others are pushed onto a lock-free list
+/// taken back by the owner. The arena should outlive all its blocks.
+class MemoryArena {
+ public:
+  // the size of one mapping, a multiple of the huge page size
+  static const size_t kRegionSize = 8 << 20;
+  // the block classes, 64 bytes to 1M
+  static const int kMinClassShift = 6;
+  static const int kMaxClassShift = 20;
+  static const int kClassCount = kMaxClassShift - kMinClassShift + 1;
+  // the space before every block, it keeps the blocks on cache lines
+  static const size_t kHeaderSpace = 64;
+
+  explicit MemoryArena(MemoryArenaType type);
+  ~MemoryArena();
+
+  // Allocates on the owner thread, returns nullptr when the size is too
+  // large or the mapping failed
+  void* Allocate(size_t size);
+
+  MemoryArenaStats stats() const;
+
+  MemoryArenaType type() const {
+    return type_;
+  }
+
+  // the arena of the calling thread, nullptr for the heap
+  static MemoryArena* current();
+
+  // make the calling thread the owner of the arena, nullptr for the heap
+  static void set_current(MemoryArena* arena);
+
+ private:
+  friend void ArenaFree(void* memory);
+
+  // the free block
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  // Free a block of the arena on the owner thread
+  void FreeLocal(void* memory, int size_class);
+
+  // Free a block of the arena on another thread
+  void FreeRemote(void* memory);
+
+  // Take back the blocks freed by the other threads
+  void DrainRemote();
+
+  // Cut a new block of the class, returns nullptr when no memory
+  void* Carve(int size_class);
+
+  // Map a new region, returns false when no memory
+  bool MapRegion();
+
+  MemoryArenaType type_;
+  FreeBlock* free_lists_[kClassCount];
+  // the blocks freed by the other threads
+  std::atomic<FreeBlock*> remote_free_;
+  // the unused part of the current region
+  uint8_t* region_begin_;
+  uint8_t* region_end_;
+  // the mapped regions
+  std::vector<uint8_t*> regions_;
+  // the usage, written by the owner only
+  std::atomic<uint64_t> mapped_bytes_;
+  std::atomic<uint64_t> hugetlb_bytes_;
+  std::atomic<uint64_t> thp_bytes_;
+  std::atomic<uint64_t> used_bytes_;
+  std::atomic<uint64_t> heap_allocations_;
+  // Disable copying of MemoryArena
+  DISALLOW_CONSTRUCTORS(MemoryArena);
+};
+
+/// Allocates from the arena of the calling thread, or from the heap when
+/// the thread has none. The memory is aligned to a cache line
+void* ArenaAllocate(size_t size);
+
+/// Frees the memory of ArenaAllocate on any thread
+void ArenaFree(void* memory);
+
+/// The usable size of the memory of ArenaAllocate, it could be larger than
+/// the size asked for
+size_t ArenaCapacity(const void* memory);
+
+/// Grows the memory, the memory is kept when it is large enough already
+void* ArenaReallocate(void* memory, size_t size);
+
+#endif // EPOLL_MEMORY_ARENA_H__
@@ -0,0 +1,133 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <message_mesh.h>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+MessageMesh::MessageMesh() {
+  for (int i = 0; i < kMaxNodes; ++i) {
+    nodes_[i].ready.store(0, std::memory_order_relaxed);
+    nodes_[i].wakeup_socket = -1;
+    nodes_[i].joined = false;
+    nodes_[i].dirty = 0;
+  }
+  for (int i = 0; i < kMaxNodes * kMaxNodes; ++i) {
+    channels_[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+MessageMesh::~MessageMesh() {
+  // release the messages never drained
+  MeshMsg msg;
+  for (int i = 0; i < kMaxNodes * kMaxNodes; ++i) {
+    Channel* queue = channels_[i].load(std::memory_order_acquire);
+    if (nullptr == queue) {
+      continue;
+    }
+    queue->Flush();
+    while (queue->Read(&msg)) {
+      free(msg.data);
+    }
+    delete queue;
+  }
+  for (int i = 0; i < kMaxNodes; ++i) {
+    if (nodes_[i].wakeup_socket >= 0) {
+      close(nodes_[i].wakeup_socket);
+    }
+  }
+}
+
+int MessageMesh::Join(int* node) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (int i = 0; i < kMaxNodes; ++i) {
+    if (nodes_[i].joined) {
+      continue;
+    }
+    if (nodes_[i].wakeup_socket < 0) {
+      // the socket is kept until the mesh destroyed so that a sender
+      // could always activate the node
+      nodes_[i].wakeup_socket = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (nodes_[i].wakeup_socket < 0) {
+        return EPOLL_FAIL;
+      }
+    }
+    nodes_[i].joined = true;
+    nodes_[i].dirty = 0;
+    // drain the messages left for the former owner
+    nodes_[i].ready.store(~static_cast<uint64_t>(0),
+      std::memory_order_release);
+    *node = i;
+    return 0;
+  }
+  return EPOLL_BUSY;
+}
+
+void MessageMesh::Leave(int node) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  nodes_[node].joined = false;
+}
+
+int MessageMesh::Post(int node, int destination, const MeshMsg& msg) {
+  Channel* queue = channel(node, destination);
+  if (nullptr == queue) {
+    queue = new (std::nothrow) Channel();
+    if (nullptr == queue || queue->Init() != 0) {
+      delete queue;
+      return EPOLL_NOMEM;
+    }
+    channels_[node * kMaxNodes + destination].store(queue,
+      std::memory_order_release);
+  }
+  CHECK_RESULT(queue->Write(msg, false));
+  nodes_[node].dirty |= static_cast<uint64_t>(1) << destination;
+  return 0;
+}
+
+void MessageMesh::Flush(int node) {
+  uint64_t dirty = nodes_[node].dirty;
+  if (0 == dirty) {
+    return;
+  }
+  nodes_[node].dirty = 0;
+  uint64_t bit = static_cast<uint64_t>(1) << node;
+  while (dirty) {
+    int destination = __builtin_ctzll(dirty);
+    dirty &= dirty - 1;
+    channel(node, destination)->Flush();
+    // only the first source marking the destination ready wakes it up
+    uint64_t ready = nodes_[destination].ready.fetch_or(bit,
+      std::memory_order_acq_rel);
+    if (0 == ready) {
+      uint64_t count = 1;
+      ssize_t rst = write(nodes_[destination].wakeup_socket,
+        &count, sizeof(count));
+      (void)rst;
+    }
+  }
+}
+
+void MessageMesh::Drain(int node, MeshMessageListener* listener) {
+  if (0 == nodes_[node].ready.load(std::memory_order_relaxed)) {
+    return;
+  }
+  uint64_t ready = nodes_[node].ready.exchange(0, std::memory_order_acq_rel);
+  MeshMsg msg;
+  while (ready) {
+    int source = __builtin_ctzll(ready);
+    ready &= ready - 1;
+    Channel* queue = channel(source, node);
+    if (nullptr == queue) {
+      continue;
+    }
+    while (queue->Read(&msg)) {
+      listener->OnMeshMessage(msg);
+    }
+  }
+}
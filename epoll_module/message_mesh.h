@@ -0,0 +1,121 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the mesh of channels between the service threads.
+
+#ifndef EPOLL_MESSAGE_MESH_H__
+#define EPOLL_MESSAGE_MESH_H__
+
+#include <atomic>
+#include <mutex>
+#include <common.h>
+#include <spsc_queue.h>
+
+class TCPSession;
+
+/// The handle to address a session on any service. It is invalidated when
+/// the session stopped or migrated to another service, the messages sent
+/// to an invalidated handle are dropped.
+struct SessionHandle {
+  // the mesh node of the service owning the session
+  int node;
+  TCPSession* session;
+  // the id of the session, the session memory may be reused
+  uint64_t session_id;
+};
+
+/// The message sent through the mesh, the data is allocated by the
+/// sender and released by the receiver
+struct MeshMsg {
+  TCPSession* session;
+  uint64_t session_id;
+  uint8_t* data;
+  int size;
+};
+
+/// The listener to receive the mesh messages
+class MeshMessageListener {
+ public:
+  // Default empty virtual destructor
+  virtual ~MeshMessageListener() {}
+  // Get called for every message drained from the mesh
+  virtual void OnMeshMessage(const MeshMsg& msg) = 0;
+};
+
+/// The N x N mesh of SPSC channels between the service threads. Every
+/// service joins the mesh as one node, the channel from node i to node j
+/// is only written by the thread of node i and only read by the thread of
+/// node j. The messages are posted without flushing, the sender flushes
+/// all its channels once per loop iteration and wakes every destination
+/// at most once, the receiver drains the channels marked ready in batches.
+class MessageMesh {
+ public:
+  static const int kMaxNodes = 64;
+
+  MessageMesh();
+  ~MessageMesh();
+
+  // Joins the mesh and returns the node index, could be called from any
+  // thread. The messages left for the former owner of the node would be
+  // drained by the new owner.
+  int Join(int* node);
+
+  // Leaves the mesh after the service thread stopped
+  void Leave(int node);
+
+  // the eventfd activated when messages arrived on the node
+  int wakeup_socket(int node) const {
+    return nodes_[node].wakeup_socket;
+  }
+
+  // Posts a message from the node to the destination node without
+  // flushing, called on the thread of the node
+  int Post(int node, int destination, const MeshMsg& msg);
+
+  // Flushes the posted messages of the node, called on the thread of the
+  // node
+  void Flush(int node);
+
+  // Drains all the ready messages sent to the node, called on the thread
+  // of the node
+  void Drain(int node, MeshMessageListener* listener);
+
+ private:
+  static const int kChannelGranularity = 256;
+  typedef SpscQueue<MeshMsg, kChannelGranularity> Channel;
+
+  // The state of one node, written by the other threads
+  struct Node {
+    // the source nodes having flushed messages
+    std::atomic<uint64_t> ready;
+    int wakeup_socket;
+    bool joined;
+    // the destination nodes having posted messages, only used by the
+    // thread of the node
+    uint64_t dirty;
+    // pad to a cache line, the nodes are written by different threads
+    uint8_t padding[40];
+  };
+  static_assert(sizeof(Node) == 64, "the node should fill a cache line");
+
+  Channel* channel(int source, int destination) {
+    return channels_[source * kMaxNodes + destination].load(
+      std::memory_order_acquire);
+  }
+
+  // the nodes
+  Node nodes_[kMaxNodes];
+  // the channels, created by the source node on its first message
+  std::atomic<Channel*> channels_[kMaxNodes * kMaxNodes];
+  // mutex for joining and leaving
+  std::mutex mutex_;
+  // Disable copying of MessageMesh
+  DISALLOW_CONSTRUCTORS(MessageMesh);
+};
+
+#endif // EPOLL_MESSAGE_MESH_H__
@@ -1,8 +1,21 @@
 #include <message_parser.h>
 #include <tcp_session.h>
-#include <iostream>
+#include <checksum.h>
+#include <delimiter_scanner.h>
+#include <logging.h>
+#include <scratch_arena.h>
+#include <tracing.h>
+
+#include <string.h>
+
+static const MessageParserOptions kDefaultParserOptions;
+
 MessageParser::MessageParser(TCPSession* session)
-  : session_(session){
+  : session_(session)
+  , options_(&kDefaultParserOptions)
+  , crc_(0)
+  , crc_offset_(0)
+  , closing_(false) {
 }
 
 MessageParser::~MessageParser() {
@@ -10,9 +23,230 @@ MessageParser::~MessageParser() {
 
 int MessageParser::Parser(const uint8_t* data, int size) {
   if (session_->session_type() == TCP_SESSION_TYPE_EVENT) {
-    std::cout << "new session" << std::endl;
+    LOG_DEBUG("new session");
   } else if (session_->session_type() == TCP_SESSION_TYPE_NORMAL) {
-    std::cout << "receiveed: " << size << " byte." << std::endl;
+    if (options_->framing == MESSAGE_FRAMING_HTTP ||
+      options_->framing == MESSAGE_FRAMING_RPC) {
+      return ParseStream(data, size);
+    }
+    if (options_->framing != MESSAGE_FRAMING_NONE) {
+      return ParseDelimited(data, size);
+    }
+    if (options_->handler != nullptr) {
+      return OnMessage(data, size);
+    }
+    LOG_DEBUG("received: {} byte.", size);
+  }
+  return 0;
+}
+
+int MessageParser::ParseDelimited(const uint8_t* data, int size) {
+  bool crlf = options_->framing == MESSAGE_FRAMING_CRLF;
+  uint8_t delimiter = crlf ? '\n' : options_->delimiter;
+  int start = 0;
+  int offset = 0;
+  while (offset < size) {
+    int found = offset + FindDelimiter(data + offset, size - offset,
+      delimiter);
+    if (found == size) {
+      break;
+    }
+    offset = found + 1;
+    int end = found;
+    // the \r ending the partial message, it was the last byte of the
+    // previous read
+    int trim = 0;
+    if (crlf) {
+      if (end > start) {
+        if (data[end - 1] != '\r') {
+          continue;
+        }
+        --end;
+      } else if (partial_.size() > 0 &&
+        partial_.begin()[partial_.size() - 1] == '\r') {
+        trim = 1;
+      } else {
+        continue;
+      }
+    }
+    int rst = 0;
+    if (partial_.size() > 0) {
+      // complete the message split over reads
+      partial_.Write(data + start, end - start);
+      rst = CompleteMessage(partial_.begin(), partial_.size() - trim);
+      partial_.Clear();
+    } else {
+      rst = CompleteMessage(data + start, end - start);
+    }
+    CHECK_RESULT(rst);
+    start = offset;
+  }
+  if (start < size) {
+    if (partial_.size() + size - start > options_->max_message_size) {
+      LOG_WARN("message exceeds {} byte.", options_->max_message_size);
+      return EPOLL_FAIL;
+    }
+    partial_.Write(data + start, size - start);
+    if (options_->checksum) {
+      UpdatePartialCrc();
+    }
   }
   return 0;
-}
\ No newline at end of file
+}
+
+int MessageParser::CompleteMessage(const uint8_t* data, int size) {
+  if (size > options_->max_message_size) {
+    LOG_WARN("message exceeds {} byte.", options_->max_message_size);
+    return EPOLL_FAIL;
+  }
+  if (!options_->checksum) {
+    return OnMessage(data, size);
+  }
+  int payload = size - kCrc32cTextSize;
+  uint32_t expected = 0;
+  if (payload < 0 || !ParseCrc32c(data + payload, &expected)) {
+    EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_WARN, 10, "message without checksum.");
+    return EPOLL_FAIL;
+  }
+  // the bytes of a partial message have been folded as they arrived
+  uint32_t crc = Crc32c(crc_, data + crc_offset_, payload - crc_offset_);
+  crc_ = 0;
+  crc_offset_ = 0;
+  if (crc != expected) {
+    EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_WARN, 10, "message checksum mismatch.");
+    return EPOLL_FAIL;
+  }
+  return OnMessage(data, payload);
+}
+
+void MessageParser::UpdatePartialCrc() {
+  // the checksum and the \r of \r\n may be the tail of the partial message
+  int reserved = kCrc32cTextSize +
+    (options_->framing == MESSAGE_FRAMING_CRLF ? 1 : 0);
+  int ready = partial_.size() - reserved;
+  if (ready > crc_offset_) {
+    crc_ = Crc32c(crc_, partial_.begin() + crc_offset_, ready - crc_offset_);
+    crc_offset_ = ready;
+  }
+}
+
+int MessageParser::OnMessage(const uint8_t* data, int size) {
+  if (nullptr == options_->handler) {
+    LOG_DEBUG("received message: {} byte.", size);
+    return 0;
+  }
+  int rst = 0;
+  {
+    TraceSpan span("handler", session_->session_id(), session_->traced());
+    rst = options_->handler->OnMessage(session_, data, size);
+  }
+  ScratchArena::EndMessage();
+  return rst;
+}
+
+int MessageParser::ParseStream(const uint8_t* data, int size) {
+  if (closing_) {
+    return 0;
+  }
+  const uint8_t* begin = data;
+  if (partial_.size() > 0) {
+    // the front request or frame was split over reads
+    partial_.Write(data, size);
+    begin = partial_.begin();
+    size = partial_.size();
+  }
+  int parsed = options_->framing == MESSAGE_FRAMING_HTTP ?
+    ParseRequests(begin, size) : ParseFrames(begin, size);
+  if (parsed < 0) {
+    return parsed;
+  }
+  if (begin != data) {
+    partial_.Shrink(parsed);
+  } else if (parsed < size) {
+    partial_.Write(data + parsed, size - parsed);
+  }
+  if (partial_.size() > options_->max_message_size) {
+    LOG_WARN("message exceeds {} byte.", options_->max_message_size);
+    return EPOLL_FAIL;
+  }
+  return 0;
+}
+
+int MessageParser::ParseRequests(const uint8_t* data, int size) {
+  static const HttpResponseHeader kBadRequest(400, "Bad Request", nullptr);
+  HttpRequest request;
+  int offset = 0;
+  while (offset < size && !closing_) {
+    int rst = http_parser_.Parse(data + offset, size - offset, &request);
+    if (0 == rst) {
+      break;
+    }
+    if (rst < 0) {
+      // answer the malformed request and close after the pending
+      // responses were written
+      EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_WARN, 10, "malformed http request.");
+      if (kBadRequest.Send(session_, nullptr, 0, false) != 0) {
+        return EPOLL_FAIL;
+      }
+      closing_ = true;
+      partial_.Clear();
+      return size;
+    }
+    offset += rst;
+    if (nullptr == options_->http_handler) {
+      LOG_DEBUG("http request: {} byte.", rst);
+    } else {
+      int handled = 0;
+      {
+        TraceSpan span("handler", session_->session_id(), session_->traced());
+        handled = options_->http_handler->OnRequest(session_, request);
+      }
+      ScratchArena::EndMessage();
+      // the parsed size is returned, a result of the handler is no size
+      if (0 != handled) {
+        return EPOLL_FAIL;
+      }
+    }
+    if (!request.keep_alive) {
+      closing_ = true;
+    }
+  }
+  if (closing_) {
+    partial_.Clear();
+    return size;
+  }
+  return offset;
+}
+
+int MessageParser::ParseFrames(const uint8_t* data, int size) {
+  int offset = 0;
+  RpcHeader header;
+  while (size - offset >= static_cast<int>(sizeof(header))) {
+    memcpy(&header, data + offset, sizeof(header));
+    if (header.size > static_cast<uint32_t>(options_->max_message_size)) {
+      LOG_WARN("rpc frame exceeds {} byte.", options_->max_message_size);
+      return EPOLL_FAIL;
+    }
+    int frame_size = static_cast<int>(sizeof(header) + header.size);
+    if (size - offset < frame_size) {
+      break;
+    }
+    if (nullptr == options_->rpc_dispatcher) {
+      LOG_DEBUG("rpc frame: {} byte.", frame_size);
+    } else {
+      int handled = 0;
+      {
+        TraceSpan span("handler", session_->session_id(), session_->traced());
+        handled = options_->rpc_dispatcher->Dispatch(session_, header,
+          data + offset + sizeof(header));
+      }
+      ScratchArena::EndMessage();
+      // the parsed size is returned, a result of the handler is no size
+      if (0 != handled) {
+        return EPOLL_FAIL;
+      }
+    }
+    offset += frame_size;
+  }
+  return offset;
+}
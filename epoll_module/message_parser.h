@@ -12,18 +12,114 @@
 
 #include <common.h>
 #include <memory>
+#include <byte_array.h>
+#include <http_codec.h>
+#include <rpc.h>
 
 class TCPSession;
+
+/// The framing of the received stream
+enum MessageFraming {
+  // every read is passed as it is
+  MESSAGE_FRAMING_NONE,
+  // the messages end with the delimiter byte
+  MESSAGE_FRAMING_DELIMITER,
+  // the messages end with \r\n
+  MESSAGE_FRAMING_CRLF,
+  // HTTP/1.1 requests passed to the http handler
+  MESSAGE_FRAMING_HTTP,
+  // RPC frames passed to the rpc dispatcher
+  MESSAGE_FRAMING_RPC
+};
+
+/// The handler of the received messages
+class MessageHandler {
+ public:
+  // Default empty virtual destructor
+  virtual ~MessageHandler() {}
+  // Get called for every message without its delimiter, the data is only
+  // valid during the call. Returns nonzero to stop the session.
+  virtual int OnMessage(TCPSession* session, const uint8_t* data,
+    int size) = 0;
+};
+
+/// The options of the message parser shared by the sessions of a server
+struct MessageParserOptions {
+  MessageFraming framing;
+  uint8_t delimiter;
+  // the max size of a message, the session sending a longer one is stopped
+  int max_message_size;
+  // the delimited messages end with the hex CRC32C of their payload
+  // before the delimiter, it is verified and stripped by the parser
+  bool checksum;
+  MessageHandler* handler;
+  HttpHandler* http_handler;
+  RpcDispatcher* rpc_dispatcher;
+
+  MessageParserOptions()
+    : framing(MESSAGE_FRAMING_NONE)
+    , delimiter('\n')
+    , max_message_size(64 * 1024)
+    , checksum(false)
+    , handler(nullptr)
+    , http_handler(nullptr)
+    , rpc_dispatcher(nullptr) {
+  }
+};
+
 class MessageParser {
  public:
   MessageParser(TCPSession* session);
   ~MessageParser();
 
+  // Parses the received data, the messages split over reads are kept
+  // until completed. Returns nonzero when the session should be stopped.
   int Parser(const uint8_t* data, int size);
 
+  // the options should outlive the parser
+  void set_options(const MessageParserOptions* options) {
+    options_ = options;
+  }
+
+  const MessageParserOptions& options() const {
+    return *options_;
+  }
+
+  // rebind the parser when its session state was moved
+  void set_session(TCPSession* session) {
+    session_ = session;
+  }
+
  private:
+  // split the data by the delimiter
+  int ParseDelimited(const uint8_t* data, int size);
+  // verify the checksum of the delimited message
+  int CompleteMessage(const uint8_t* data, int size);
+  // fold the bytes of the partial message which could not be the
+  // checksum into the crc
+  void UpdatePartialCrc();
+  int OnMessage(const uint8_t* data, int size);
+  // parse the pipelined HTTP requests or RPC frames, the one split over
+  // reads is kept until completed
+  int ParseStream(const uint8_t* data, int size);
+  // parse the requests at the front of the data, returns the parsed size
+  int ParseRequests(const uint8_t* data, int size);
+  // parse the frames at the front of the data, returns the parsed size
+  int ParseFrames(const uint8_t* data, int size);
+
    // message parser session
    TCPSession* session_;
+   // the parser options
+   const MessageParserOptions* options_;
+   // the partial message received so far
+   ByteArray partial_;
+   // the crc of the partial message and the count of the bytes in it
+   uint32_t crc_;
+   int crc_offset_;
+   // the HTTP request parser
+   HttpParser http_parser_;
+   // the input is ignored after a malformed request was answered
+   bool closing_;
    // Disable copying of MessageParser
    DISALLOW_CONSTRUCTORS(MessageParser);
 };
@@ -0,0 +1,121 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines a typed single-threaded object pool.
+
+#ifndef EPOLL_OBJECT_POOL_H__
+#define EPOLL_OBJECT_POOL_H__
+
+#include <stdlib.h>
+#include <new>
+#include <utility>
+#include <vector>
+#include <common.h>
+#include <memory_arena.h>
+
+//  This class hands out storage for objects of type T from chunks of at
+//  least N slots. Every slot starts on a cache line boundary so that the
+//  leading fields of T would share one cache line. Objects are constructed
+//  and destroyed explicitly by Construct/Destroy, the storage of a
+//  destroyed object is kept on a free list for the next Construct. The
+//  chunks come from the arena of the thread if there is one, a chunk is
+//  filled up to the capacity of its block.
+//
+//  The pool is not thread safe, it is intended to be owned by one
+//  service thread.
+template <typename T, int N>
+class ObjectPool {
+ public:
+  static const size_t kCacheLineSize = 64;
+
+  inline ObjectPool()
+    : free_list_(nullptr)
+    , size_(0)
+    , capacity_(0) {}
+
+  // Destroy the pool, all the objects should have been destroyed
+  inline ~ObjectPool() {
+    assert(0 == size_);
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+      ArenaFree(chunks_[i]);
+    }
+  }
+
+  /// Construct an object, returns nullptr when memory allocation failed.
+  template <typename... Args>
+  inline T* Construct(Args&&... args) {
+    if (nullptr == free_list_ && Grow() != 0) {
+      return nullptr;
+    }
+    Slot* slot = free_list_;
+    free_list_ = slot->next;
+    ++size_;
+    return new(slot) T(std::forward<Args>(args)...);
+  }
+
+  /// Destroy the object and give the storage back to the pool.
+  inline void Destroy(T* object) {
+    object->~T();
+    Slot* slot = reinterpret_cast<Slot*>(object);
+    slot->next = free_list_;
+    free_list_ = slot;
+    --size_;
+  }
+
+  // the count of the living objects
+  size_t size() const {
+    return size_;
+  }
+
+  // the count of the allocated slots
+  size_t capacity() const {
+    return capacity_;
+  }
+
+ private:
+  // the storage of one object, linked into the free list when unused
+  union Slot {
+    Slot* next;
+    uint8_t storage[sizeof(T)];
+  };
+
+  static const size_t kSlotSize =
+    (sizeof(Slot) + kCacheLineSize - 1) / kCacheLineSize * kCacheLineSize;
+
+  inline int Grow() {
+    // the arena memory is aligned to a cache line
+    void* chunk = ArenaAllocate(kSlotSize * N);
+    if (nullptr == chunk) {
+      return EPOLL_NOMEM;
+    }
+    chunks_.push_back(chunk);
+    size_t count = ArenaCapacity(chunk) / kSlotSize;
+    capacity_ += count;
+    uint8_t* memory = reinterpret_cast<uint8_t*>(chunk);
+    for (size_t i = count; i-- > 0;) {
+      Slot* slot = reinterpret_cast<Slot*>(memory + i * kSlotSize);
+      slot->next = free_list_;
+      free_list_ = slot;
+    }
+    return 0;
+  }
+
+  // the unused slots
+  Slot* free_list_;
+  // the living objects
+  size_t size_;
+  // the allocated slots
+  size_t capacity_;
+  // the allocated chunks
+  std::vector<void*> chunks_;
+
+  //  Disable copying of ObjectPool
+  DISALLOW_CONSTRUCTORS(ObjectPool);
+};
+
+#endif // EPOLL_OBJECT_POOL_H__
@@ -8,9 +8,9 @@
 
 #include <pipe.h>
 
-int CreatePipePair(std::shared_ptr<Pipe> pipes[2], int index, bool enable_recycle) {
-  std::shared_ptr<Pipe> pipe0(new (std::nothrow) Pipe(index, enable_recycle));
-  std::shared_ptr<Pipe> pipe1(new (std::nothrow) Pipe(index, enable_recycle));
+int CreatePipePair(std::shared_ptr<Pipe> pipes[2], int index) {
+  std::shared_ptr<Pipe> pipe0(new (std::nothrow) Pipe(index));
+  std::shared_ptr<Pipe> pipe1(new (std::nothrow) Pipe(index));
   
   Pipe::MessageQueue* queues[2] = {0};
   queues[0] = new (std::nothrow) Pipe::MessageQueue();
@@ -25,13 +25,12 @@ int CreatePipePair(std::shared_ptr<Pipe> pipes[2], int index, bool enable_recycl
   return 0;
 }
 
-Pipe::Pipe(int index, bool enable_recycle)
+Pipe::Pipe(int index)
   : listener_(nullptr)
   , terminated_(false)
   , peer_terminated_(false)
   , in_queue_(nullptr)
   , out_queue_(nullptr)
-  , enable_recycle_(enable_recycle)
   , index_(index) {
   // nothing
 }
@@ -46,11 +45,6 @@ Pipe::~Pipe() {
     delete in_queue_;
     in_queue_ = nullptr;
   }
-  // delete data of the recycle queue 
-  PipeMsg msg = nullptr;
-  while (recycle_queue_.Read(&msg)) {
-    delete msg;
-  }
 }
 
 int Pipe::Init(MessageQueue* in_queue, MessageQueue* out_queue, 
@@ -58,13 +52,10 @@ int Pipe::Init(MessageQueue* in_queue, MessageQueue* out_queue,
   peer_ = peer;
   in_queue_ = in_queue;
   out_queue_ = out_queue;
-  if (enable_recycle_) {
-    CHECK_RESULT(recycle_queue_.Init());
-  }
   return 0;
 }
 
-int Pipe::Write(PipeMsg msg, bool incomplete) {
+int Pipe::Write(const PipeMsg& msg, bool incomplete) {
   if (terminated_) {
     return EPOLL_FAIL;
   }
@@ -78,7 +69,7 @@ int Pipe::Write(PipeMsg msg, bool incomplete) {
   return 0;
 }
 
-int Pipe::Write(PipeMsg msg, bool* o_wake_peer) {
+int Pipe::Write(const PipeMsg& msg, bool* o_wake_peer) {
   if (terminated_) {
     return EPOLL_FAIL;
   }
@@ -92,6 +83,24 @@ int Pipe::Write(PipeMsg msg, bool* o_wake_peer) {
   return 0;
 }
 
+int Pipe::Post(const PipeMsg& msg) {
+  if (terminated_) {
+    return EPOLL_FAIL;
+  }
+  return out_queue_->Write(msg, false);
+}
+
+int Pipe::Flush() {
+  if (terminated_) {
+    return EPOLL_FAIL;
+  }
+  if (!out_queue_->Flush()) {
+    // activate the peer pipe reader
+    peer_->SendReadActivated();
+  }
+  return 0;
+}
+
 int Pipe::Unwrite(PipeMsg* res_msg) {
   return out_queue_->Unwrite(res_msg) ? 0 : EPOLL_FAIL;
 }
@@ -136,7 +145,15 @@ int Pipe::Terminate() {
   if (terminated_) {
     return 0;
   }
-  CHECK_RESULT(out_queue_->Write(nullptr, false));
+  PipeMsg msg;
+  msg.type = PIPE_MSG_TERMINATE;
+  msg.socket = -1;
+  msg.data = nullptr;
+  msg.target = nullptr;
+  msg.time = 0;
+  msg.priority = 0;
+  msg.tracked = false;
+  CHECK_RESULT(out_queue_->Write(msg, false));
   if (!out_queue_->Flush()) {
     // activate the peer pipe reader
     peer_->SendReadActivated();
@@ -164,7 +181,7 @@ bool Pipe::DoRead(PipeMsg* res_msg, int* res) {
     return true;
   }
   if (in_queue_->Read(res_msg)) {
-    if (nullptr == *res_msg) {
+    if (PIPE_MSG_TERMINATE == res_msg->type) {
       peer_terminated_ = true;
       *res = EPOLL_EOF;
       return true;
@@ -174,33 +191,3 @@ bool Pipe::DoRead(PipeMsg* res_msg, int* res) {
   }
   return false;
 }
-
-int Pipe::Recycle(PipeMsg msg) {
-  if (terminated_) {
-    return EPOLL_FAIL;
-  }
-  if (!enable_recycle_) {
-    return EPOLL_INVALID;
-  }
-  CHECK_RESULT(recycle_queue_.Write(msg, false));
-  recycle_queue_.Flush();
-  return 0;
-}
-
-
-bool Pipe::ConsumeRecycleQueue(PipeMsg* res_msg) {
-  if (peer_terminated_) {
-    return false;
-  }
-  if (!peer_->enable_recycle_) {
-    return false;
-  }
-  if (peer_->recycle_queue_.Read(res_msg)) {
-    if (nullptr == *res_msg) {
-      return false;
-    }
-    return true;
-  }
-  return false;
-}
-
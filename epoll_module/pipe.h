@@ -11,8 +11,10 @@
 #ifndef EPOLL_PIPE_H__
 #define EPOLL_PIPE_H__
 
+#include <netinet/in.h>
 #include <common.h>
 #include <spsc_queue.h>
+#include <spsc_ring.h>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -34,26 +36,63 @@ class PipeEventListener {
 // The function to create a pair of pipe objects. The two created pipe
 // objects are intended to be operated on two threads, and when write
 // message on any of the two pipes, the other pipe would read this message
-int CreatePipePair(std::shared_ptr<Pipe> pipes[2], int index, bool enable_recycle);
+int CreatePipePair(std::shared_ptr<Pipe> pipes[2], int index);
+
+/// The type of the message exchanged through the pipe
+enum PipeMsgType {
+  PIPE_MSG_TERMINATE,         // the peer pipe terminated
+  PIPE_MSG_SESSION,           // data holds a constructed session
+  PIPE_MSG_SOCKET,            // an accepted socket with the peer address
+  PIPE_MSG_REBALANCE,         // move hot sessions to the target service
+  PIPE_MSG_MIGRATE,           // data holds a session moving to the target
+  PIPE_MSG_RETIRE,            // move all sessions away and retire
+  PIPE_MSG_RETIRED            // all sessions of the service moved away
+};
+
+/// The message exchanged through the pipe, it is copied by value so
+/// that passing an accepted socket would not need any allocation.
+/// The messages written by the service thread to the listen thread
+/// are forwarded to their target service
+struct PipeMsg {
+  PipeMsgType type;
+  int socket;
+  sockaddr_in address;
+  void* data;
+  // the target service of the rebalance/migrate messages, a migrating
+  // session without target would be placed by the server
+  void* target;
+  // the time a traced socket or migrating session was queued, 0 if not
+  // traced
+  int64_t time;
+  // the SessionPriority of a pushed socket
+  int priority;
+  // whether the admission of a pushed socket counted it on its source
+  bool tracked;
+};
 
 /// The pipe class used to exchange messages between two threads. This
 /// class is only intended to be created through the CreatePipePair
 /// function
-typedef void* PipeMsg;
-
 class Pipe {
  public:
   //  This allows CreatePipePair to create Pipe objects.
-  friend int CreatePipePair(std::shared_ptr<Pipe> pipes[2], int index, bool enable_recycle);
+  friend int CreatePipePair(std::shared_ptr<Pipe> pipes[2], int index);
 
   // Destroy the pipe
   ~Pipe();
   
   // Writes message to the pipe
-  int Write(PipeMsg msg, bool incomplete = false);
+  int Write(const PipeMsg& msg, bool incomplete = false);
 
   // writes message to the pipe and return whether we need to awake the peer
-  int Write(PipeMsg msg, bool* o_wake_peer);
+  int Write(const PipeMsg& msg, bool* o_wake_peer);
+
+  // Writes message to the pipe without flushing, the message would be
+  // visible to the peer after the next Flush
+  int Post(const PipeMsg& msg);
+
+  // Flushes the posted messages and awake the peer if needed
+  int Flush();
 
   //  Pop an incomplete message from the pipe.
   int Unwrite(PipeMsg* res_msg);
@@ -67,12 +106,6 @@ class Pipe {
   // Ask pipe to terminate. 
   int Terminate();
 
-  // Recycle msg
-  int Recycle(PipeMsg msg);
-
-  // consume recycle queue
-  bool ConsumeRecycleQueue(PipeMsg* res_msg);
-
   // Sets the listener
   void set_listener(PipeEventListener* listener) {
     // could only be set once
@@ -85,12 +118,18 @@ class Pipe {
 
  private:
   static const int kIdleMessageGranularity = 256;
-  // Define the message queue
+  // Define the message queue, the bounded ring never allocates after the
+  // pipe created, but a write fails when the ring is full
+#ifdef EPOLL_PIPE_USE_RING
+  static const int kRingCapacity = 4096;
+  typedef SpscRing<PipeMsg, kRingCapacity> MessageQueue;
+#else
   typedef SpscQueue<PipeMsg, kIdleMessageGranularity> MessageQueue;
+#endif
 
   //  Constructor is private. pipe can only be created using
   //  PipePair function.
-  explicit Pipe(int index, bool enable_recycle);
+  explicit Pipe(int index);
 
   int Init(MessageQueue* in_queue, MessageQueue* out_queue, 
     std::shared_ptr<Pipe> peer);
@@ -106,7 +145,6 @@ class Pipe {
   // The flag indicating whether this pipe has been terminated
   bool terminated_;
   bool peer_terminated_;
-  bool enable_recycle_;
   // Hold reference to the peer object so that the peer
   // object would not be destroyed when calling SendReadActivated
   // on it
@@ -116,8 +154,6 @@ class Pipe {
   MessageQueue* in_queue_;
   // The output queue
   MessageQueue* out_queue_;
-  // The recycle queue
-  MessageQueue recycle_queue_;
   // mutex for read waiting
   std::mutex mutex_;
   // condition for read waiting
@@ -0,0 +1,261 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <placement_policy.h>
+#include <tcp_service.h>
+
+#include <algorithm>
+
+namespace {
+
+// the finalizer of splitmix64, it spreads the keys over the ring
+uint64_t MixKey(uint64_t key) {
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+  return key;
+}
+
+}  // namespace
+
+uint64_t AffinityKey(const sockaddr_in& address) {
+  return address.sin_addr.s_addr;
+}
+
+uint64_t AffinityKey(const void* data, int size) {
+  // FNV-1a
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return 0 == hash ? 1 : hash;
+}
+
+// Choose the services in turn
+class RoundRobinPlacementPolicy : public PlacementPolicy {
+ public:
+  RoundRobinPlacementPolicy()
+    : next_service_(0) {
+  }
+
+  virtual size_t Select(
+    const std::vector<std::shared_ptr<TCPService>>& services) {
+    if (next_service_ >= services.size()) {
+      next_service_ = 0;
+    }
+    return next_service_++;
+  }
+
+ private:
+  size_t next_service_;
+};
+
+// Choose the service with the least active sessions
+class LeastSessionsPlacementPolicy : public PlacementPolicy {
+ public:
+  virtual size_t Select(
+    const std::vector<std::shared_ptr<TCPService>>& services) {
+    size_t result = 0;
+    int least = services[0]->active_sessions();
+    for (size_t i = 1; i < services.size(); ++i) {
+      int sessions = services[i]->active_sessions();
+      if (sessions < least) {
+        least = sessions;
+        result = i;
+      }
+    }
+    return result;
+  }
+};
+
+// Choose the service with the least busy time in the last load window,
+// the session count breaks the tie of the idle services
+class LeastBusyPlacementPolicy : public PlacementPolicy {
+ public:
+  virtual size_t Select(
+    const std::vector<std::shared_ptr<TCPService>>& services) {
+    size_t result = 0;
+    int64_t least_busy = services[0]->recent_busy_time();
+    int least_sessions = services[0]->active_sessions();
+    for (size_t i = 1; i < services.size(); ++i) {
+      int64_t busy = services[i]->recent_busy_time();
+      int sessions = services[i]->active_sessions();
+      if (busy < least_busy ||
+        (busy == least_busy && sessions < least_sessions)) {
+        least_busy = busy;
+        least_sessions = sessions;
+        result = i;
+      }
+    }
+    return result;
+  }
+};
+
+// Choose two services at random and take the one with less sessions
+class TwoChoicesPlacementPolicy : public PlacementPolicy {
+ public:
+  TwoChoicesPlacementPolicy()
+    : seed_(static_cast<uint64_t>(GetCurrentMicroseconds()) | 1) {
+  }
+
+  virtual size_t Select(
+    const std::vector<std::shared_ptr<TCPService>>& services) {
+    size_t count = services.size();
+    if (count == 1) {
+      return 0;
+    }
+    size_t first = Next() % count;
+    // the second choice differs from the first one
+    size_t second = (first + 1 + Next() % (count - 1)) % count;
+    if (services[second]->active_sessions() <
+      services[first]->active_sessions()) {
+      return second;
+    }
+    return first;
+  }
+
+ private:
+  // xorshift64
+  uint64_t Next() {
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 7;
+    seed_ ^= seed_ << 17;
+    return seed_;
+  }
+
+  uint64_t seed_;
+};
+
+// Map the routing keys to the services on a consistent hash ring, every
+// service owns many points of the ring and a key goes to the owner of
+// the first point after it. The ring is built again when the services
+// changed, the points of the services kept stay where they were. Every
+// ring built is published, so the services could look up the keys
+class AffinityPlacementPolicy : public PlacementPolicy {
+ public:
+  // the points of a service, more points spread the keys more evenly
+  static const int kServicePoints = 128;
+
+  // the connections without key take turns
+  virtual size_t Select(
+    const std::vector<std::shared_ptr<TCPService>>& services) {
+    return round_robin_.Select(services);
+  }
+
+  virtual size_t SelectByKey(
+    const std::vector<std::shared_ptr<TCPService>>& services, uint64_t key) {
+    if (!Matches(services)) {
+      Build(services);
+    }
+    return Find(*ring_, key);
+  }
+
+  virtual bool HasAffinity() const {
+    return true;
+  }
+
+  virtual TCPService* ServiceOfKey(uint64_t key) const {
+    std::shared_ptr<const Ring> ring = std::atomic_load(&published_);
+    if (!ring) {
+      return nullptr;
+    }
+    return ring->members[Find(*ring, key)];
+  }
+
+ private:
+  struct Point {
+    uint64_t hash;
+    // the index of the service
+    size_t service;
+  };
+
+  // the services and their points by their hash, immutable once
+  // published
+  struct Ring {
+    std::vector<TCPService*> members;
+    std::vector<Point> points;
+  };
+
+  static size_t Find(const Ring& ring, uint64_t key) {
+    if (ring.members.size() == 1) {
+      return 0;
+    }
+    std::vector<Point>::const_iterator it = std::lower_bound(
+      ring.points.begin(), ring.points.end(), MixKey(key), PointBefore);
+    if (it == ring.points.end()) {
+      it = ring.points.begin();
+    }
+    return it->service;
+  }
+
+  static bool PointBefore(const Point& point, uint64_t hash) {
+    return point.hash < hash;
+  }
+
+  static bool PointLess(const Point& a, const Point& b) {
+    return a.hash < b.hash;
+  }
+
+  // whether the ring was built of the services
+  bool Matches(
+    const std::vector<std::shared_ptr<TCPService>>& services) const {
+    if (!ring_ || ring_->members.size() != services.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < services.size(); ++i) {
+      if (ring_->members[i] != services[i].get()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void Build(const std::vector<std::shared_ptr<TCPService>>& services) {
+    std::shared_ptr<Ring> ring(new Ring());
+    for (size_t i = 0; i < services.size(); ++i) {
+      ring->members.push_back(services[i].get());
+      // the points follow the service rather than its index, which
+      // shifts when another service retired
+      uint64_t seed = MixKey(reinterpret_cast<uintptr_t>(services[i].get()));
+      for (int j = 0; j < kServicePoints; ++j) {
+        Point point;
+        point.hash = MixKey(seed + j);
+        point.service = i;
+        ring->points.push_back(point);
+      }
+    }
+    std::sort(ring->points.begin(), ring->points.end(), PointLess);
+    ring_ = ring;
+    std::atomic_store(&published_, ring_);
+  }
+
+  RoundRobinPlacementPolicy round_robin_;
+  // the ring of the listen thread, and the one read by the services
+  std::shared_ptr<const Ring> ring_;
+  std::shared_ptr<const Ring> published_;
+};
+
+std::shared_ptr<PlacementPolicy> CreatePlacementPolicy(
+  PlacementPolicyType type) {
+  switch (type) {
+  case PLACEMENT_POLICY_LEAST_SESSIONS:
+    return std::make_shared<LeastSessionsPlacementPolicy>();
+  case PLACEMENT_POLICY_LEAST_BUSY:
+    return std::make_shared<LeastBusyPlacementPolicy>();
+  case PLACEMENT_POLICY_TWO_CHOICES:
+    return std::make_shared<TwoChoicesPlacementPolicy>();
+  case PLACEMENT_POLICY_AFFINITY:
+    return std::make_shared<AffinityPlacementPolicy>();
+  default:
+    return std::make_shared<RoundRobinPlacementPolicy>();
+  }
+}
@@ -0,0 +1,71 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the policies to place new connections on the services.
+
+#ifndef EPOLL_PLACEMENT_POLICY_H__
+#define EPOLL_PLACEMENT_POLICY_H__
+
+#include <netinet/in.h>
+#include <memory>
+#include <vector>
+#include <common.h>
+
+class TCPService;
+
+enum PlacementPolicyType {
+  PLACEMENT_POLICY_ROUND_ROBIN,       // the next service in turn
+  PLACEMENT_POLICY_LEAST_SESSIONS,    // the service with least sessions
+  PLACEMENT_POLICY_LEAST_BUSY,        // the service with least busy time
+  PLACEMENT_POLICY_TWO_CHOICES,       // the less loaded of two random ones
+  PLACEMENT_POLICY_AFFINITY           // the service of the routing key
+};
+
+/// The policy to choose the service for a new connection. It is only
+/// called on the listen thread, and reads the load figures published
+/// by the services, except the queries of the affinity.
+class PlacementPolicy {
+ public:
+  // Default empty virtual destructor
+  virtual ~PlacementPolicy() {}
+  // Returns the index of the chosen service, services is never empty
+  virtual size_t Select(
+    const std::vector<std::shared_ptr<TCPService>>& services) = 0;
+  // Returns the index of the chosen service for the routing key of the
+  // connection, the policies without affinity ignore the key
+  virtual size_t SelectByKey(
+    const std::vector<std::shared_ptr<TCPService>>& services,
+    uint64_t /*key*/) {
+    return Select(services);
+  }
+  // whether the services are chosen by the routing keys, could be called
+  // from any thread
+  virtual bool HasAffinity() const {
+    return false;
+  }
+  // Returns the service of the routing key as of the last selection by
+  // key, nullptr without affinity or before any such selection, could be
+  // called from any thread
+  virtual TCPService* ServiceOfKey(uint64_t /*key*/) const {
+    return nullptr;
+  }
+};
+
+// The routing key of the source address, the port is ignored. The
+// affinity policy places the accepted connections by it, until
+// TCPService::RehomeSession gave the session another key
+uint64_t AffinityKey(const sockaddr_in& address);
+
+// The routing key of the data, such as a tenant name, never 0
+uint64_t AffinityKey(const void* data, int size);
+
+// The function to create the built-in placement policies
+std::shared_ptr<PlacementPolicy> CreatePlacementPolicy(
+  PlacementPolicyType type);
+
+#endif // EPOLL_PLACEMENT_POLICY_H__
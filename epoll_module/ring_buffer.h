@@ -0,0 +1,204 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the ring buffer of bytes
+
+#ifndef EPOLL_RING_BUFFER_H__
+#define EPOLL_RING_BUFFER_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include <common.h>
+#include <memory_arena.h>
+
+/// A contiguous part of a buffer
+struct ByteSpan {
+  uint8_t* data;
+  int size;
+};
+
+/// This class is a growable ring of bytes. Consuming from the front only
+/// moves the read cursor, the content wraps around the end of the memory
+/// instead of being moved to the front, so draining a large buffer in
+/// small pieces costs nothing more than the copies into it. The content
+/// is read as at most two spans, or made contiguous on demand which only
+/// moves the bytes when they wrap.
+class RingBuffer {
+ public:
+  RingBuffer()
+    : memory_(nullptr)
+    , capacity_(0)
+    , head_(0)
+    , size_(0) {
+    // nothing
+  }
+  ~RingBuffer() {
+    ArenaFree(memory_);
+  }
+
+  // Appends the data, grows the ring when it is full
+  void Write(const uint8_t* buffer, int size) {
+    if (0 == size) return;
+    Reserve(size);
+    int tail = (head_ + size_) & (capacity_ - 1);
+    int first = capacity_ - tail;
+    if (first >= size) {
+      memcpy(memory_ + tail, buffer, size);
+    } else {
+      memcpy(memory_ + tail, buffer, first);
+      memcpy(memory_, buffer + first, size - first);
+    }
+    size_ += size;
+  }
+
+  // Removes the size bytes from the front
+  void Consume(int size) {
+    if (size >= size_) {
+      Clear();
+      return;
+    }
+    head_ = (head_ + size) & (capacity_ - 1);
+    size_ -= size;
+  }
+
+  // Gets the content as spans in order, returns the count of the spans
+  int ReadableSpans(ByteSpan spans[2]) {
+    if (0 == size_) return 0;
+    int first = capacity_ - head_;
+    spans[0].data = memory_ + head_;
+    if (first >= size_) {
+      spans[0].size = size_;
+      return 1;
+    }
+    spans[0].size = first;
+    spans[1].data = memory_;
+    spans[1].size = size_ - first;
+    return 2;
+  }
+
+  // Gets the free space after the content, which could be filled and then
+  // appended by Commit. The space wraps so it could be two spans too.
+  int WritableSpans(int size, ByteSpan spans[2]) {
+    Reserve(size);
+    int tail = (head_ + size_) & (capacity_ - 1);
+    int free_size = capacity_ - size_;
+    spans[0].data = memory_ + tail;
+    if (tail < head_ || capacity_ - tail >= free_size) {
+      spans[0].size = free_size;
+      return 1;
+    }
+    spans[0].size = capacity_ - tail;
+    spans[1].data = memory_;
+    spans[1].size = head_;
+    return 2;
+  }
+
+  // Appends the size bytes filled into the writable spans
+  void Commit(int size) {
+    size_ += size;
+  }
+
+  // Makes the first size bytes contiguous and returns them, the bytes are
+  // only moved when they wrap
+  const uint8_t* Contiguous(int size) {
+    if (0 == size_) return nullptr;
+    if (head_ + size <= capacity_) {
+      return memory_ + head_;
+    }
+    int first = capacity_ - head_;
+    int second = size_ - first;
+    if (size_ <= head_) {
+      // rotate in place, the content fits before the read cursor
+      memmove(memory_ + first, memory_, second);
+      memcpy(memory_, memory_ + head_, first);
+      head_ = 0;
+    } else {
+      Linearize(capacity_);
+    }
+    return memory_ + head_;
+  }
+
+  void Clear() {
+    head_ = 0;
+    size_ = 0;
+  }
+
+  // Exchanges the content with the other ring without copying
+  void Swap(RingBuffer* other) {
+    uint8_t* memory = memory_;
+    int capacity = capacity_;
+    int head = head_;
+    int size = size_;
+    memory_ = other->memory_;
+    capacity_ = other->capacity_;
+    head_ = other->head_;
+    size_ = other->size_;
+    other->memory_ = memory;
+    other->capacity_ = capacity;
+    other->head_ = head;
+    other->size_ = size;
+  }
+
+  int size() const {
+    return size_;
+  }
+
+  int capacity() const {
+    return capacity_;
+  }
+
+ private:
+  static const int kMinCapacity = 1024;
+
+  // Ensures the free space of the added bytes
+  void Reserve(int added) {
+    if (size_ + added <= capacity_) {
+      if (0 == size_) {
+        head_ = 0;
+      }
+      return;
+    }
+    int capacity = capacity_ > 0 ? capacity_ : kMinCapacity;
+    while (capacity < size_ + added) {
+      capacity *= 2;
+    }
+    Linearize(capacity);
+  }
+
+  // Moves the content to the front of the memory with the capacity, it is
+  // a power of two
+  void Linearize(int capacity) {
+    uint8_t* memory = reinterpret_cast<uint8_t*>(ArenaAllocate(capacity));
+    int first = capacity_ - head_;
+    if (0 == size_) {
+      // nothing to move
+    } else if (first >= size_) {
+      memcpy(memory, memory_ + head_, size_);
+    } else {
+      memcpy(memory, memory_ + head_, first);
+      memcpy(memory + first, memory_, size_ - first);
+    }
+    ArenaFree(memory_);
+    memory_ = memory;
+    capacity_ = capacity;
+    head_ = 0;
+  }
+
+  uint8_t* memory_;
+  // the capacity, a power of two
+  int capacity_;
+  // the read cursor
+  int head_;
+  // the content size
+  int size_;
+
+  // Disable copying of RingBuffer
+  DISALLOW_CONSTRUCTORS(RingBuffer);
+};
+
+#endif // EPOLL_RING_BUFFER_H__
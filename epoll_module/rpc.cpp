@@ -0,0 +1,185 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <rpc.h>
+
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <utility>
+#include <vector>
+#include <byte_array.h>
+#include <logging.h>
+#include <tcp_service.h>
+#include <tcp_session.h>
+
+struct RpcCallState {
+  // set by the first of the response and the deadline timer
+  std::atomic<bool> answered;
+
+  RpcCallState() : answered(false) {}
+};
+
+namespace {
+
+// the frame being built by the thread
+thread_local ByteArray rpc_frame;
+
+void BuildFrame(const RpcHeader& header, const uint8_t* data) {
+  rpc_frame.Clear();
+  rpc_frame.Write(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+  rpc_frame.Write(data, header.size);
+}
+
+int SendResponse(TCPService* service, const RpcCall& call, RpcStatus status,
+  const uint8_t* data, int size) {
+  RpcHeader header;
+  memset(&header, 0, sizeof(header));
+  header.size = size;
+  header.method = call.method;
+  header.type = RPC_FRAME_RESPONSE;
+  header.status = static_cast<uint8_t>(status);
+  header.correlation = call.correlation;
+  if (call.expired(GetCurrentMicroseconds())) {
+    header.status = RPC_STATUS_DEADLINE_EXCEEDED;
+    header.size = 0;
+  }
+  BuildFrame(header, data);
+  return service->SendTo(call.session, rpc_frame.begin(), rpc_frame.size());
+}
+
+// The calls with a deadline dispatched by the service of the thread. A
+// call is kept until its deadline, and answered with
+// RPC_STATUS_DEADLINE_EXCEEDED then if no response was sent
+class RpcDeadlines : public ServiceTimer {
+ public:
+  RpcDeadlines() : service_(nullptr), due_time_(0) {}
+
+  void Add(TCPService* service, const RpcCall& call) {
+    if (nullptr == service_) {
+      service_ = service;
+    }
+    // a service thread runs a single service
+    if (service_ != service) {
+      return;
+    }
+    calls_.push_back(std::make_pair(call.deadline, call));
+    std::push_heap(calls_.begin(), calls_.end(), Later());
+    // a call expires once the time passed its deadline
+    if (0 == due_time_ || call.deadline + 1 < due_time_) {
+      due_time_ = call.deadline + 1;
+      service->ScheduleTimer(this, due_time_);
+    }
+  }
+
+  virtual int64_t OnTimer(TCPService* service, int64_t now) {
+    while (!calls_.empty() && calls_.front().first < now) {
+      std::pop_heap(calls_.begin(), calls_.end(), Later());
+      const RpcCall& call = calls_.back().second;
+      if (!call.state->answered.exchange(true)) {
+        SendResponse(service, call, RPC_STATUS_DEADLINE_EXCEEDED, nullptr, 0);
+      }
+      calls_.pop_back();
+    }
+    due_time_ = calls_.empty() ? 0 : calls_.front().first + 1;
+    return due_time_;
+  }
+
+ private:
+  typedef std::pair<int64_t, RpcCall> Entry;
+
+  // orders the heap by the earliest deadline
+  struct Later {
+    bool operator()(const Entry& left, const Entry& right) const {
+      return left.first > right.first;
+    }
+  };
+
+  TCPService* service_;
+  int64_t due_time_;
+  std::vector<Entry> calls_;
+};
+
+thread_local RpcDeadlines rpc_deadlines;
+
+}  // namespace
+
+RpcDispatcher::RpcDispatcher()
+  : response_handler_(nullptr) {
+  memset(handlers_, 0, sizeof(handlers_));
+}
+
+int RpcDispatcher::Register(uint16_t method, RpcHandler* handler) {
+  if (method >= kMaxMethods || nullptr == handler) {
+    return EPOLL_INVALID;
+  }
+  if (handlers_[method] != nullptr) {
+    return EPOLL_ID_EXISTS;
+  }
+  handlers_[method] = handler;
+  return 0;
+}
+
+int RpcDispatcher::Dispatch(TCPSession* session, const RpcHeader& header,
+  const uint8_t* data) {
+  if (RPC_FRAME_RESPONSE == header.type) {
+    if (nullptr == response_handler_) {
+      return 0;
+    }
+    return response_handler_->OnResponse(session, header, data, header.size);
+  }
+  if (header.type != RPC_FRAME_REQUEST) {
+    EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_WARN, 10, "unknown rpc frame type {}.",
+      header.type);
+    return EPOLL_FAIL;
+  }
+  RpcCall call;
+  call.session = session->handle();
+  call.correlation = header.correlation;
+  call.method = header.method;
+  call.deadline = 0;
+  if (header.timeout > 0) {
+    call.deadline = session->last_actived_time() +
+      static_cast<int64_t>(header.timeout) * 1000;
+    call.state = std::make_shared<RpcCallState>();
+    rpc_deadlines.Add(session->service(), call);
+  }
+  RpcHandler* handler =
+    header.method < kMaxMethods ? handlers_[header.method] : nullptr;
+  if (nullptr == handler) {
+    return RpcRespond(session->service(), call, RPC_STATUS_NO_METHOD,
+      nullptr, 0);
+  }
+  return handler->OnCall(session, call, data, header.size);
+}
+
+int RpcRespond(TCPService* service, const RpcCall& call, RpcStatus status,
+  const uint8_t* data, int size) {
+  if (nullptr == service) {
+    return EPOLL_INVALID;
+  }
+  // the deadline timer has answered the call
+  if (call.state && call.state->answered.exchange(true)) {
+    return 0;
+  }
+  return SendResponse(service, call, status, data, size);
+}
+
+int RpcRequest(TCPSession* session, uint16_t method, uint64_t correlation,
+  uint32_t timeout, const uint8_t* data, int size) {
+  RpcHeader header;
+  memset(&header, 0, sizeof(header));
+  header.size = size;
+  header.method = method;
+  header.type = RPC_FRAME_REQUEST;
+  header.timeout = timeout;
+  header.correlation = correlation;
+  BuildFrame(header, data);
+  return session->Send(rpc_frame.begin(), rpc_frame.size());
+}
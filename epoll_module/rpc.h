@@ -0,0 +1,135 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the request/response framing of the RPC.
+
+#ifndef EPOLL_RPC_H__
+#define EPOLL_RPC_H__
+
+#include <memory>
+
+#include <common.h>
+#include <message_mesh.h>
+
+class TCPService;
+class TCPSession;
+struct RpcCallState;
+
+enum RpcFrameType {
+  RPC_FRAME_REQUEST = 1,
+  RPC_FRAME_RESPONSE = 2
+};
+
+enum RpcStatus {
+  RPC_STATUS_OK = 0,
+  RPC_STATUS_NO_METHOD = 1,
+  RPC_STATUS_DEADLINE_EXCEEDED = 2,
+  RPC_STATUS_ERROR = 3
+};
+
+/// The header of every frame, in little endian, followed by the payload.
+/// The correlation is chosen by the requester and echoed by the response,
+/// so the responses could be sent in any order.
+struct RpcHeader {
+  // the payload size
+  uint32_t size;
+  uint16_t method;
+  uint8_t type;
+  // the status of the response
+  uint8_t status;
+  // the time budget of the request in milliseconds, 0 for none
+  uint32_t timeout;
+  uint32_t reserved;
+  uint64_t correlation;
+};
+static_assert(sizeof(RpcHeader) == 24, "the rpc header should be packed");
+
+/// The request being served, it could be kept to respond later
+struct RpcCall {
+  SessionHandle session;
+  uint64_t correlation;
+  uint16_t method;
+  // the absolute deadline in microseconds, 0 for none
+  int64_t deadline;
+  // whether the call has been answered, shared with the deadline timer of
+  // the service, nullptr without deadline
+  std::shared_ptr<RpcCallState> state;
+
+  bool expired(int64_t now) const {
+    return deadline != 0 && now > deadline;
+  }
+};
+
+/// The handler of the requests of one method
+class RpcHandler {
+ public:
+  // Default empty virtual destructor
+  virtual ~RpcHandler() {}
+  // Get called for every request of the method, the payload is only valid
+  // during the call. The response is sent by RpcRespond, now or later.
+  // Returns nonzero to stop the session.
+  virtual int OnCall(TCPSession* session, const RpcCall& call,
+    const uint8_t* data, int size) = 0;
+};
+
+/// The handler of the responses received by a requester
+class RpcResponseHandler {
+ public:
+  // Default empty virtual destructor
+  virtual ~RpcResponseHandler() {}
+  // Returns nonzero to stop the session
+  virtual int OnResponse(TCPSession* session, const RpcHeader& header,
+    const uint8_t* data, int size) = 0;
+};
+
+/// The registry of the handlers, the method id indexes a flat table.
+/// The handlers are registered before the server started.
+class RpcDispatcher {
+ public:
+  static const int kMaxMethods = 1024;
+
+  RpcDispatcher();
+
+  // Returns EPOLL_INVALID when the method is out of the table,
+  // EPOLL_ID_EXISTS when it has been registered
+  int Register(uint16_t method, RpcHandler* handler);
+
+  void set_response_handler(RpcResponseHandler* handler) {
+    response_handler_ = handler;
+  }
+
+  // Dispatches a received frame, the requests of the unknown methods are
+  // answered with RPC_STATUS_NO_METHOD. A request with a time budget is
+  // answered with RPC_STATUS_DEADLINE_EXCEEDED by the service of the
+  // session once it expired without response.
+  int Dispatch(TCPSession* session, const RpcHeader& header,
+    const uint8_t* data);
+
+ private:
+  RpcHandler* handlers_[kMaxMethods];
+  RpcResponseHandler* response_handler_;
+  // Disable copying of RpcDispatcher
+  DISALLOW_CONSTRUCTORS(RpcDispatcher);
+};
+
+/// Sends the response of the call, it could be called on any service
+/// thread with the service of the thread. The response is queued to the
+/// corked output of the session, or to the mesh when the session lives
+/// on another service, and flushed with the others at the end of the
+/// loop iteration. An expired call is answered with
+/// RPC_STATUS_DEADLINE_EXCEEDED and without the payload, a call is
+/// answered once, the response after the deadline timer answered it is
+/// dropped.
+int RpcRespond(TCPService* service, const RpcCall& call, RpcStatus status,
+  const uint8_t* data, int size);
+
+/// Sends a request on the thread of the session
+int RpcRequest(TCPSession* session, uint16_t method, uint64_t correlation,
+  uint32_t timeout, const uint8_t* data, int size);
+
+#endif // EPOLL_RPC_H__
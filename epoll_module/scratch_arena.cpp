@@ -0,0 +1,163 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <scratch_arena.h>
+
+#include <string.h>
+#include <memory_arena.h>
+
+namespace {
+
+// the space of the chunk header, it keeps the memory on cache lines
+const size_t kChunkHeaderSpace = 64;
+
+// the scratch arena of the thread
+thread_local ScratchArena* current_scratch = nullptr;
+
+uint8_t* AlignUp(uint8_t* position, size_t alignment) {
+  uintptr_t address = reinterpret_cast<uintptr_t>(position);
+  return reinterpret_cast<uint8_t*>((address + alignment - 1) &
+    ~static_cast<uintptr_t>(alignment - 1));
+}
+
+}  // namespace
+
+ScratchArena::ScratchArena()
+  : chunks_(nullptr)
+  , current_chunk_(nullptr)
+  , position_(nullptr)
+  , end_(nullptr)
+  , large_chunks_(nullptr)
+  , used_bytes_(0)
+  , reset_policy_(SCRATCH_RESET_ITERATION) {
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+ScratchArena::~ScratchArena() {
+  Release();
+}
+
+void* ScratchArena::Allocate(size_t size, size_t alignment) {
+  uint8_t* memory = AlignUp(position_, alignment);
+  if (nullptr == position_ || memory > end_ ||
+    size > static_cast<size_t>(end_ - memory)) {
+    if (size > kChunkSize - kChunkHeaderSpace) {
+      Chunk* chunk = reinterpret_cast<Chunk*>(
+        ArenaAllocate(kChunkHeaderSpace + size));
+      if (nullptr == chunk) {
+        return nullptr;
+      }
+      chunk->size = kChunkHeaderSpace + size;
+      chunk->next = large_chunks_;
+      large_chunks_ = chunk;
+      ++stats_.large_allocations;
+      return reinterpret_cast<uint8_t*>(chunk) + kChunkHeaderSpace;
+    }
+    if (!NextChunk()) {
+      return nullptr;
+    }
+    memory = position_;
+  }
+  position_ = memory + size;
+  size_t in_use = used_bytes_ + (position_ -
+    reinterpret_cast<uint8_t*>(current_chunk_));
+  if (in_use > stats_.peak_bytes) {
+    stats_.peak_bytes = in_use;
+  }
+  return memory;
+}
+
+void ScratchArena::Free(void* memory, size_t size) {
+  uint8_t* begin = reinterpret_cast<uint8_t*>(memory);
+  if (nullptr != begin && begin + size == position_) {
+    position_ = begin;
+  }
+}
+
+bool ScratchArena::NextChunk() {
+  Chunk* next = nullptr;
+  if (nullptr != current_chunk_) {
+    used_bytes_ += position_ - reinterpret_cast<uint8_t*>(current_chunk_);
+    next = current_chunk_->next;
+  } else {
+    next = chunks_;
+  }
+  if (nullptr == next) {
+    next = reinterpret_cast<Chunk*>(ArenaAllocate(kChunkSize));
+    if (nullptr == next) {
+      return false;
+    }
+    next->size = kChunkSize;
+    next->next = nullptr;
+    if (nullptr != current_chunk_) {
+      current_chunk_->next = next;
+    } else {
+      chunks_ = next;
+    }
+    ++stats_.chunk_allocations;
+    stats_.retained_bytes += kChunkSize;
+  }
+  current_chunk_ = next;
+  position_ = reinterpret_cast<uint8_t*>(next) + kChunkHeaderSpace;
+  end_ = reinterpret_cast<uint8_t*>(next) + next->size;
+  return true;
+}
+
+void ScratchArena::Reset() {
+  while (nullptr != large_chunks_) {
+    Chunk* chunk = large_chunks_;
+    large_chunks_ = chunk->next;
+    ArenaFree(chunk);
+  }
+  if (nullptr == current_chunk_) {
+    return;
+  }
+  // keep the chunks of a common burst, free those of a rare one
+  if (stats_.retained_bytes > kMaxRetainedBytes) {
+    Chunk* last = chunks_;
+    size_t retained = kChunkSize;
+    while (retained + kChunkSize <= kMaxRetainedBytes) {
+      last = last->next;
+      retained += kChunkSize;
+    }
+    Chunk* chunk = last->next;
+    last->next = nullptr;
+    while (nullptr != chunk) {
+      Chunk* next = chunk->next;
+      ArenaFree(chunk);
+      chunk = next;
+    }
+    stats_.retained_bytes = retained;
+  }
+  current_chunk_ = nullptr;
+  position_ = nullptr;
+  end_ = nullptr;
+  used_bytes_ = 0;
+}
+
+void ScratchArena::Release() {
+  Reset();
+  while (nullptr != chunks_) {
+    Chunk* chunk = chunks_;
+    chunks_ = chunk->next;
+    ArenaFree(chunk);
+  }
+  stats_.retained_bytes = 0;
+}
+
+ScratchArenaStats ScratchArena::stats() const {
+  return stats_;
+}
+
+ScratchArena* ScratchArena::current() {
+  return current_scratch;
+}
+
+void ScratchArena::set_current(ScratchArena* arena) {
+  current_scratch = arena;
+}
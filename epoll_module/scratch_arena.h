@@ -0,0 +1,194 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the scratch arena of the handler temporaries.
+
+#ifndef EPOLL_SCRATCH_ARENA_H__
+#define EPOLL_SCRATCH_ARENA_H__
+
+#include <stddef.h>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+#include <common.h>
+
+enum ScratchResetPolicy {
+  SCRATCH_RESET_ITERATION,    // reset at the end of every loop iteration
+  SCRATCH_RESET_MESSAGE       // reset after every message handled as well
+};
+
+/// The usage of a scratch arena
+struct ScratchArenaStats {
+  // the chunks taken from the memory arena or the heap since the start,
+  // they stop growing once the arena warmed up
+  uint64_t chunk_allocations;
+  // the allocations larger than a chunk, taken and freed one by one
+  uint64_t large_allocations;
+  // the bytes kept by the arena between the resets
+  uint64_t retained_bytes;
+  // the most bytes handed out between two resets
+  uint64_t peak_bytes;
+};
+
+/// This class hands out the temporaries of the handlers on the service
+/// thread by bumping a pointer through a few retained chunks. Nothing is
+/// freed one by one: the service resets the whole arena at the end of
+/// every loop iteration, or after every message by the policy, so the
+/// memory must not be kept past that point.
+///
+/// The chunks come from the memory arena of the service thread when it
+/// has one. The arena is only used by its owner thread.
+class ScratchArena {
+ public:
+  // the size of a chunk, the larger allocations get their own memory
+  static const size_t kChunkSize = 64 << 10;
+  // the chunks kept over a reset, those above are freed
+  static const size_t kMaxRetainedBytes = 1 << 20;
+
+  ScratchArena();
+  ~ScratchArena();
+
+  // Allocates the size aligned to the alignment, a power of two up to a
+  // cache line, returns nullptr when no memory
+  void* Allocate(size_t size, size_t alignment = 16);
+
+  // Gives back the memory when it was the last allocation, so that the
+  // temporaries freed in the reverse order reuse their space, else it is
+  // kept until the reset
+  void Free(void* memory, size_t size);
+
+  // Makes all the memory handed out available again
+  void Reset();
+
+  // Frees all the chunks, called when the service thread exits
+  void Release();
+
+  // reset the arena of the calling thread after a message was handled,
+  // when its policy is SCRATCH_RESET_MESSAGE
+  static void EndMessage() {
+    ScratchArena* arena = current();
+    if (nullptr != arena && arena->reset_policy_ == SCRATCH_RESET_MESSAGE) {
+      arena->Reset();
+    }
+  }
+
+  void set_reset_policy(ScratchResetPolicy reset_policy) {
+    reset_policy_ = reset_policy;
+  }
+
+  ScratchResetPolicy reset_policy() const {
+    return reset_policy_;
+  }
+
+  ScratchArenaStats stats() const;
+
+  // the arena of the calling thread, nullptr if none
+  static ScratchArena* current();
+
+  static void set_current(ScratchArena* arena);
+
+ private:
+  // the header at the front of every chunk
+  struct Chunk {
+    Chunk* next;
+    size_t size;
+  };
+
+  // move to the next retained chunk or allocate a new one, returns false
+  // when no memory
+  bool NextChunk();
+
+  // the chunks in use and the retained ones after them
+  Chunk* chunks_;
+  Chunk* current_chunk_;
+  // the unused part of the current chunk
+  uint8_t* position_;
+  uint8_t* end_;
+  // the allocations larger than a chunk since the reset
+  Chunk* large_chunks_;
+  // the bytes of the chunks in use before the current one
+  size_t used_bytes_;
+  ScratchResetPolicy reset_policy_;
+  ScratchArenaStats stats_;
+  // Disable copying of ScratchArena
+  DISALLOW_CONSTRUCTORS(ScratchArena);
+};
+
+/// The STL allocator of the scratch arena. It takes the arena of the
+/// calling thread when constructed, and falls back to the heap on the
+/// threads without one. The containers should not outlive the reset of
+/// the arena, nor move to another thread.
+template <class T>
+class ScratchAllocator {
+ public:
+  typedef T value_type;
+
+  ScratchAllocator()
+    : arena_(ScratchArena::current()) {
+  }
+
+  explicit ScratchAllocator(ScratchArena* arena)
+    : arena_(arena) {
+  }
+
+  template <class U>
+  ScratchAllocator(const ScratchAllocator<U>& other)
+    : arena_(other.arena()) {
+  }
+
+  T* allocate(size_t n) {
+    if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
+      throw std::bad_alloc();
+    }
+    void* memory = nullptr;
+    if (nullptr != arena_) {
+      memory = arena_->Allocate(n * sizeof(T), alignof(T));
+    } else {
+      memory = ::operator new(n * sizeof(T), std::nothrow);
+    }
+    if (nullptr == memory) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(memory);
+  }
+
+  void deallocate(T* memory, size_t n) {
+    if (nullptr != arena_) {
+      arena_->Free(memory, n * sizeof(T));
+    } else {
+      ::operator delete(memory);
+    }
+  }
+
+  ScratchArena* arena() const {
+    return arena_;
+  }
+
+ private:
+  ScratchArena* arena_;
+};
+
+template <class T, class U>
+bool operator==(const ScratchAllocator<T>& a, const ScratchAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <class T, class U>
+bool operator!=(const ScratchAllocator<T>& a, const ScratchAllocator<U>& b) {
+  return a.arena() != b.arena();
+}
+
+/// The containers of the handler temporaries
+typedef std::basic_string<char, std::char_traits<char>,
+  ScratchAllocator<char>> ScratchString;
+
+template <class T>
+using ScratchVector = std::vector<T, ScratchAllocator<T>>;
+
+#endif // EPOLL_SCRATCH_ARENA_H__
@@ -0,0 +1,56 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <session_priority.h>
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+SubnetClassifier::SubnetClassifier(SessionPriority default_priority)
+  : default_priority_(default_priority) {
+}
+
+int SubnetClassifier::AddSubnet(const char* cidr, SessionPriority priority) {
+  if (nullptr == cidr || priority < 0 || priority >= SESSION_PRIORITY_COUNT) {
+    return EPOLL_INVALID;
+  }
+  std::string address(cidr);
+  int prefix = 32;
+  std::string::size_type slash = address.find('/');
+  if (slash != std::string::npos) {
+    char* end = nullptr;
+    prefix = static_cast<int>(strtol(address.c_str() + slash + 1, &end, 10));
+    if (end == address.c_str() + slash + 1 || *end != '\0' ||
+      prefix < 0 || prefix > 32) {
+      return EPOLL_INVALID;
+    }
+    address.resize(slash);
+  }
+  in_addr parsed;
+  if (inet_pton(AF_INET, address.c_str(), &parsed) != 1) {
+    return EPOLL_INVALID;
+  }
+  Subnet subnet;
+  subnet.mask = 0 == prefix ? 0 : 0xffffffffu << (32 - prefix);
+  subnet.network = ntohl(parsed.s_addr) & subnet.mask;
+  subnet.priority = priority;
+  subnets_.push_back(subnet);
+  return 0;
+}
+
+SessionPriority SubnetClassifier::Classify(const sockaddr_in& address) {
+  uint32_t ip = ntohl(address.sin_addr.s_addr);
+  for (size_t i = 0; i < subnets_.size(); ++i) {
+    if ((ip & subnets_[i].mask) == subnets_[i].network) {
+      return subnets_[i].priority;
+    }
+  }
+  return default_priority_;
+}
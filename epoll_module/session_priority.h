@@ -0,0 +1,83 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the priority classes of the sessions.
+
+#ifndef EPOLL_SESSION_PRIORITY_H__
+#define EPOLL_SESSION_PRIORITY_H__
+
+#include <netinet/in.h>
+#include <vector>
+#include <common.h>
+
+/// The priority class of a session. The service dispatches the ready
+/// sessions of the higher classes first in every loop iteration.
+enum SessionPriority {
+  SESSION_PRIORITY_HIGH,      // the control traffic, never deferred
+  SESSION_PRIORITY_NORMAL,    // the default class
+  SESSION_PRIORITY_LOW,       // the bulk traffic
+  SESSION_PRIORITY_COUNT
+};
+
+/// The options of the priority classes
+struct PriorityOptions {
+  // the bytes read from the sessions of each class per loop iteration,
+  // the sessions left are dispatched in the next iterations after the
+  // higher classes, 0 for no limit. The high class is never limited
+  int read_budget[SESSION_PRIORITY_COUNT];
+  // the IO services only receiving the high priority connections, they
+  // are not rebalanced nor retired
+  int high_priority_services;
+
+  PriorityOptions()
+    : high_priority_services(0) {
+    for (int i = 0; i < SESSION_PRIORITY_COUNT; ++i) {
+      read_budget[i] = 0;
+    }
+  }
+};
+
+/// The classifier of the accepted connections, it is only called on the
+/// listen thread. The handler could change the class later by
+/// TCPSession::set_priority, the session stays on its service then.
+class SessionClassifier {
+ public:
+  // Default empty virtual destructor
+  virtual ~SessionClassifier() {}
+  // Returns the class of the connection from the address
+  virtual SessionPriority Classify(const sockaddr_in& address) = 0;
+};
+
+/// The classifier by the subnets of the peer addresses, the first
+/// matching subnet wins
+class SubnetClassifier : public SessionClassifier {
+ public:
+  explicit SubnetClassifier(
+    SessionPriority default_priority = SESSION_PRIORITY_NORMAL);
+
+  // Adds the subnet in the CIDR notation such as "10.0.0.0/8", a single
+  // address without the prefix length matches itself only
+  int AddSubnet(const char* cidr, SessionPriority priority);
+
+  virtual SessionPriority Classify(const sockaddr_in& address);
+
+ private:
+  struct Subnet {
+    // in host order
+    uint32_t network;
+    uint32_t mask;
+    SessionPriority priority;
+  };
+
+  SessionPriority default_priority_;
+  std::vector<Subnet> subnets_;
+  // Disable copying of SubnetClassifier
+  DISALLOW_CONSTRUCTORS(SubnetClassifier);
+};
+
+#endif // EPOLL_SESSION_PRIORITY_H__
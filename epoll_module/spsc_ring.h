@@ -0,0 +1,209 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines a bounded single-writer/single-reader lock-free ring.
+
+#ifndef EPOLL_SPSC_RING_H__
+#define EPOLL_SPSC_RING_H__
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <assert.h>
+#include <atomic>
+#include <common.h>
+
+//  This class is a bounded alternative of SpscQueue with the same
+//  interface, so that Pipe could select either of them. The items are
+//  stored in a power of two sized ring allocated once by Init, nothing
+//  is allocated afterwards and a write fails when the ring is full.
+//
+//  The writer and the reader indexes live on separate cache lines, and
+//  each side keeps a cached copy of the remote index so that it only
+//  touches the remote cache line when the cached one says the ring is
+//  full or empty.
+//
+//  T is the type of the object in the ring.
+//  N is the capacity of the ring, it should be a power of two.
+template <typename T, int N>
+class SpscRing {
+ public:
+  static_assert(N > 0 && (N & (N - 1)) == 0,
+    "the capacity should be a power of two");
+
+  inline SpscRing()
+    : values_(nullptr)
+    , tail_(0)
+    , write_(0)
+    , flush_(0)
+    , cached_head_(0)
+    , head_(0)
+    , cached_tail_(0)
+    , sleeping_(false) {}
+
+  inline ~SpscRing() {
+    free(values_);
+  }
+
+  /// Initialize the ring. May fail when memory allocation failed.
+  inline int Init() {
+    values_ = reinterpret_cast<T*>(malloc(sizeof(T) * N));
+    if (nullptr == values_) {
+      return EPOLL_NOMEM;
+    }
+    return 0;
+  }
+
+  //  Write an item to the ring.  Don't flush it yet. If incomplete is
+  //  set to true the item is assumed to be continued by items
+  //  subsequently written to the ring. Incomplete items are never
+  //  flushed down the stream. Fails when the ring is full.
+  inline int Write(const T& value, bool incomplete) {
+    if (write_ - cached_head_ == static_cast<size_t>(N)) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (write_ - cached_head_ == static_cast<size_t>(N)) {
+        return EPOLL_BUSY;
+      }
+    }
+    values_[write_ & kMask] = value;
+    ++write_;
+    if (!incomplete) {
+      flush_ = write_;
+    }
+    return 0;
+  }
+
+  //  Write at most count complete items to the ring, returns the count
+  //  of the written items. They are flushed by the next Flush.
+  inline int WriteBatch(const T* values, int count) {
+    size_t space = N - (write_ - cached_head_);
+    if (space < static_cast<size_t>(count)) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      space = N - (write_ - cached_head_);
+    }
+    if (space < static_cast<size_t>(count)) {
+      count = static_cast<int>(space);
+    }
+    for (int i = 0; i < count; ++i) {
+      values_[(write_ + i) & kMask] = values[i];
+    }
+    write_ += count;
+    flush_ = write_;
+    return count;
+  }
+
+  //  Pop an incomplete item from the ring. Returns true is such
+  //  item exists, false otherwise.
+  inline bool Unwrite(T* value) {
+    if (flush_ == write_) {
+      return false;
+    }
+    --write_;
+    *value = values_[write_ & kMask];
+    return true;
+  }
+
+  //  Flush all the completed items into the ring. Returns false if
+  //  the reader thread is sleeping. In that case, caller is obliged to
+  //  wake the reader up before using the ring again.
+  inline bool Flush() {
+    if (tail_.load(std::memory_order_relaxed) == flush_) {
+      return true;
+    }
+    tail_.store(flush_, std::memory_order_seq_cst);
+    //  Either the reader sees the new tail when checking again after
+    //  going asleep, or the writer sees it asleep here.
+    if (sleeping_.load(std::memory_order_seq_cst)) {
+      sleeping_.store(false, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  //  Check whether item is available for reading. When there is no
+  //  item the reader is considered asleep until the next flush.
+  inline bool CheckRead() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head != cached_tail_) {
+      return true;
+    }
+    cached_tail_ = tail_.load(std::memory_order_acquire);
+    if (head != cached_tail_) {
+      return true;
+    }
+    sleeping_.store(true, std::memory_order_seq_cst);
+    cached_tail_ = tail_.load(std::memory_order_seq_cst);
+    if (head != cached_tail_) {
+      sleeping_.store(false, std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+
+  //  Reads an item from the ring. Returns false if there is no value.
+  //  available.
+  inline bool Read(T* value) {
+    if (!CheckRead()) {
+      return false;
+    }
+    size_t head = head_.load(std::memory_order_relaxed);
+    *value = values_[head & kMask];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  //  Reads at most count items from the ring, returns the count of the
+  //  read items.
+  inline int ReadBatch(T* values, int count) {
+    if (!CheckRead()) {
+      return 0;
+    }
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t available = cached_tail_ - head;
+    if (available < static_cast<size_t>(count)) {
+      count = static_cast<int>(available);
+    }
+    for (int i = 0; i < count; ++i) {
+      values[i] = values_[(head + i) & kMask];
+    }
+    head_.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+ private:
+  static const size_t kCacheLineSize = 64;
+  static const size_t kMask = N - 1;
+
+  //  The items, read only after Init.
+  T* values_;
+  uint8_t padding0_[kCacheLineSize];
+
+  //  The writer side. The tail is the flushed position read by the
+  //  reader, the others are used exclusively by writer thread.
+  std::atomic<size_t> tail_;
+  size_t write_;
+  size_t flush_;
+  size_t cached_head_;
+  uint8_t padding1_[kCacheLineSize];
+
+  //  The reader side. The head is the read position read by the writer
+  //  when the ring looks full, the cached tail is used exclusively by
+  //  reader thread.
+  std::atomic<size_t> head_;
+  size_t cached_tail_;
+  uint8_t padding2_[kCacheLineSize];
+
+  //  Set by the reader when it found the ring empty, cleared by the
+  //  writer when it asks to wake the reader.
+  std::atomic<bool> sleeping_;
+  uint8_t padding3_[kCacheLineSize];
+
+  //  Disable copying of SpscRing
+  DISALLOW_CONSTRUCTORS(SpscRing);
+};
+
+#endif // EPOLL_SPSC_RING_H__
@@ -0,0 +1,195 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <stall_watchdog.h>
+
+#include <arpa/inet.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <logging.h>
+
+namespace {
+
+// the watch of the service thread, read by the signal handler
+thread_local LoopWatch* current_watch = nullptr;
+
+int StackSignal() {
+  return SIGRTMIN + 1;
+}
+
+}  // namespace
+
+// Captures the stack of the interrupted thread, backtrace was called once
+// before so that it does not load anything here
+void CaptureStack(int /*signal*/) {
+  LoopWatch* watch = current_watch;
+  if (nullptr != watch) {
+    watch->Capture();
+  }
+}
+
+LoopWatch::LoopWatch()
+  : thread_(0)
+  , iteration_start_(0)
+  , stage_("")
+  , session_id_(0)
+  , peer_(0)
+  , reported_start_(0)
+  , frame_count_(0) {
+  memset(frames_, 0, sizeof(frames_));
+}
+
+void LoopWatch::Capture() {
+  int count = backtrace(frames_, kMaxFrames);
+  frame_count_.store(count, std::memory_order_release);
+}
+
+StallWatchdog::StallWatchdog()
+  : threshold_(0)
+  , stopping_(false)
+  , stall_count_(0) {
+}
+
+StallWatchdog::~StallWatchdog() {
+  Stop();
+}
+
+int StallWatchdog::Start(int64_t threshold) {
+  if (threshold <= 0) {
+    return EPOLL_INVALID;
+  }
+  if (thread_.joinable()) {
+    return EPOLL_BUSY;
+  }
+  // load the unwinder now, it may allocate on the first call
+  void* frames[2];
+  backtrace(frames, 2);
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = CaptureStack;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(StackSignal(), &action, nullptr) != 0) {
+    return EPOLL_FAIL;
+  }
+  threshold_ = threshold;
+  stopping_ = false;
+  thread_ = std::thread(&StallWatchdog::Run, this);
+  return 0;
+}
+
+void StallWatchdog::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+  thread_.join();
+}
+
+void StallWatchdog::Register(LoopWatch* watch) {
+  watch->thread_ = pthread_self();
+  current_watch = watch;
+  std::lock_guard<std::mutex> lock(mutex_);
+  watches_.push_back(watch);
+}
+
+void StallWatchdog::Unregister(LoopWatch* watch) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<LoopWatch*>::iterator it =
+    std::find(watches_.begin(), watches_.end(), watch);
+  if (it != watches_.end()) {
+    watches_.erase(it);
+  }
+  if (current_watch == watch) {
+    current_watch = nullptr;
+  }
+}
+
+std::vector<StallReport> StallWatchdog::stall_reports() {
+  std::lock_guard<std::mutex> lock(reports_mutex_);
+  return std::vector<StallReport>(reports_.begin(), reports_.end());
+}
+
+void StallWatchdog::Run() {
+  // check twice per threshold, the stalls are reported late by half of
+  // the threshold at most
+  int64_t interval = std::max<int64_t>(1000,
+    std::min<int64_t>(threshold_ / 2, 100000));
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    condition_.wait_for(lock, std::chrono::microseconds(interval));
+    int64_t now = GetCurrentMicroseconds();
+    for (size_t i = 0; i < watches_.size() && !stopping_; ++i) {
+      LoopWatch* watch = watches_[i];
+      int64_t start = watch->iteration_start_.load(std::memory_order_relaxed);
+      if (0 == start || start == watch->reported_start_ ||
+        now - start < threshold_) {
+        continue;
+      }
+      watch->reported_start_ = start;
+      Report(watch, start, now);
+    }
+  }
+}
+
+void StallWatchdog::Report(LoopWatch* watch, int64_t start, int64_t now) {
+  StallReport report;
+  report.start_time = start;
+  report.duration = now - start;
+  report.stage = watch->stage_.load(std::memory_order_relaxed);
+  report.session_id = watch->session_id_.load(std::memory_order_relaxed);
+  uint64_t peer = watch->peer_.load(std::memory_order_relaxed);
+  memset(&report.address, 0, sizeof(report.address));
+  report.address.sin_family = AF_INET;
+  report.address.sin_addr.s_addr = static_cast<uint32_t>(peer >> 32);
+  report.address.sin_port = static_cast<uint16_t>(peer & 0xffff);
+
+  // the thread is still stalled unless it ended the iteration meanwhile
+  watch->frame_count_.store(-1, std::memory_order_relaxed);
+  if (pthread_kill(watch->thread_, StackSignal()) == 0) {
+    for (int i = 0; i < kStackWait; ++i) {
+      if (watch->frame_count_.load(std::memory_order_acquire) >= 0) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  int count = watch->frame_count_.load(std::memory_order_acquire);
+  if (count > 0) {
+    char** symbols = backtrace_symbols(watch->frames_, count);
+    // skip the frames of the signal handler
+    for (int i = 2; nullptr != symbols && i < count; ++i) {
+      report.stack.push_back(symbols[i]);
+    }
+    free(symbols);
+  }
+  stall_count_.fetch_add(1, std::memory_order_relaxed);
+
+  EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_WARN, 10,
+    "event loop stalled {} us in {}, session: {}, peer: {}:{}",
+    report.duration, report.stage, report.session_id,
+    inet_ntoa(report.address.sin_addr), ntohs(report.address.sin_port));
+  for (size_t i = 0; i < report.stack.size(); ++i) {
+    EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_WARN, 100, "  #{} {}", i,
+      report.stack[i].c_str());
+  }
+
+  std::lock_guard<std::mutex> lock(reports_mutex_);
+  reports_.push_back(report);
+  if (reports_.size() > kMaxReports) {
+    reports_.pop_front();
+  }
+}
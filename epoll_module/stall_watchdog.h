@@ -0,0 +1,157 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the watchdog of the stalled event loops.
+
+#ifndef EPOLL_STALL_WATCHDOG_H__
+#define EPOLL_STALL_WATCHDOG_H__
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <common.h>
+#include <tcp_session.h>
+
+/// The loop iteration of one service thread as seen by the watchdog, it is
+/// written by the service thread with relaxed stores only
+class LoopWatch {
+ public:
+  // the max frames of a captured stack
+  static const int kMaxFrames = 32;
+
+  LoopWatch();
+
+  // the iteration started, called on the service thread
+  void Begin(int64_t time) {
+    session_id_.store(0, std::memory_order_relaxed);
+    stage_.store("dispatch", std::memory_order_relaxed);
+    iteration_start_.store(time, std::memory_order_relaxed);
+  }
+
+  // the iteration ended, the thread waits for the events
+  void End() {
+    iteration_start_.store(0, std::memory_order_relaxed);
+  }
+
+  // the session being handled
+  void set_session(TCPSession* session) {
+    const sockaddr_in& address = session->address();
+    session_id_.store(session->session_id(), std::memory_order_relaxed);
+    peer_.store((static_cast<uint64_t>(address.sin_addr.s_addr) << 32) |
+      address.sin_port, std::memory_order_relaxed);
+  }
+
+  // the stage of the iteration, the name should be a string literal
+  void set_stage(const char* stage) {
+    session_id_.store(0, std::memory_order_relaxed);
+    stage_.store(stage, std::memory_order_relaxed);
+  }
+
+ private:
+  friend class StallWatchdog;
+  friend void CaptureStack(int signal);
+
+  // capture the stack in the signal handler on the service thread
+  void Capture();
+
+  pthread_t thread_;
+  std::atomic<int64_t> iteration_start_;
+  std::atomic<const char*> stage_;
+  std::atomic<uint64_t> session_id_;
+  // the peer address of the session, the ip in the high 32 bits and the
+  // port in the low 16 bits, in network order
+  std::atomic<uint64_t> peer_;
+  // the iteration reported already, touched by the watchdog only
+  int64_t reported_start_;
+  // the stack captured by the signal handler on the service thread
+  void* frames_[kMaxFrames];
+  std::atomic<int> frame_count_;
+  // Disable copying of LoopWatch
+  DISALLOW_CONSTRUCTORS(LoopWatch);
+};
+
+/// A loop iteration which exceeded the threshold
+struct StallReport {
+  // the time the iteration started and how long it had run when reported,
+  // in microseconds
+  int64_t start_time;
+  int64_t duration;
+  // the stage of the iteration and the session being handled, 0 if none
+  const char* stage;
+  uint64_t session_id;
+  sockaddr_in address;
+  // the symbolized stack of the stalled thread
+  std::vector<std::string> stack;
+};
+
+/// This class watches the loop iterations of the registered services from
+/// its own thread. An iteration running past the threshold is logged once
+/// with the session being handled, and the stack of the stalled thread is
+/// captured by interrupting it with the real-time signal SIGRTMIN + 1,
+/// which the application should leave to the watchdog. The handler is
+/// installed with SA_RESTART, but the calls never restarted after a
+/// signal, such as the sleeps, return early in the interrupted thread.
+class StallWatchdog {
+ public:
+  // the reports kept for stall_reports
+  static const size_t kMaxReports = 16;
+
+  StallWatchdog();
+  ~StallWatchdog();
+
+  // Starts watching with the threshold in microseconds
+  int Start(int64_t threshold);
+
+  void Stop();
+
+  // register the calling service thread, called on the service thread
+  void Register(LoopWatch* watch);
+
+  // the watch is not checked any more once it returns
+  void Unregister(LoopWatch* watch);
+
+  // the count of the stalls detected
+  uint64_t stall_count() const {
+    return stall_count_.load(std::memory_order_relaxed);
+  }
+
+  // the latest stalls, the oldest first
+  std::vector<StallReport> stall_reports();
+
+ private:
+  // the max time to wait for the stack of the stalled thread, in
+  // milliseconds
+  static const int kStackWait = 100;
+
+  void Run();
+
+  // report the stall of the watch
+  void Report(LoopWatch* watch, int64_t start, int64_t now);
+
+  int64_t threshold_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool stopping_;
+  // the registered watches, the mutex is held while checking them so that
+  // a watch is never touched once unregistered
+  std::vector<LoopWatch*> watches_;
+  std::mutex reports_mutex_;
+  std::deque<StallReport> reports_;
+  std::atomic<uint64_t> stall_count_;
+  // Disable copying of StallWatchdog
+  DISALLOW_CONSTRUCTORS(StallWatchdog);
+};
+
+#endif // EPOLL_STALL_WATCHDOG_H__
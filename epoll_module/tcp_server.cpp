@@ -1,18 +1,48 @@
 
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
 #include <string.h>
-#include <iostream>
 #include <unistd.h>
 
 #include <common.h>
+#include <logging.h>
 #include <tcp_service.h>
 #include <tcp_server.h>
 #include <tcp_session.h>
 
+namespace {
+
+// close the refused connection with a reset, so that no TIME_WAIT is left
+// on the server for the connections of a storm
+void RefuseConnection(int socket) {
+  linger option;
+  option.l_onoff = 1;
+  option.l_linger = 0;
+  setsockopt(socket, SOL_SOCKET, SO_LINGER, &option, sizeof(option));
+  close(socket);
+}
+
+}  // namespace
+
 TCPServer::TCPServer()
-  : next_service_(0)
-  , stopped_(true){
+  : stopped_(true)
+  , placement_policy_(CreatePlacementPolicy(PLACEMENT_POLICY_ROUND_ROBIN))
+  , listen_socket_(-1)
+  , inline_(false)
+  , epoll_module_count_(0)
+  , arena_type_(MEMORY_ARENA_NONE)
+  , defer_accept_seconds_(0)
+  , rebalance_threshold_(0)
+  , scratch_reset_policy_(SCRATCH_RESET_ITERATION)
+  , service_listener_(nullptr)
+  , next_priority_service_(0)
+  , last_rebalance_time_(0)
+  , retiring_count_(0)
+  , service_count_(0)
+  , mesh_(new MessageMesh())
+  , stall_threshold_(0)
+  , transport_sample_interval_(0) {
   //nothing
 }
 
@@ -21,12 +51,18 @@ TCPServer::~TCPServer() {
 }
 
 int TCPServer::InitServer(const char* ip_adress, int port,
-                          int epoll_module_count) {
+                          int epoll_module_count,
+                          MemoryArenaType arena_type) {
   if (epoll_module_count == 0) {
     return EPOLL_FAIL;
   }
   epoll_module_count_ = epoll_module_count;
-  listen_socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  arena_type_ = arena_type;
+  listen_socket_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+    IPPROTO_TCP);
+  if (listen_socket_ == -1) {
+    return EPOLL_FAIL;
+  }
 
   sockaddr_in server_sockaddr;
   server_sockaddr.sin_family = AF_INET;
@@ -43,31 +79,86 @@ int TCPServer::InitServer(const char* ip_adress, int port,
   return 0;
 }
 
+int TCPServer::InitInline(const char* ip_adress, int port,
+                          MemoryArenaType arena_type) {
+  CHECK_RESULT(InitServer(ip_adress, port, 1, arena_type));
+  inline_ = true;
+  return 0;
+}
+
+int TCPServer::InitClient(int epoll_module_count,
+                          MemoryArenaType arena_type) {
+  if (epoll_module_count == 0) {
+    return EPOLL_FAIL;
+  }
+  epoll_module_count_ = epoll_module_count;
+  arena_type_ = arena_type;
+  listen_socket_ = -1;
+  return 0;
+}
+
 int TCPServer::StartServer() {
-  int rst = 0;
-  rst = listen(listen_socket_, SOMAXCONN);
-  if (rst == -1) {
+  if (0 == epoll_module_count_) {
     return EPOLL_FAIL;
   }
+  // the rebalancing would move the sessions off the services of their keys
+  if (rebalance_threshold_ > 0 && placement_policy_->HasAffinity()) {
+    return EPOLL_INVALID;
+  }
+  if (listen_socket_ >= 0) {
+    if (defer_accept_seconds_ > 0 &&
+      setsockopt(listen_socket_, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+        &defer_accept_seconds_, sizeof(defer_accept_seconds_)) == -1) {
+      return EPOLL_FAIL;
+    }
+    if (listen(listen_socket_, SOMAXCONN) == -1) {
+      return EPOLL_FAIL;
+    }
+  }
+  if (admission_options_.enabled()) {
+    admission_control_.reset(new AdmissionControl(admission_options_));
+  }
+  if (stall_threshold_ > 0) {
+    CHECK_RESULT(watchdog_.Start(stall_threshold_));
+  }
+  if (inline_) {
+    // the listen session is the first one started by the IO service
+    std::shared_ptr<TCPService> tcp_service;
+    CHECK_RESULT(CreateService(&tcp_service));
+    services_.push_back(tcp_service);
+    service_count_ = 1;
+    stopped_ = false;
+    TCPSession* listen_session = new TCPSession(listen_socket_,
+      TCP_SESSION_TYPE_LISTEN, EPOLLET | EPOLLIN);
+    return tcp_service->PushSessions(listen_session);
+  }
 
   // start event service
   for (int i = 0; i < epoll_module_count_; ++i) {
-    std::shared_ptr<TCPService> tcp_service(new TCPService());
-    CHECK_RESULT(tcp_service->Init(TCP_SERVICE_TYPE_NORMAL,
-      128, shared_from_this()));
-    tcp_service->Start(3000);
+    std::shared_ptr<TCPService> tcp_service;
+    CHECK_RESULT(CreateService(&tcp_service));
     services_.push_back(tcp_service);
   }
+  service_count_ = epoll_module_count_;
+  for (int i = 0; i < priority_options_.high_priority_services; ++i) {
+    std::shared_ptr<TCPService> tcp_service;
+    CHECK_RESULT(CreateService(&tcp_service));
+    priority_services_.push_back(tcp_service);
+  }
   // start listen service
   listen_service_.reset(new TCPService());
   CHECK_RESULT(listen_service_->Init(TCP_SERVICE_TYPE_LISTEN, 
     128, shared_from_this()));
-  listen_service_->Start(-1);
-  // add listen socket
-  int event = EPOLLET | EPOLLIN;
-  TCPSession* listen_session = new TCPSession(listen_socket_,
-    TCP_SESSION_TYPE_LISTEN, event);
-  CHECK_RESULT(listen_service_->PushSessions(listen_session));
+  listen_service_->Start(rebalance_threshold_ > 0 ?
+    kRebalanceCheckInterval : -1);
+  // add listen socket, the listen service of a client only forwards the
+  // messages of the services
+  if (listen_socket_ >= 0) {
+    int event = EPOLLET | EPOLLIN;
+    TCPSession* listen_session = new TCPSession(listen_socket_,
+      TCP_SESSION_TYPE_LISTEN, event);
+    CHECK_RESULT(listen_service_->PushSessions(listen_session));
+  }
   stopped_ = false;
   return 0;
 }
@@ -76,9 +167,16 @@ void TCPServer::StopServer() {
   if (stopped_) {
     return;
   }
-  listen_service_->Stop();
+  capture_.Stop();
+  if (inline_) {
+    DoStop();
+  } else {
+    listen_service_->Stop();
+  }
   services_.clear();
-  if (listen_socket_ > 0) {
+  priority_services_.clear();
+  watchdog_.Stop();
+  if (listen_socket_ >= 0) {
     close(listen_socket_);
     listen_socket_ = -1;
   }
@@ -89,6 +187,18 @@ void TCPServer::DoStop() {
   for (size_t i = 0; i < services_.size(); ++i) {
     services_[i]->Stop();
   }
+  for (size_t i = 0; i < priority_services_.size(); ++i) {
+    priority_services_[i]->Stop();
+  }
+  for (size_t i = 0; i < retiring_services_.size(); ++i) {
+    retiring_services_[i]->Stop();
+  }
+  retiring_services_.clear();
+  std::lock_guard<std::mutex> lock(resize_mutex_);
+  for (size_t i = 0; i < adding_services_.size(); ++i) {
+    adding_services_[i]->Stop();
+  }
+  adding_services_.clear();
 }
 
 int TCPServer::HandleAccpet() {
@@ -100,39 +210,332 @@ int TCPServer::HandleAccpet() {
   struct sockaddr_in conn_address;
   socklen_t addrLen = sizeof(conn_address);
 
-  // session info
-  int event = EPOLLET | EPOLLIN | EPOLLOUT| EPOLLRDHUP;
-  std::shared_ptr<TCPService> service;
-  TCPSession* session = nullptr;
-  PipeMsg msg = nullptr;
-
-  // get socket
-  while ((conn_socket = accept(listen_socket_,
-    (struct sockaddr *)&conn_address, &addrLen)) > 0) {
-    service = GetNextService();
-    if (service->ConsumeRecycleQueue(&msg)) {
-      session = new(msg) TCPSession(conn_socket,
-        TCP_SESSION_TYPE_NORMAL, event);
-    } else {
-      session = (new TCPSession(conn_socket,
-        TCP_SESSION_TYPE_NORMAL, event));
+  // the time of the burst for the rate limits
+  int64_t now = admission_control_ ? GetCurrentMicroseconds() : 0;
+
+  // get socket, only the socket and the peer address are passed to the
+  // service, the session would be constructed on the service thread
+  while ((conn_socket = accept4(listen_socket_,
+    (struct sockaddr *)&conn_address, &addrLen,
+    SOCK_NONBLOCK | SOCK_CLOEXEC)) > 0) {
+    addrLen = sizeof(conn_address);
+    bool tracked = false;
+    if (admission_control_) {
+      AdmissionResult result = admission_control_->Admit(conn_address, now,
+        &tracked);
+      if (result != ADMISSION_ACCEPTED) {
+        RefuseConnection(conn_socket);
+        EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_WARN, 1,
+          "connection refused by admission, reason: {}", result);
+        continue;
+      }
+    }
+    SessionPriority priority = session_classifier_ ?
+      session_classifier_->Classify(conn_address) : SESSION_PRIORITY_NORMAL;
+    if (inline_) {
+      // this thread is the IO thread of the connection
+      services_[0]->StartSocket(conn_socket, conn_address, priority,
+        tracked);
+      continue;
+    }
+    if (PlaceConnection(priority, AffinityKey(conn_address))->PushSocket(
+      conn_socket, conn_address, priority, tracked) != 0) {
+      close(conn_socket);
+      if (admission_control_) {
+        admission_control_->Release(conn_address, tracked);
+      }
     }
-    service->PushSessions(session);
   }
   if (conn_socket == -1) {
     if (errno != EAGAIN && errno != ECONNABORTED 
       && errno != EPROTO && errno != EINTR) {
-      std::cout << "accept error, errno: " << errno << std::endl;
+      EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_ERROR, 10,
+        "accept error, errno: {}", errno);
+    }
+  }
+  if (inline_) {
+    return 0;
+  }
+  // flush once per accept burst
+  for (size_t i = 0; i < services_.size(); ++i) {
+    services_[i]->FlushSockets();
+  }
+  for (size_t i = 0; i < priority_services_.size(); ++i) {
+    priority_services_[i]->FlushSockets();
+  }
+  return 0;
+}
+
+void TCPServer::ListenActivate() {
+  if (listen_service_) {
+    listen_service_->EventActivate();
+  }
+}
+
+void TCPServer::ForwardMessages() {
+  for (size_t i = 0; i < services_.size(); ++i) {
+    ForwardMessages(services_[i]);
+  }
+  for (size_t i = 0; i < priority_services_.size(); ++i) {
+    ForwardMessages(priority_services_[i]);
+  }
+  for (size_t i = 0; i < retiring_services_.size();) {
+    if (ForwardMessages(retiring_services_[i])) {
+      retiring_services_[i]->Stop();
+      // the thread of the service has exited, the arena could be owned
+      // by the next new service
+      if (retiring_services_[i]->arena()) {
+        std::lock_guard<std::mutex> lock(resize_mutex_);
+        idle_arenas_.push_back(retiring_services_[i]->arena());
+      }
+      retiring_services_.erase(retiring_services_.begin() + i);
+    } else {
+      ++i;
+    }
+  }
+}
+
+bool TCPServer::ForwardMessages(const std::shared_ptr<TCPService>& service) {
+  PipeMsg msg;
+  while (service->PopMessage(&msg) == 0) {
+    if (msg.type == PIPE_MSG_RETIRED) {
+      return true;
+    }
+    if (msg.type != PIPE_MSG_MIGRATE) {
+      continue;
+    }
+    // the target may have retired since the session left
+    TCPService* target = FindService(msg.target);
+    if (nullptr == target) {
+      TCPSession* migrant = reinterpret_cast<TCPSession*>(msg.data);
+      target = GetNextService(0 != migrant->affinity_key() ?
+        migrant->affinity_key() : AffinityKey(migrant->address())).get();
+    }
+    msg.target = target;
+    if (target->PushMessage(msg) != 0) {
+      TCPSession* migrant = reinterpret_cast<TCPSession*>(msg.data);
+      if (admission_control_ && !migrant->outbound()) {
+        admission_control_->Release(migrant->address(),
+          migrant->admission_tracked());
+      }
+      migrant->Stop();
+      delete migrant;
+    }
+  }
+  return false;
+}
+
+TCPService* TCPServer::FindService(void* service) {
+  for (size_t i = 0; i < services_.size(); ++i) {
+    if (services_[i].get() == service) {
+      return services_[i].get();
+    }
+  }
+  for (size_t i = 0; i < priority_services_.size(); ++i) {
+    if (priority_services_[i].get() == service) {
+      return priority_services_[i].get();
     }
   }
+  return nullptr;
+}
+
+int TCPServer::CreateService(std::shared_ptr<TCPService>* service) {
+  std::shared_ptr<TCPService> tcp_service(new TCPService());
+  CHECK_RESULT(tcp_service->Init(TCP_SERVICE_TYPE_NORMAL,
+    kServiceEvents, shared_from_this()));
+  tcp_service->set_arena(AcquireArena());
+  tcp_service->Start(kServiceLoopWait);
+  *service = tcp_service;
   return 0;
 }
 
-const std::shared_ptr<TCPService>& TCPServer::GetNextService() {
-  const std::shared_ptr<TCPService>& result = services_[next_service_];
-  next_service_++;
-  if (next_service_ == static_cast<int>(services_.size())) {
-    next_service_ = 0;
+std::shared_ptr<MemoryArena> TCPServer::AcquireArena() {
+  std::shared_ptr<MemoryArena> arena;
+  if (MEMORY_ARENA_NONE == arena_type_) {
+    return arena;
+  }
+  std::lock_guard<std::mutex> lock(resize_mutex_);
+  if (!idle_arenas_.empty()) {
+    arena = idle_arenas_.back();
+    idle_arenas_.pop_back();
+  } else {
+    arena.reset(new MemoryArena(arena_type_));
+    arenas_.push_back(arena);
+  }
+  return arena;
+}
+
+MemoryArenaStats TCPServer::arena_stats() {
+  MemoryArenaStats result;
+  memset(&result, 0, sizeof(result));
+  std::lock_guard<std::mutex> lock(resize_mutex_);
+  for (size_t i = 0; i < arenas_.size(); ++i) {
+    MemoryArenaStats stats = arenas_[i]->stats();
+    result.mapped_bytes += stats.mapped_bytes;
+    result.hugetlb_bytes += stats.hugetlb_bytes;
+    result.thp_bytes += stats.thp_bytes;
+    result.used_bytes += stats.used_bytes;
+    result.heap_allocations += stats.heap_allocations;
   }
   return result;
 }
+
+EventLoopStats TCPServer::loop_stats() {
+  std::lock_guard<std::mutex> lock(loop_stats_mutex_);
+  return loop_stats_;
+}
+
+void TCPServer::AddLoopStats(const EventLoopStats& stats) {
+  std::lock_guard<std::mutex> lock(loop_stats_mutex_);
+  loop_stats_.Merge(stats);
+}
+
+void TCPServer::TopSessions(TransportOrder order, size_t count,
+  std::vector<TransportStats>* result) {
+  result->clear();
+  {
+    std::lock_guard<std::mutex> lock(transport_mutex_);
+    std::map<TCPService*, std::vector<TransportStats>>::iterator it;
+    for (it = transport_stats_.begin(); it != transport_stats_.end(); ++it) {
+      result->insert(result->end(), it->second.begin(), it->second.end());
+    }
+  }
+  SelectWorstSessions(order, count, result);
+}
+
+void TCPServer::PublishTransportStats(TCPService* service,
+  std::vector<TransportStats>* stats) {
+  std::lock_guard<std::mutex> lock(transport_mutex_);
+  if (stats->empty()) {
+    transport_stats_.erase(service);
+    return;
+  }
+  transport_stats_[service].swap(*stats);
+}
+
+int TCPServer::AddService() {
+  if (stopped_) {
+    return EPOLL_FAIL;
+  }
+  if (inline_) {
+    return EPOLL_INVALID;
+  }
+  std::shared_ptr<TCPService> tcp_service;
+  CHECK_RESULT(CreateService(&tcp_service));
+  {
+    std::lock_guard<std::mutex> lock(resize_mutex_);
+    adding_services_.push_back(tcp_service);
+    ++service_count_;
+  }
+  ListenActivate();
+  return 0;
+}
+
+int TCPServer::RetireService() {
+  if (stopped_) {
+    return EPOLL_FAIL;
+  }
+  if (inline_) {
+    return EPOLL_INVALID;
+  }
+  {
+    std::lock_guard<std::mutex> lock(resize_mutex_);
+    if (service_count_ <= 1) {
+      return EPOLL_INVALID;
+    }
+    ++retiring_count_;
+    --service_count_;
+  }
+  ListenActivate();
+  return 0;
+}
+
+int TCPServer::service_count() {
+  std::lock_guard<std::mutex> lock(resize_mutex_);
+  return service_count_;
+}
+
+bool TCPServer::IsPriorityService(const TCPService* service) const {
+  for (size_t i = 0; i < priority_services_.size(); ++i) {
+    if (priority_services_[i].get() == service) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TCPServer::DoResize() {
+  std::vector<std::shared_ptr<TCPService>> adding;
+  int retiring = 0;
+  {
+    std::lock_guard<std::mutex> lock(resize_mutex_);
+    adding.swap(adding_services_);
+    retiring = retiring_count_;
+    retiring_count_ = 0;
+  }
+  services_.insert(services_.end(), adding.begin(), adding.end());
+  while (retiring-- > 0 && services_.size() > 1) {
+    // the service with the least sessions is the cheapest to drain
+    size_t idlest = 0;
+    for (size_t i = 1; i < services_.size(); ++i) {
+      if (services_[i]->active_sessions() <
+        services_[idlest]->active_sessions()) {
+        idlest = i;
+      }
+    }
+    std::shared_ptr<TCPService> service = services_[idlest];
+    // no more connections are placed on the service from now on, the
+    // sockets pushed before would be started and moved away in order
+    services_.erase(services_.begin() + idlest);
+    if (service->RequestRetire() != 0) {
+      service->Stop();
+      continue;
+    }
+    retiring_services_.push_back(service);
+  }
+}
+
+void TCPServer::DoRebalance() {
+  if (stopped_ || rebalance_threshold_ <= 0 || services_.size() < 2) {
+    return;
+  }
+  int64_t current_time = GetCurrentMicroseconds();
+  if (current_time - last_rebalance_time_ < kRebalanceInterval) {
+    return;
+  }
+  size_t busiest = 0;
+  size_t idlest = 0;
+  int64_t most_busy = services_[0]->recent_busy_time();
+  int64_t least_busy = most_busy;
+  for (size_t i = 1; i < services_.size(); ++i) {
+    int64_t busy = services_[i]->recent_busy_time();
+    if (busy > most_busy) {
+      most_busy = busy;
+      busiest = i;
+    }
+    if (busy < least_busy) {
+      least_busy = busy;
+      idlest = i;
+    }
+  }
+  if (most_busy - least_busy < rebalance_threshold_) {
+    return;
+  }
+  last_rebalance_time_ = current_time;
+  services_[busiest]->RequestRebalance(services_[idlest].get());
+}
+
+const std::shared_ptr<TCPService>& TCPServer::GetNextService(uint64_t key) {
+  return services_[placement_policy_->SelectByKey(services_, key)];
+}
+
+TCPService* TCPServer::PlaceConnection(SessionPriority priority,
+  uint64_t key) {
+  if (SESSION_PRIORITY_HIGH != priority || priority_services_.empty()) {
+    return GetNextService(key).get();
+  }
+  // the control connections are few, take turns
+  next_priority_service_ = (next_priority_service_ + 1) %
+    priority_services_.size();
+  return priority_services_[next_priority_service_].get();
+}
@@ -10,11 +10,25 @@
 #ifndef TCP_SERVER_H__
 #define TCP_SERVER_H__
 
+#include <map>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <admission_control.h>
 #include <common.h>
+#include <memory_arena.h>
+#include <message_mesh.h>
+#include <message_parser.h>
+#include <placement_policy.h>
+#include <scratch_arena.h>
+#include <session_priority.h>
+#include <stall_watchdog.h>
+#include <tcp_service.h>
+#include <traffic_capture.h>
+#include <transport_stats.h>
 
 class TCPService;
+class ServiceListener;
 class Pipe;
 
 class TCPServer
@@ -23,7 +37,23 @@ public:
   TCPServer();
   ~TCPServer();
 
-  int InitServer(const char* ip_adress, int port, int epoll_module_count);
+  // the arena type selects the memory of the sessions and their buffers
+  // on every IO service, the huge page arenas fall back to the normal
+  // pages when the huge pages are unavailable
+  int InitServer(const char* ip_adress, int port, int epoll_module_count,
+    MemoryArenaType arena_type = MEMORY_ARENA_NONE);
+
+  // init the server without listening, its IO services only run the
+  // connections opened by TCPService::Connect
+  int InitClient(int epoll_module_count,
+    MemoryArenaType arena_type = MEMORY_ARENA_NONE);
+
+  // init the server with one IO service which accepts the connections
+  // on its own thread, without the listen service. The connections are
+  // started at once by the thread which accepted them, the services are
+  // never added, retired, rebalanced nor dedicated to a priority class
+  int InitInline(const char* ip_adress, int port,
+    MemoryArenaType arena_type = MEMORY_ARENA_NONE);
 
   int StartServer();
 
@@ -32,21 +62,281 @@ public:
   void DoStop();
 
   int HandleAccpet();
+
+  // activate the listen service to forward the service messages
+  void ListenActivate();
+
+  // forward the messages between the services, called on the listen thread
+  void ForwardMessages();
+
+  // start a new IO service, it would receive connections once the listen
+  // thread added it, could be called from any thread
+  int AddService();
+
+  // retire the IO service with the least sessions, its sessions would be
+  // moved to the other services before it stops, at least one service is
+  // kept, could be called from any thread
+  int RetireService();
+
+  // apply the requested services changes, called on the listen thread
+  void DoResize();
+
+  // whether the server was initialized by InitInline
+  bool is_inline() const {
+    return inline_;
+  }
+
+  // the count of the IO services receiving connections
+  int service_count();
+
+  // whether the service is one of those dedicated to the high priority
+  // connections, they are fixed while the server runs, could be called
+  // from any thread
+  bool IsPriorityService(const TCPService* service) const;
+
+  // the usage of the arenas of all the IO services, could be called from
+  // any thread
+  MemoryArenaStats arena_stats();
+
+  // the message mesh between the IO services
+  MessageMesh* mesh() {
+    return mesh_.get();
+  }
+
+  // ask the busiest service to move sessions to the idlest one when the
+  // skew of their busy time passed the threshold, called on the listen
+  // thread
+  void DoRebalance();
+
+  // wake the listen service only when data arrived on the accepted
+  // connection (TCP_DEFER_ACCEPT), 0 to disable, StartServer fails when
+  // the option could not be set, set before StartServer
+  void set_defer_accept_seconds(int seconds) {
+    defer_accept_seconds_ = seconds;
+  }
+
+  // the policy to place the new connections, round robin by default,
+  // StartServer fails with EPOLL_INVALID when the rebalancing is enabled
+  // with the affinity policy, set before StartServer
+  void set_placement_policy(
+    const std::shared_ptr<PlacementPolicy>& placement_policy) {
+    placement_policy_ = placement_policy;
+  }
+
+  const std::shared_ptr<PlacementPolicy>& placement_policy() const {
+    return placement_policy_;
+  }
+
+  // the busy time skew in microseconds per second to trigger rebalancing,
+  // 0 to disable, it is not allowed with the affinity policy, set before
+  // StartServer
+  void set_rebalance_threshold(int64_t rebalance_threshold) {
+    rebalance_threshold_ = rebalance_threshold;
+  }
+
+  // the framing and the handler of the received messages, set before
+  // StartServer
+  void set_message_parser_options(const MessageParserOptions& options) {
+    message_parser_options_ = options;
+  }
+
+  const MessageParserOptions& message_parser_options() const {
+    return message_parser_options_;
+  }
+
+  // the read budgets of the priority classes and the services dedicated
+  // to the high class, set before StartServer
+  void set_priority_options(const PriorityOptions& options) {
+    priority_options_ = options;
+  }
+
+  const PriorityOptions& priority_options() const {
+    return priority_options_;
+  }
+
+  // the classifier of the accepted connections, all of them are of the
+  // normal class without it, set before StartServer
+  void set_session_classifier(
+    const std::shared_ptr<SessionClassifier>& session_classifier) {
+    session_classifier_ = session_classifier;
+  }
+
+  // the limits of the accepted connections, the refused connections are
+  // closed before reaching the services, set before StartServer
+  void set_admission_options(const AdmissionOptions& options) {
+    admission_options_ = options;
+  }
+
+  // the listener called on the thread of every IO service when it starts
+  // and stops, it should outlive the server, set before StartServer
+  void set_service_listener(ServiceListener* service_listener) {
+    service_listener_ = service_listener;
+  }
+
+  ServiceListener* service_listener() const {
+    return service_listener_;
+  }
+
+  // capture the traffic of the sessions into the file until StopCapture,
+  // could be called from any thread while the server runs
+  int StartCapture(const char* path) {
+    return capture_.Start(path);
+  }
+
+  void StopCapture() {
+    capture_.Stop();
+  }
+
+  TrafficCapture* capture() {
+    return &capture_;
+  }
+
+  // the admission control, nullptr when no limit was set
+  AdmissionControl* admission_control() {
+    return admission_control_.get();
+  }
+
+  // report the loop iterations of the services longer than the threshold
+  // in microseconds, 0 to disable, set before StartServer
+  void set_stall_threshold(int64_t stall_threshold) {
+    stall_threshold_ = stall_threshold;
+  }
+
+  // the stall watchdog, nullptr when disabled
+  StallWatchdog* stall_watchdog() {
+    return stall_threshold_ > 0 ? &watchdog_ : nullptr;
+  }
+
+  // the loop durations of all the IO services, the retired ones included,
+  // could be called from any thread
+  EventLoopStats loop_stats();
+
+  // add the loop durations published by an IO service
+  void AddLoopStats(const EventLoopStats& stats);
+
+  // when the scratch arenas of the IO services are reset, at the end of
+  // every loop iteration by default, set before StartServer
+  void set_scratch_reset_policy(ScratchResetPolicy policy) {
+    scratch_reset_policy_ = policy;
+  }
+
+  ScratchResetPolicy scratch_reset_policy() const {
+    return scratch_reset_policy_;
+  }
+
+  // sample the TCP_INFO of every session once per interval in
+  // microseconds, the sampling of a service is spread over the interval,
+  // 0 to disable, set before StartServer
+  void set_transport_sample_interval(int64_t interval) {
+    transport_sample_interval_ = interval;
+  }
+
+  int64_t transport_sample_interval() const {
+    return transport_sample_interval_;
+  }
+
+  // the count worst sessions of the order from the last sweep of every
+  // IO service, the worst first, could be called from any thread
+  void TopSessions(TransportOrder order, size_t count,
+    std::vector<TransportStats>* result);
+
+  // replace the stats published by the IO service with its last sweep,
+  // the stats are taken from the vector
+  void PublishTransportStats(TCPService* service,
+    std::vector<TransportStats>* stats);
 private:
-  // the simple load balancing
-  const std::shared_ptr<TCPService>& GetNextService();
+  // the interval in milliseconds of checking the rebalance
+  static const int kRebalanceCheckInterval = 1000;
+  // the min interval in microseconds between two rebalances, the busy time
+  // should be measured again after sessions moved
+  static const int64_t kRebalanceInterval = 3000000;
+
+  // the event count of the IO service
+  static const int kServiceEvents = 128;
+  // the loop waiting time in milliseconds of the IO service
+  static const int kServiceLoopWait = 3000;
+
+  // create and start an IO service
+  int CreateService(std::shared_ptr<TCPService>* service);
+
+  // the arena of a new IO service, the arena of a retired service is
+  // reused, nullptr for the heap
+  std::shared_ptr<MemoryArena> AcquireArena();
+
+  // forward the messages of the service, returns true when the service
+  // has retired
+  bool ForwardMessages(const std::shared_ptr<TCPService>& service);
+
+  // the service receiving connections, nullptr if it has been removed
+  TCPService* FindService(void* service);
+
+  // the load balancing by the routing key
+  const std::shared_ptr<TCPService>& GetNextService(uint64_t key);
+
+  // the service of a new connection of the class
+  TCPService* PlaceConnection(SessionPriority priority, uint64_t key);
 
   bool stopped_;
-  // the next service
-  int next_service_;
-  // the listen socket
+  // the placement policy
+  std::shared_ptr<PlacementPolicy> placement_policy_;
+  // the listen socket, -1 for a client
   int listen_socket_;
+  // whether the only IO service accepts the connections itself
+  bool inline_;
   // the epoll module count
   int epoll_module_count_;
-  // the service vector
+  // the memory of the IO services
+  MemoryArenaType arena_type_;
+  // the TCP_DEFER_ACCEPT timeout
+  int defer_accept_seconds_;
+  // the rebalance threshold
+  int64_t rebalance_threshold_;
+  // the options of the message parsers
+  MessageParserOptions message_parser_options_;
+  // the reset of the handler temporaries
+  ScratchResetPolicy scratch_reset_policy_;
+  // the listener of the IO services
+  ServiceListener* service_listener_;
+  // the priority classes
+  PriorityOptions priority_options_;
+  std::shared_ptr<SessionClassifier> session_classifier_;
+  // the services of the high priority connections, created on start
+  std::vector<std::shared_ptr<TCPService>> priority_services_;
+  size_t next_priority_service_;
+  // the admission of the accepted connections
+  AdmissionOptions admission_options_;
+  std::unique_ptr<AdmissionControl> admission_control_;
+  // the last time of rebalancing
+  int64_t last_rebalance_time_;
+  // the service vector, it is only changed on the listen thread
   std::vector<std::shared_ptr<TCPService>> services_;
+  // the services moving their sessions away
+  std::vector<std::shared_ptr<TCPService>> retiring_services_;
+  // the services changes requested by the other threads
+  std::mutex resize_mutex_;
+  std::vector<std::shared_ptr<TCPService>> adding_services_;
+  int retiring_count_;
+  // all the arenas, and those of the retired services
+  std::vector<std::shared_ptr<MemoryArena>> arenas_;
+  std::vector<std::shared_ptr<MemoryArena>> idle_arenas_;
+  // the service count after the requested changes
+  int service_count_;
   // the listen service
   std::shared_ptr<TCPService> listen_service_;
+  // the message mesh, it outlives the services
+  std::shared_ptr<MessageMesh> mesh_;
+  // the traffic capture, it outlives the services
+  TrafficCapture capture_;
+  // the stall threshold and the watchdog, it outlives the services
+  int64_t stall_threshold_;
+  StallWatchdog watchdog_;
+  // the loop durations published by the IO services
+  std::mutex loop_stats_mutex_;
+  EventLoopStats loop_stats_;
+  // the transport sampling, and the last sweep of every IO service
+  int64_t transport_sample_interval_;
+  std::mutex transport_mutex_;
+  std::map<TCPService*, std::vector<TransportStats>> transport_stats_;
   DISALLOW_CONSTRUCTORS(TCPServer);
 };
 
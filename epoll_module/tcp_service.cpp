@@ -1,11 +1,17 @@
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <string.h>
 #include <unistd.h>
-#include <iostream>
+#include <algorithm>
+#include <functional>
 
 #include <tcp_service.h>
 #include <tcp_session.h>
 #include <tcp_server.h>
 #include <common.h>
+#include <logging.h>
 #include <pipe.h>
+#include <tracing.h>
 
 // The listener for the pipe events on the TCPService for conn I/O
 class TCPServiceEventPipeListener : public PipeEventListener {
@@ -29,12 +35,78 @@ private:
   std::shared_ptr<TCPService> service_;
 };
 
+// The listener for the messages written by the service thread, they are
+// forwarded by the listen thread
+class TCPServiceForwardPipeListener : public PipeEventListener {
+public:
+  explicit TCPServiceForwardPipeListener(TCPServer* server)
+    : server_(server) {
+  }
+  virtual ~TCPServiceForwardPipeListener() {}
+
+private:
+  virtual void OnReadActivated(Pipe* /*pipe*/) {
+    server_->ListenActivate();
+  }
+
+  virtual void OnDestroy(Pipe* /*pipe*/) {
+    // delete this listener when the pipe was destroyed
+    delete this;
+  }
+  // the server outlives its services
+  TCPServer* server_;
+};
+
+// The listener for the messages drained from the mesh
+class TCPServiceMeshListener : public MeshMessageListener {
+public:
+  explicit TCPServiceMeshListener(TCPService* service)
+    : service_(service) {
+  }
+  virtual ~TCPServiceMeshListener() {}
+
+private:
+  virtual void OnMeshMessage(const MeshMsg& msg) {
+    service_->OnMeshMessage(msg);
+  }
+  TCPService* service_;
+};
+
+// The timer of the transport sampling
+class TCPServiceTransportTimer : public ServiceTimer {
+public:
+  TCPServiceTransportTimer() {}
+  virtual ~TCPServiceTransportTimer() {}
+
+private:
+  virtual int64_t OnTimer(TCPService* service, int64_t now) {
+    return service->SampleTransport(now);
+  }
+};
+
 
 TCPService::TCPService()
-  : stopped_(true)
+  : epoll_socket_(0)
   , loop_waite_second_(0)
-  , epoll_socket_(0) {
-  //nothing
+  , stopped_(true)
+  , rebalance_target_(nullptr)
+  , retire_pending_(false)
+  , busy_time_(0)
+  , load_window_start_(0)
+  , active_sessions_(0)
+  , pending_sessions_(0)
+  , recent_busy_time_(0)
+  , recent_busy_window_(0)
+  , transport_interval_(0)
+  , transport_cursor_(nullptr)
+  , watchdog_(nullptr)
+  , mesh_(nullptr)
+  , mesh_node_(-1)
+  , capture_(nullptr)
+  , capture_buffer_(nullptr) {
+  for (int i = 0; i < SESSION_PRIORITY_COUNT; ++i) {
+    read_budget_[i] = 0;
+  }
 }
 
 
@@ -45,15 +117,31 @@ int TCPService::Init(TCPServiceType service_type, int nevents,
   std::shared_ptr<TCPServer> server) {
   service_type_ = service_type;
   server_ = server;
+  capture_ = server->capture();
+  watchdog_ = server->stall_watchdog();
+  scratch_arena_.set_reset_policy(server->scratch_reset_policy());
+  if (service_type_ == TCP_SERVICE_TYPE_NORMAL &&
+    server->transport_sample_interval() > 0) {
+    transport_interval_ = server->transport_sample_interval();
+    transport_timer_.reset(new TCPServiceTransportTimer());
+  }
+  for (int i = SESSION_PRIORITY_NORMAL; i < SESSION_PRIORITY_COUNT; ++i) {
+    read_budget_[i] = server->priority_options().read_budget[i];
+  }
   nevents_ = nevents;
   std::shared_ptr<Pipe> pipes[2];
-  CHECK_RESULT(CreatePipePair(pipes, 0, true));
+  CHECK_RESULT(CreatePipePair(pipes, 0));
   event_pop_pipe_ = pipes[0];
   event_push_pipe_ = pipes[1];
   TCPServiceEventPipeListener* event_listener =
     new TCPServiceEventPipeListener(pipes[1], shared_from_this());
   event_pop_pipe_->set_listener(event_listener);
   event_pop_pipe_->CheckRead();
+  if (service_type_ == TCP_SERVICE_TYPE_NORMAL) {
+    event_push_pipe_->set_listener(
+      new TCPServiceForwardPipeListener(server.get()));
+    event_push_pipe_->CheckRead();
+  }
   event_list_.resize(nevents_);
 
   epoll_socket_ = epoll_create(nevents_);
@@ -87,6 +175,25 @@ int TCPService::Init(TCPServiceType service_type, int nevents,
     return EPOLL_FAIL;
   }
   CHECK_RESULT(event_writer_->Start());
+
+  if (service_type_ == TCP_SERVICE_TYPE_NORMAL) {
+    CHECK_RESULT(server->mesh()->Join(&mesh_node_));
+    mesh_ = server->mesh();
+    mesh_listener_.reset(new TCPServiceMeshListener(this));
+    // the wakeup socket is owned by the mesh, keep a duplicate
+    int mesh_socket = dup(mesh_->wakeup_socket(mesh_node_));
+    if (mesh_socket < 0) {
+      return EPOLL_FAIL;
+    }
+    event = EPOLLET | EPOLLIN;
+    mesh_reader_.reset(new TCPSession(mesh_socket,
+      TCP_SESSION_TYPE_MESH, event));
+    if (!EventManipulate(mesh_socket, EPOLL_CTL_ADD,
+      event, mesh_reader_.get())) {
+      return EPOLL_FAIL;
+    }
+    CHECK_RESULT(mesh_reader_->Start());
+  }
   return 0;
 }
 
@@ -105,14 +212,24 @@ void TCPService::Stop() {
   event_push_pipe_->Terminate();
   // stop thread
   thread_->join();
+  if (nullptr != capture_buffer_) {
+    capture_->Close(capture_buffer_);
+    capture_buffer_ = nullptr;
+  }
 
-  PipeMsg msg = nullptr;
+  PipeMsg msg;
   // waiting pop pipe thread exit
   while (true) {
     int rst = event_push_pipe_->Read(-1, &msg);
     if (rst == EPOLL_EOF) {
       break;
     }
+    // the session could not reach its target any more
+    if (rst == 0 && msg.type == PIPE_MSG_MIGRATE) {
+      TCPSession* migrant = reinterpret_cast<TCPSession*>(msg.data);
+      migrant->Stop();
+      delete migrant;
+    }
   }
   if (epoll_socket_) {
     close(epoll_socket_);
@@ -124,35 +241,89 @@ void TCPService::Stop() {
   event_writer_.reset();
   event_reader_->Stop();
   event_reader_.reset();
+  if (mesh_reader_) {
+    mesh_reader_->Stop();
+    mesh_reader_.reset();
+  }
   event_list_.clear();
   thread_.reset();
   server_.reset();
   std::set<TCPSession*>::iterator it;
   for (it = sessions_.begin(); it != sessions_.end(); ++it) {
     (*it)->Stop();
-    delete (*it);
+    ReleaseSession(*it);
   }
   sessions_.clear();
+  flush_sessions_.clear();
+  rehome_sessions_.clear();
+  rebalance_target_ = nullptr;
+  retire_pending_ = false;
+  for (int i = 0; i < SESSION_PRIORITY_COUNT; ++i) {
+    ready_sessions_[i].clear();
+  }
+  timers_.clear();
+  if (nullptr != mesh_) {
+    mesh_->Leave(mesh_node_);
+    mesh_ = nullptr;
+    mesh_node_ = -1;
+  }
   stopped_ = true;
 }
 
 int TCPService::OnStartSession(TCPSession* session) {
+  // the sockets were created nonblocking by the server, a migrated
+  // session has been started by its former service
   int event = session->event();
-  if (MakeSocketNonBlocking(session->socket()) != 0 ||
-    !EventManipulate(session->socket(), EPOLL_CTL_ADD, event, session) ||
-    session->Start() != 0) {
+  bool starting = session->stopped();
+  if (!EventManipulate(session->socket(), EPOLL_CTL_ADD, event, session) ||
+    (starting && session->Start() != 0)) {
     return EPOLL_FAIL;
   }
+  if (starting && session->session_type() == TCP_SESSION_TYPE_NORMAL) {
+    session->message_parser()->set_options(
+      &server_->message_parser_options());
+    if (capturing()) {
+      Capture(CAPTURE_RECORD_OPEN, session->session_id(),
+        session->last_actived_time(), &session->address(),
+        sizeof(sockaddr_in));
+    }
+  }
+  session->set_service(this);
   sessions_.insert(session);
+  active_sessions_.store(static_cast<int>(sessions_.size()),
+    std::memory_order_relaxed);
   return 0;
 }
 
 int TCPService::OnStopSession(TCPSession* session) {
+  if (session->flush_pending()) {
+    std::vector<TCPSession*>::iterator it = std::find(
+      flush_sessions_.begin(), flush_sessions_.end(), session);
+    if (it != flush_sessions_.end()) {
+      flush_sessions_.erase(it);
+    }
+    session->set_flush_pending(false);
+  }
+  if (0 != session->ready_events()) {
+    CancelReady(session);
+  }
+  if (session->rehome_pending()) {
+    CancelRehome(session);
+  }
+  if (session->session_type() == TCP_SESSION_TYPE_NORMAL) {
+    if (!session->outbound()) {
+      ReleaseAdmission(session->address(), session->admission_tracked());
+    }
+    if (capturing()) {
+      Capture(CAPTURE_RECORD_CLOSE, session->session_id(),
+        GetCurrentMicroseconds(), nullptr, 0);
+    }
+  }
   session->Stop();
   sessions_.erase(session);
-  if (event_pop_pipe_->Recycle(session) != 0) {
-    delete session;
-  }
+  active_sessions_.store(static_cast<int>(sessions_.size()),
+    std::memory_order_relaxed);
+  ReleaseSession(session);
   return 0;
 }
 
@@ -170,37 +341,586 @@ bool TCPService::EventManipulate(int sockfd, int cmd,
 void TCPService::DoCheckAlive() {
   std::set<TCPSession*>::iterator it;
   int64_t current_time = GetCurrentMicroseconds();
-  for (it = sessions_.begin(); it != sessions_.end(); ++it) {
-    if ((current_time - (*it)->last_actived_time()) > 15000000) {
-      OnStopSession(*it);
+  for (it = sessions_.begin(); it != sessions_.end();) {
+    // the session would be erased and destroyed when stopping
+    TCPSession* session = *it++;
+    // the listen session of an inline server is never idle
+    if (session->session_type() == TCP_SESSION_TYPE_NORMAL &&
+      (current_time - session->last_actived_time()) > 15000000) {
+      OnStopSession(session);
     }
   }
 }
 
 void TCPService::EventActivate() {
+  // it may be called from any thread, write the socket directly and
+  // ignore EAGAIN as the reader would be activated by the pending data
   uint8_t falg = 0;
-  event_writer_->Send(&falg, 1);
+  ssize_t rst = write(event_writer_->socket(), &falg, 1);
+  (void)rst;
 }
 
-bool TCPService::ConsumeRecycleQueue(PipeMsg* res_msg) {
-  return event_push_pipe_->ConsumeRecycleQueue(res_msg);
+int TCPService::PushSessions(TCPSession* session) {
+  PipeMsg msg;
+  msg.type = PIPE_MSG_SESSION;
+  msg.socket = session->socket();
+  msg.data = session;
+  msg.target = nullptr;
+  msg.time = 0;
+  msg.priority = 0;
+  msg.tracked = false;
+  return event_push_pipe_->Write(msg, false);
 }
 
-int TCPService::PushSessions(TCPSession* session) {
-  return event_push_pipe_->Write(session, false);
+int TCPService::PushSocket(int socket, const sockaddr_in& address,
+  SessionPriority priority, bool tracked) {
+  PipeMsg msg;
+  msg.type = PIPE_MSG_SOCKET;
+  msg.socket = socket;
+  msg.address = address;
+  msg.data = nullptr;
+  msg.target = nullptr;
+  msg.time = Tracer::enabled() && Tracer::Sample() ?
+    GetCurrentMicroseconds() : 0;
+  msg.priority = priority;
+  msg.tracked = tracked;
+  CHECK_RESULT(event_push_pipe_->Post(msg));
+  pending_sessions_.fetch_add(1, std::memory_order_relaxed);
+  return 0;
+}
+
+int TCPService::FlushSockets() {
+  return event_push_pipe_->Flush();
+}
+
+TCPSession* TCPService::StartSocket(int socket, const sockaddr_in& address,
+  SessionPriority priority, bool tracked) {
+  TCPSession* session = AllocSession(socket, address);
+  if (nullptr == session) {
+    close(socket);
+    ReleaseAdmission(address, tracked);
+    return nullptr;
+  }
+  session->set_priority(priority);
+  session->set_admission_tracked(tracked);
+  if (OnStartSession(session) != 0) {
+    OnStopSession(session);
+    return nullptr;
+  }
+  return session;
+}
+
+int TCPService::PushMessage(const PipeMsg& msg) {
+  return event_push_pipe_->Write(msg, false);
+}
+
+int TCPService::PopMessage(PipeMsg* msg) {
+  return event_push_pipe_->Read(0, msg);
+}
+
+int TCPService::RequestRebalance(TCPService* target) {
+  PipeMsg msg;
+  msg.type = PIPE_MSG_REBALANCE;
+  msg.socket = -1;
+  msg.data = nullptr;
+  msg.target = target;
+  msg.time = 0;
+  msg.priority = 0;
+  msg.tracked = false;
+  return PushMessage(msg);
+}
+
+int TCPService::RequestRetire() {
+  PipeMsg msg;
+  msg.type = PIPE_MSG_RETIRE;
+  msg.socket = -1;
+  msg.data = nullptr;
+  msg.target = nullptr;
+  msg.time = 0;
+  msg.priority = 0;
+  msg.tracked = false;
+  return PushMessage(msg);
+}
+
+int TCPService::MigrateSession(TCPSession* session, TCPService* target) {
+  if (target == this || session->session_type() != TCP_SESSION_TYPE_NORMAL) {
+    return EPOLL_INVALID;
+  }
+  // the listen thread of an inline server never forwards the migrant
+  if (server_->is_inline()) {
+    return EPOLL_INVALID;
+  }
+  // write out the corked data, the blocked data moves with the buffers
+  if (session->flush_pending()) {
+    flush_sessions_.erase(std::find(flush_sessions_.begin(),
+      flush_sessions_.end(), session));
+    session->set_flush_pending(false);
+  }
+  // the readiness is checked again by the target
+  if (0 != session->ready_events()) {
+    CancelReady(session);
+  }
+  if (session->rehome_pending()) {
+    CancelRehome(session);
+  }
+  if (session->DoSend() == EPOLL_FAIL) {
+    OnStopSession(session);
+    return EPOLL_FAIL;
+  }
+  // the readiness would be checked again when the target adds the
+  // socket, the pending bytes stay in the socket meanwhile
+  if (!EventManipulate(session->socket(), EPOLL_CTL_DEL, 0, session)) {
+    OnStopSession(session);
+    return EPOLL_FAIL;
+  }
+  TCPSession* migrant = new TCPSession(-1, TCP_SESSION_TYPE_NORMAL, 0);
+  migrant->TransferFrom(session);
+  sessions_.erase(session);
+  active_sessions_.store(static_cast<int>(sessions_.size()),
+    std::memory_order_relaxed);
+  ReleaseSession(session);
+
+  PipeMsg msg;
+  msg.type = PIPE_MSG_MIGRATE;
+  msg.socket = migrant->socket();
+  msg.address = migrant->address();
+  msg.data = migrant;
+  msg.target = target;
+  msg.time = Tracer::enabled() && Tracer::Sample() ?
+    GetCurrentMicroseconds() : 0;
+  msg.priority = 0;
+  msg.tracked = false;
+  if (event_pop_pipe_->Write(msg, false) != 0) {
+    migrant->Stop();
+    delete migrant;
+    return EPOLL_FAIL;
+  }
+  return 0;
+}
+
+int TCPService::RehomeSession(TCPSession* session, uint64_t key) {
+  if (session->session_type() != TCP_SESSION_TYPE_NORMAL) {
+    return EPOLL_INVALID;
+  }
+  // the session stays on the service dedicated to its priority class
+  if (server_->IsPriorityService(this)) {
+    return EPOLL_INVALID;
+  }
+  // the other policies would place the session by its load only
+  const std::shared_ptr<PlacementPolicy>& policy = server_->placement_policy();
+  if (!policy->HasAffinity()) {
+    return EPOLL_INVALID;
+  }
+  session->set_affinity_key(key);
+  // the session lives on the service of its key already
+  if (policy->ServiceOfKey(key) == this) {
+    if (session->rehome_pending()) {
+      CancelRehome(session);
+    }
+    return 0;
+  }
+  // the handler of the session may be running, it could not move now
+  if (!session->rehome_pending() && server_->service_count() > 1) {
+    session->set_rehome_pending(true);
+    rehome_sessions_.push_back(session);
+  }
+  return 0;
+}
+
+void TCPService::DoRehome() {
+  std::vector<TCPSession*> sessions;
+  sessions.swap(rehome_sessions_);
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    sessions[i]->set_rehome_pending(false);
+    // a failed session has been stopped
+    MigrateSession(sessions[i], nullptr);
+  }
+}
+
+void TCPService::CancelRehome(TCPSession* session) {
+  rehome_sessions_.erase(std::find(rehome_sessions_.begin(),
+    rehome_sessions_.end(), session));
+  session->set_rehome_pending(false);
+}
+
+void TCPService::PendingFlush(TCPSession* session) {
+  flush_sessions_.push_back(session);
+}
+
+int TCPService::ModifySession(TCPSession* session) {
+  if (!EventManipulate(session->socket(), EPOLL_CTL_MOD,
+    session->event(), session)) {
+    return EPOLL_FAIL;
+  }
+  return 0;
+}
+
+int TCPService::Connect(const sockaddr_in& address, TCPSession** session) {
+  int socket = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+    IPPROTO_TCP);
+  if (socket < 0) {
+    return EPOLL_FAIL;
+  }
+  // the requests are written as soon as they are queued
+  int flag = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  if (connect(socket, reinterpret_cast<const sockaddr*>(&address),
+    sizeof(address)) != 0 && errno != EINPROGRESS) {
+    close(socket);
+    return EPOLL_FAIL;
+  }
+  TCPSession* outbound = AllocSession(socket, address);
+  if (nullptr == outbound) {
+    close(socket);
+    return EPOLL_NOMEM;
+  }
+  outbound->set_outbound(true);
+  if (OnStartSession(outbound) != 0) {
+    OnStopSession(outbound);
+    return EPOLL_FAIL;
+  }
+  *session = outbound;
+  return 0;
+}
+
+void TCPService::ScheduleTimer(ServiceTimer* timer, int64_t due_time) {
+  CancelTimer(timer);
+  timers_.push_back(std::make_pair(due_time, timer));
+  std::push_heap(timers_.begin(), timers_.end(),
+    std::greater<std::pair<int64_t, ServiceTimer*>>());
+}
+
+void TCPService::CancelTimer(ServiceTimer* timer) {
+  for (size_t i = 0; i < timers_.size(); ++i) {
+    if (timers_[i].second == timer) {
+      timers_.erase(timers_.begin() + i);
+      std::make_heap(timers_.begin(), timers_.end(),
+        std::greater<std::pair<int64_t, ServiceTimer*>>());
+      return;
+    }
+  }
+}
+
+int TCPService::NextTimeout(int64_t now) const {
+  // the sessions deferred by the read budgets are dispatched at once
+  if (HasReady()) {
+    return 0;
+  }
+  if (timers_.empty()) {
+    return loop_waite_second_;
+  }
+  // floor the wait, the last millisecond is polled so that the timers
+  // are not late by the granularity of epoll_wait
+  int64_t wait = (timers_.front().first - now) / 1000;
+  if (wait < 0) {
+    wait = 0;
+  }
+  if (loop_waite_second_ != -1 && wait > loop_waite_second_) {
+    return loop_waite_second_;
+  }
+  return static_cast<int>(wait);
+}
+
+void TCPService::RunTimers(int64_t now) {
+  while (!timers_.empty() && timers_.front().first <= now) {
+    ServiceTimer* timer = timers_.front().second;
+    std::pop_heap(timers_.begin(), timers_.end(),
+      std::greater<std::pair<int64_t, ServiceTimer*>>());
+    timers_.pop_back();
+    int64_t due_time = timer->OnTimer(this, now);
+    if (due_time > 0) {
+      ScheduleTimer(timer, due_time);
+    }
+  }
 }
 
+void TCPService::FlushSessions() {
+  // one write per dirty session, the EPOLLOUT interest would be armed
+  // by the session only when the socket blocked
+  for (size_t i = 0; i < flush_sessions_.size(); ++i) {
+    TCPSession* session = flush_sessions_[i];
+    session->set_flush_pending(false);
+    if (session->DoSend() == EPOLL_FAIL) {
+      OnStopSession(session);
+    }
+  }
+  flush_sessions_.clear();
+}
+
+TCPSession* TCPService::AllocSession(int socket,
+  const sockaddr_in& address) {
+  // EPOLLOUT would be armed by the session only while output blocked
+  int event = EPOLLET | EPOLLIN | EPOLLRDHUP;
+  TCPSession* session = session_pool_.Construct(socket,
+    TCP_SESSION_TYPE_NORMAL, event);
+  if (nullptr == session) {
+    return nullptr;
+  }
+  session->set_address(address);
+  return session;
+}
+
+void TCPService::ReleaseAdmission(const sockaddr_in& address,
+  bool tracked) {
+  AdmissionControl* admission =
+    server_ ? server_->admission_control() : nullptr;
+  if (nullptr != admission) {
+    admission->Release(address, tracked);
+  }
+}
+
+void TCPService::ReleaseSession(TCPSession* session) {
+  // only the normal sessions come from the pool, the listen session
+  // was created by the server
+  if (session->session_type() == TCP_SESSION_TYPE_NORMAL) {
+    session_pool_.Destroy(session);
+  } else {
+    delete session;
+  }
+}
+
+
+int64_t TCPService::recent_busy_time() const {
+  // an idle service may sleep in epoll_wait without publishing
+  int64_t window = recent_busy_window_.load(std::memory_order_relaxed);
+  if (GetCurrentMicroseconds() - window > 2 * kLoadWindow) {
+    return 0;
+  }
+  return recent_busy_time_.load(std::memory_order_relaxed);
+}
+
+void TCPService::UpdateLoad(int64_t iteration_start,
+  int64_t iteration_end) {
+  busy_time_ += iteration_end - iteration_start;
+  if (iteration_end - load_window_start_ < kLoadWindow) {
+    return;
+  }
+  recent_busy_time_.store(busy_time_, std::memory_order_relaxed);
+  recent_busy_window_.store(iteration_end, std::memory_order_relaxed);
+  busy_time_ = 0;
+  load_window_start_ = iteration_end;
+  PublishLoopStats();
+}
+
+void EventLoopStats::Merge(const EventLoopStats& other) {
+  wait.Merge(other.wait);
+  dispatch.Merge(other.dispatch);
+  timers.Merge(other.timers);
+  check_alive.Merge(other.check_alive);
+  iteration.Merge(other.iteration);
+}
+
+void EventLoopStats::Reset() {
+  wait.Reset();
+  dispatch.Reset();
+  timers.Reset();
+  check_alive.Reset();
+  iteration.Reset();
+}
+
+EventLoopStats TCPService::loop_stats() {
+  std::lock_guard<std::mutex> lock(loop_stats_mutex_);
+  return loop_stats_;
+}
+
+int64_t TCPService::SampleTransport(int64_t now) {
+  std::set<TCPSession*>::iterator it =
+    sessions_.upper_bound(transport_cursor_);
+  for (int sampled = 0; sampled < kTransportBatch && it != sessions_.end();
+    ++it) {
+    TCPSession* session = *it;
+    transport_cursor_ = session;
+    if (session->session_type() != TCP_SESSION_TYPE_NORMAL ||
+      session->SampleTransport(now) != 0) {
+      continue;
+    }
+    transport_sweep_.push_back(session->transport_stats());
+    ++sampled;
+  }
+  if (it == sessions_.end()) {
+    server_->PublishTransportStats(this, &transport_sweep_);
+    transport_sweep_.clear();
+    transport_cursor_ = nullptr;
+  }
+  // spread the batches of a sweep over the interval
+  int64_t batches = static_cast<int64_t>(sessions_.size()) /
+    kTransportBatch + 1;
+  int64_t tick = transport_interval_ / batches;
+  if (tick < kMinTransportTick) {
+    tick = kMinTransportTick;
+  }
+  return now + tick;
+}
+
+void TCPService::PublishLoopStats() {
+  {
+    std::lock_guard<std::mutex> lock(loop_stats_mutex_);
+    loop_stats_.Merge(window_loop_stats_);
+  }
+  if (service_type_ == TCP_SERVICE_TYPE_NORMAL) {
+    server_->AddLoopStats(window_loop_stats_);
+  }
+  window_loop_stats_.Reset();
+}
+
+void TCPService::DoRebalance(TCPService* target) {
+  // measure the traffic of the sessions since the last rebalance
+  std::vector<std::pair<uint64_t, TCPSession*>> heats;
+  heats.reserve(sessions_.size());
+  uint64_t total = 0;
+  std::set<TCPSession*>::iterator it;
+  for (it = sessions_.begin(); it != sessions_.end(); ++it) {
+    TCPSession* session = *it;
+    if (session->session_type() != TCP_SESSION_TYPE_NORMAL) {
+      continue;
+    }
+    uint64_t heat = session->received_bytes() - session->rebalance_mark();
+    session->set_rebalance_mark(session->received_bytes());
+    heats.push_back(std::make_pair(heat, session));
+    total += heat;
+  }
+  int64_t busy = recent_busy_time();
+  int64_t target_busy = target->recent_busy_time();
+  if (total == 0 || busy <= target_busy) {
+    return;
+  }
+  // move half of the skew, a session hotter than that would only move
+  // the hot spot to the target so it is kept
+  uint64_t budget = static_cast<uint64_t>(
+    static_cast<double>(total) * (busy - target_busy) / (2 * busy));
+  std::sort(heats.begin(), heats.end(),
+    std::greater<std::pair<uint64_t, TCPSession*>>());
+  size_t moved = 0;
+  for (size_t i = 0; i < heats.size() && moved < kMaxRebalanceSessions; ++i) {
+    if (heats[i].first == 0 || budget == 0) {
+      break;
+    }
+    if (heats[i].first > budget) {
+      continue;
+    }
+    if (MigrateSession(heats[i].second, target) == 0) {
+      budget -= heats[i].first;
+      ++moved;
+    }
+  }
+}
+
+void TCPService::DoRetire() {
+  // the sessions are erased while migrating, a session failed to migrate
+  // has been stopped
+  std::vector<TCPSession*> sessions(sessions_.begin(), sessions_.end());
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    MigrateSession(sessions[i], nullptr);
+  }
+  PipeMsg msg;
+  msg.type = PIPE_MSG_RETIRED;
+  msg.socket = -1;
+  msg.data = nullptr;
+  msg.target = nullptr;
+  msg.time = 0;
+  msg.priority = 0;
+  msg.tracked = false;
+  event_pop_pipe_->Write(msg, false);
+}
+
+int TCPService::AdoptSession(TCPSession* migrant) {
+  TCPSession* session = session_pool_.Construct(-1,
+    TCP_SESSION_TYPE_NORMAL, 0);
+  if (nullptr == session) {
+    if (!migrant->outbound()) {
+      ReleaseAdmission(migrant->address(), migrant->admission_tracked());
+    }
+    migrant->Stop();
+    delete migrant;
+    return EPOLL_NOMEM;
+  }
+  session->TransferFrom(migrant);
+  delete migrant;
+  if (OnStartSession(session) != 0) {
+    OnStopSession(session);
+    return EPOLL_FAIL;
+  }
+  // the data queued before moving may wait for flushing
+  if (session->DoSend() == EPOLL_FAIL) {
+    OnStopSession(session);
+    return EPOLL_FAIL;
+  }
+  return 0;
+}
+
+int TCPService::SendTo(const SessionHandle& handle,
+  const uint8_t* buffer, int size) {
+  if (nullptr == mesh_ || handle.node < 0) {
+    return EPOLL_INVALID;
+  }
+  if (handle.node == mesh_node_) {
+    if (sessions_.find(handle.session) == sessions_.end() ||
+      handle.session->session_id() != handle.session_id) {
+      return EPOLL_NO_EXISTS;
+    }
+    return handle.session->Send(buffer, size);
+  }
+  MeshMsg msg;
+  msg.session = handle.session;
+  msg.session_id = handle.session_id;
+  msg.size = size;
+  msg.data = reinterpret_cast<uint8_t*>(malloc(size));
+  if (nullptr == msg.data) {
+    return EPOLL_NOMEM;
+  }
+  memcpy(msg.data, buffer, size);
+  if (mesh_->Post(mesh_node_, handle.node, msg) != 0) {
+    free(msg.data);
+    return EPOLL_NOMEM;
+  }
+  return 0;
+}
+
+void TCPService::OnMeshMessage(const MeshMsg& msg) {
+  // the session may have stopped or migrated since the handle was taken
+  if (sessions_.find(msg.session) != sessions_.end() &&
+    msg.session->session_id() == msg.session_id) {
+    msg.session->Send(msg.data, msg.size);
+  }
+  free(msg.data);
+}
 
 void TCPService::DoStop() {
   event_pop_pipe_->Terminate();
 }
 
 int TCPService::HandleEvent() {
-  PipeMsg msg = nullptr;
+  PipeMsg msg;
+  TCPSession* session = nullptr;
   while (true) {
     int rst = event_pop_pipe_->Read(0, &msg);
     if (0 == rst) {
-      TCPSession* session = reinterpret_cast<TCPSession*>(msg);
+      if (msg.type == PIPE_MSG_REBALANCE) {
+        // the sessions moved may have events left in this iteration
+        rebalance_target_ = reinterpret_cast<TCPService*>(msg.target);
+        continue;
+      } else if (msg.type == PIPE_MSG_MIGRATE) {
+        TCPSession* migrant = reinterpret_cast<TCPSession*>(msg.data);
+        uint64_t session_id = migrant->session_id();
+        if (AdoptSession(migrant) == 0 && 0 != msg.time) {
+          Tracer::Record("migrate", session_id, msg.time,
+            GetCurrentMicroseconds());
+        }
+        continue;
+      } else if (msg.type == PIPE_MSG_RETIRE) {
+        retire_pending_ = true;
+        continue;
+      } else if (msg.type == PIPE_MSG_SOCKET) {
+        pending_sessions_.fetch_sub(1, std::memory_order_relaxed);
+        session = StartSocket(msg.socket, msg.address,
+          static_cast<SessionPriority>(msg.priority), msg.tracked);
+        if (nullptr != session && 0 != msg.time) {
+          Tracer::Record("pipe", session->session_id(), msg.time,
+            GetCurrentMicroseconds());
+        }
+        continue;
+      }
+      session = reinterpret_cast<TCPSession*>(msg.data);
       if (OnStartSession(session) != 0) {
         OnStopSession(session);
       }
@@ -214,49 +934,217 @@ int TCPService::HandleEvent() {
       break;
     }
   }
+  if (service_type_ == TCP_SERVICE_TYPE_LISTEN) {
+    server_->ForwardMessages();
+    server_->DoResize();
+  }
   return 0;
 }
 
+int TCPService::DispatchSession(TCPSession* session, int events,
+  int max_bytes, int64_t* received_bytes) {
+  TCPSessionType type = session->session_type();
+  loop_watch_.set_session(session);
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_WARN, 100,
+      "epoll_wait() error on fd: {}", session->socket());
+  }
+  int result = 0;
+  if ((events & EPOLLIN) == EPOLLIN) {
+    if ((events & EPOLLRDHUP) == EPOLLRDHUP) {
+      // the session was destroyed, skip the rest of its events
+      OnStopSession(session);
+      return 0;
+    }
+    if (type == TCP_SESSION_TYPE_LISTEN) {
+      server_->HandleAccpet();
+    } else {
+      uint64_t received = session->received_bytes();
+      int rst = session->DoReceive(max_bytes);
+      *received_bytes = session->received_bytes() - received;
+      if (EPOLL_FAIL == rst && type == TCP_SESSION_TYPE_NORMAL) {
+        // the peer closed, the read failed or the parser asked to stop
+        OnStopSession(session);
+        return 0;
+      }
+      if (EPOLL_BUSY == rst) {
+        result = EPOLL_BUSY;
+      }
+      if (type == TCP_SESSION_TYPE_EVENT && EPOLL_EOF == HandleEvent()) {
+        return EPOLL_EOF;
+      }
+    }
+  }
+  if ((events & EPOLLOUT) == EPOLLOUT) {
+    session->DoSend();
+  }
+  return result;
+}
+
+void TCPService::DispatchReady() {
+  for (int priority = SESSION_PRIORITY_NORMAL;
+    priority < SESSION_PRIORITY_COUNT; ++priority) {
+    std::deque<TCPSession*>& ready = ready_sessions_[priority];
+    int budget = read_budget_[priority];
+    int64_t left = budget;
+    // a session left with data is queued again behind the others of its
+    // class, it is dispatched in the next iteration
+    size_t count = ready.size();
+    while (count-- > 0 && !ready.empty() && (0 == budget || left > 0)) {
+      TCPSession* session = ready.front();
+      ready.pop_front();
+      int events = session->ready_events();
+      session->set_ready_events(0);
+      int64_t received_bytes = 0;
+      if (DispatchSession(session, events, static_cast<int>(
+        0 == budget ? 0 : left), &received_bytes) == EPOLL_BUSY) {
+        session->set_ready_events(EPOLLIN);
+        ready.push_back(session);
+      }
+      left -= received_bytes;
+    }
+  }
+}
+
+bool TCPService::HasReady() const {
+  for (int i = SESSION_PRIORITY_NORMAL; i < SESSION_PRIORITY_COUNT; ++i) {
+    if (!ready_sessions_[i].empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TCPService::CancelReady(TCPSession* session) {
+  // the class may have changed since the session was queued
+  for (int i = SESSION_PRIORITY_NORMAL; i < SESSION_PRIORITY_COUNT; ++i) {
+    std::deque<TCPSession*>::iterator it = std::find(
+      ready_sessions_[i].begin(), ready_sessions_[i].end(), session);
+    if (it != ready_sessions_[i].end()) {
+      ready_sessions_[i].erase(it);
+      break;
+    }
+  }
+  session->set_ready_events(0);
+}
+
 void TCPService::EventLoop() {
-  while (!stopped_) {
-    int events = epoll_wait(epoll_socket_, &event_list_[0], nevents_, loop_waite_second_);
-    if (events == 0) {
-      if (loop_waite_second_ != -1) {
+  MemoryArena::set_current(arena_.get());
+  ScratchArena::set_current(&scratch_arena_);
+  ServiceListener* listener = service_type_ == TCP_SERVICE_TYPE_NORMAL ?
+    server_->service_listener() : nullptr;
+  if (nullptr != watchdog_) {
+    watchdog_->Register(&loop_watch_);
+  }
+  if (nullptr != listener) {
+    listener->OnServiceStart(this);
+  }
+  if (transport_timer_) {
+    ScheduleTimer(transport_timer_.get(),
+      GetCurrentMicroseconds() + transport_interval_);
+  }
+  bool terminated = false;
+  while (!stopped_ && !terminated) {
+    int64_t wait_start = GetCurrentMicroseconds();
+    int timeout = NextTimeout(wait_start);
+    int events = epoll_wait(epoll_socket_, &event_list_[0], nevents_, timeout);
+    int64_t iteration_start = GetCurrentMicroseconds();
+    window_loop_stats_.wait.Record(iteration_start - wait_start);
+    if (Tracer::enabled() && events > 0 && Tracer::Sample()) {
+      Tracer::Record("epoll_wait", 0, wait_start, iteration_start);
+    }
+    if (service_type_ == TCP_SERVICE_TYPE_LISTEN) {
+      server_->DoRebalance();
+    }
+    bool timer_due = !timers_.empty() &&
+      timers_.front().first <= iteration_start;
+    if (events == 0 && !timer_due && !HasReady()) {
+      UpdateLoad(iteration_start, iteration_start);
+      if (timeout != -1) {
         continue;
       }
-      std::cout << "epoll_wait() returned no events without timeout." << std::endl;
+      LOG_WARN("epoll_wait() returned no events without timeout.");
     }
+    loop_watch_.Begin(iteration_start);
+    // the internal and the high priority sessions are dispatched in the
+    // kernel order, the others are queued by their class
     for (int i = 0; i < events; i++) {
       TCPSession* session = reinterpret_cast<TCPSession*>(event_list_[i].data.ptr);
-      TCPSessionType type = session->session_type();
       int events = event_list_[i].events;
-
-      if (events & (EPOLLERR | EPOLLHUP)) {
-        std::cout << "epoll_wait() error on fd: " << session->socket() << std::endl;
-      }
-      if ((events & EPOLLIN) == EPOLLIN) {
-        if ((events & EPOLLRDHUP) == EPOLLRDHUP) {
-          OnStopSession(session);
-        } else {
-          if (type == TCP_SESSION_TYPE_LISTEN) {
-            server_->HandleAccpet();
-          } else {
-            session->DoReceive();
-            if (type == TCP_SESSION_TYPE_EVENT) {
-              if (EPOLL_EOF == HandleEvent()) {
-                return;
-              }
-            }
-          }
+      if (session->session_type() == TCP_SESSION_TYPE_NORMAL &&
+        session->priority() != SESSION_PRIORITY_HIGH) {
+        if (0 == session->ready_events()) {
+          ready_sessions_[session->priority()].push_back(session);
         }
+        session->set_ready_events(session->ready_events() | events);
+        continue;
       }
-      if ((events & EPOLLOUT) == EPOLLOUT) {
-        session->DoSend();
+      int64_t received_bytes = 0;
+      if (EPOLL_EOF == DispatchSession(session, events, 0, &received_bytes)) {
+        terminated = true;
+        break;
       }
     }
+    if (terminated) {
+      break;
+    }
+    DispatchReady();
+    int64_t dispatch_end = GetCurrentMicroseconds();
+    window_loop_stats_.dispatch.Record(dispatch_end - iteration_start);
+    if (timer_due) {
+      loop_watch_.set_stage("timers");
+      RunTimers(iteration_start);
+      window_loop_stats_.timers.Record(
+        GetCurrentMicroseconds() - dispatch_end);
+    }
+    if (nullptr != rebalance_target_) {
+      DoRebalance(rebalance_target_);
+      rebalance_target_ = nullptr;
+    }
+    if (retire_pending_) {
+      DoRetire();
+      retire_pending_ = false;
+    }
+    if (!rehome_sessions_.empty()) {
+      DoRehome();
+    }
+    loop_watch_.set_stage("flush");
+    if (nullptr != mesh_) {
+      mesh_->Drain(mesh_node_, mesh_listener_.get());
+    }
+    FlushSessions();
+    if (nullptr != mesh_) {
+      mesh_->Flush(mesh_node_);
+    }
+    if (nullptr != capture_buffer_) {
+      capture_buffer_->Flush();
+    }
     if (service_type_ == TCP_SERVICE_TYPE_NORMAL) {
+      loop_watch_.set_stage("check_alive");
+      int64_t check_start = GetCurrentMicroseconds();
       DoCheckAlive();
+      window_loop_stats_.check_alive.Record(
+        GetCurrentMicroseconds() - check_start);
     }
+    scratch_arena_.Reset();
+    loop_watch_.End();
+    int64_t iteration_end = GetCurrentMicroseconds();
+    window_loop_stats_.iteration.Record(iteration_end - iteration_start);
+    UpdateLoad(iteration_start, iteration_end);
   }
+  loop_watch_.End();
+  if (nullptr != listener) {
+    listener->OnServiceStop(this);
+  }
+  if (nullptr != watchdog_) {
+    watchdog_->Unregister(&loop_watch_);
+  }
+  PublishLoopStats();
+  if (transport_timer_) {
+    // the sessions are gone with the service
+    transport_sweep_.clear();
+    server_->PublishTransportStats(this, &transport_sweep_);
+  }
+  ScratchArena::set_current(nullptr);
+  scratch_arena_.Release();
 }
-
@@ -11,21 +11,70 @@
 #define TCP_SERVICE_H__
 
 #include <sys/epoll.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 #include <set>
 
 #include <common.h>
+#include <histogram.h>
+#include <memory_arena.h>
+#include <message_mesh.h>
+#include <object_pool.h>
 #include <pipe.h>
+#include <scratch_arena.h>
+#include <stall_watchdog.h>
+#include <tcp_session.h>
+#include <traffic_capture.h>
 
 class TCPServer;
-class TCPSession;
 
 enum TCPServiceType {
   TCP_SERVICE_TYPE_LISTEN,
   TCP_SERVICE_TYPE_NORMAL
 };
 
+/// The timer of a service, it runs on the service thread
+class ServiceTimer {
+ public:
+  // Default empty virtual destructor
+  virtual ~ServiceTimer() {}
+  // Get called once the due time passed, returns the next due time in
+  // microseconds, or 0 to cancel the timer
+  virtual int64_t OnTimer(TCPService* service, int64_t now) = 0;
+};
+
+/// The listener of the IO services of a server, it is called on the
+/// service thread
+class ServiceListener {
+ public:
+  // Default empty virtual destructor
+  virtual ~ServiceListener() {}
+  // Get called before the service handles any event
+  virtual void OnServiceStart(TCPService* service) = 0;
+  // Get called before the service thread exits, the sessions are still
+  // started
+  virtual void OnServiceStop(TCPService* service) = 0;
+};
+
+/// The durations of the parts of the loop iterations, in microseconds.
+/// The wait is counted for every epoll_wait, the others only for the
+/// iterations which had events or timers to handle.
+struct EventLoopStats {
+  Histogram wait;
+  Histogram dispatch;
+  Histogram timers;
+  Histogram check_alive;
+  // from the return of epoll_wait until the next one
+  Histogram iteration;
+
+  void Merge(const EventLoopStats& other);
+  void Reset();
+};
+
 class TCPService 
   : public std::enable_shared_from_this<TCPService>{
 public:
@@ -36,6 +85,22 @@ public:
 
   void Start(int loop_waite_second);
 
+  // the arena of the sessions and their buffers, nullptr for the heap,
+  // set before Start
+  void set_arena(const std::shared_ptr<MemoryArena>& arena) {
+    arena_ = arena;
+  }
+
+  const std::shared_ptr<MemoryArena>& arena() const {
+    return arena_;
+  }
+
+  // the arena of the handler temporaries, it is reset by the policy of
+  // the server, called on the service thread
+  ScratchArena* scratch_arena() {
+    return &scratch_arena_;
+  }
+
   void Stop();
 
   int OnStartSession(TCPSession* session);
@@ -45,22 +110,204 @@ public:
   // event activate
   void EventActivate();
 
-  // consume recycle queue
-  bool ConsumeRecycleQueue(PipeMsg* res_msg);
-
   int PushSessions(TCPSession* session);
 
+  // push an accepted socket without flushing, the session would be
+  // constructed on the service thread with the priority class
+  int PushSocket(int socket, const sockaddr_in& address,
+    SessionPriority priority, bool tracked);
+
+  // flush the pushed sockets of the accept burst
+  int FlushSockets();
+
+  // construct and start the session of an accepted socket at once, the
+  // socket is closed when the session could not start, called on the
+  // service thread
+  TCPSession* StartSocket(int socket, const sockaddr_in& address,
+    SessionPriority priority, bool tracked);
+
+  // push a message written by the listen thread
+  int PushMessage(const PipeMsg& msg);
+
+  // read a message written by the service thread, called on the listen
+  // thread to forward it
+  int PopMessage(PipeMsg* msg);
+
+  // ask the service to move some hot sessions to the target service,
+  // called on the listen thread
+  int RequestRebalance(TCPService* target);
+
+  // ask the service to move all the sessions away, it would answer with
+  // PIPE_MSG_RETIRED once drained, called on the listen thread
+  int RequestRetire();
+
+  // move the session to the service of the routing key once the current
+  // dispatch is done, so that a handler could re-home its own session
+  // after reading the key from the first frame. The server places the
+  // session by its key among the services of the normal connections, a
+  // session already on that service is not moved. Returns EPOLL_INVALID
+  // without the affinity placement policy, or for a session on a high
+  // priority service, called on the service thread
+  int RehomeSession(TCPSession* session, uint64_t key);
+
+  // the session has corked data to flush at the end of the loop iteration
+  void PendingFlush(TCPSession* session);
+
+  // update the epoll interest of the session
+  int ModifySession(TCPSession* session);
+
+  // open a nonblocking connection to the address, the session is started
+  // at once and the data sent before it connected is queued, its received
+  // messages go to the parser options of the server as those of the
+  // accepted sessions, called on the service thread
+  int Connect(const sockaddr_in& address, TCPSession** session);
+
+  // run the timer once the due time in microseconds passed, a timer is
+  // scheduled once at most, called on the service thread
+  void ScheduleTimer(ServiceTimer* timer, int64_t due_time);
+
+  // remove the timer if scheduled, called on the service thread
+  void CancelTimer(ServiceTimer* timer);
+
+  // the load figures published by the service thread, they could be
+  // read from any thread
+
+  // the started sessions plus the pushed sockets not started yet
+  int active_sessions() const {
+    return active_sessions_.load(std::memory_order_relaxed) +
+      pending_sessions_.load(std::memory_order_relaxed);
+  }
+
+  // the microseconds spent out of epoll_wait during the last load window
+  int64_t recent_busy_time() const;
+
+  // the loop durations since the service started, published once per
+  // load window
+  EventLoopStats loop_stats();
+
+  // sample the transport of the next batch of sessions, the sweep of all
+  // the sessions is published to the server once done, returns the due
+  // time of the next batch, called on the service thread by its timer
+  int64_t SampleTransport(int64_t now);
+
+  // the node of the service in the message mesh, -1 if not joined
+  int mesh_node() const {
+    return mesh_node_;
+  }
+
+  // send data to the session of any service, the data is queued on the
+  // mesh and delivered when the owner service drains it, called on the
+  // service thread
+  int SendTo(const SessionHandle& handle, const uint8_t* buffer, int size);
+
+  // deliver a message drained from the mesh
+  void OnMeshMessage(const MeshMsg& msg);
+
+  // whether the traffic of the sessions is being captured
+  bool capturing() const {
+    return nullptr != capture_ && capture_->active();
+  }
+
+  // record the traffic of a session, called on the service thread
+  void Capture(CaptureRecordType type, uint64_t session_id, int64_t time,
+    const void* data, int size) {
+    if (nullptr == capture_buffer_) {
+      capture_buffer_ = capture_->Register(this);
+      if (nullptr == capture_buffer_) {
+        return;
+      }
+    }
+    capture_buffer_->Record(type, session_id, time,
+      reinterpret_cast<const uint8_t*>(data), size);
+  }
+
 private:
+  // the session count of each chunk allocated by the session pool
+  static const int kSessionPoolGranularity = 64;
+  // the length of the window to publish the busy time
+  static const int64_t kLoadWindow = 1000000;
+  // the max count of the sessions moved by one rebalance
+  static const size_t kMaxRebalanceSessions = 64;
+  // the sessions sampled per transport timer, and the min interval of the
+  // timer in microseconds
+  static const int kTransportBatch = 64;
+  static const int64_t kMinTransportTick = 1000;
+
   void DoStop();
 
   int HandleEvent();
 
   void EventLoop();
 
+  // dispatch the events of a session, the reads of a normal session are
+  // limited by max_bytes as TCPSession::DoReceive and counted into
+  // received_bytes. Returns EPOLL_EOF once the service terminated, and
+  // EPOLL_BUSY when the session was left with data to read
+  int DispatchSession(TCPSession* session, int events, int max_bytes,
+    int64_t* received_bytes);
+
+  // dispatch the queued sessions by their class within the read budgets
+  void DispatchReady();
+
+  // whether any session is waiting in the ready queues
+  bool HasReady() const;
+
+  // remove the session from the ready queues
+  void CancelReady(TCPSession* session);
+
   bool EventManipulate(int sockfd, int cmd, int events, void* ptr);
 
   void DoCheckAlive();
 
+  // flush the corked sessions
+  void FlushSessions();
+
+  // move a session of this service to the target service, it is removed
+  // from this service at once and started on the target service with its
+  // buffers and parser state, the server places the session when the
+  // target is nullptr. The session is released here, so it must not be
+  // called while the session is being dispatched, DoRebalance, DoRetire
+  // and DoRehome run after the dispatch. An inline server never moves
+  // its sessions
+  int MigrateSession(TCPSession* session, TCPService* target);
+
+  // migrate the sessions waiting to be re-homed
+  void DoRehome();
+
+  // remove the session from the sessions waiting to be re-homed
+  void CancelRehome(TCPSession* session);
+
+  // the epoll_wait timeout in milliseconds up to the next timer
+  int NextTimeout(int64_t now) const;
+
+  // run the due timers
+  void RunTimers(int64_t now);
+
+  // account the busy time of one loop iteration
+  void UpdateLoad(int64_t iteration_start, int64_t iteration_end);
+
+  // publish the loop durations recorded since the last publishing
+  void PublishLoopStats();
+
+  // construct a session from the session pool of this service
+  TCPSession* AllocSession(int socket, const sockaddr_in& address);
+
+  // destroy the stopped session
+  void ReleaseSession(TCPSession* session);
+
+  // release the admission of a closed connection of the server
+  void ReleaseAdmission(const sockaddr_in& address, bool tracked);
+
+  // move the hot sessions to the target, the traffic moved is in
+  // proportion to the busy time skew between the two services
+  void DoRebalance(TCPService* target);
+
+  // start a session migrated from another service
+  int AdoptSession(TCPSession* migrant);
+
+  // move all the sessions away
+  void DoRetire();
+
   TCPServiceType service_type_;
   int epoll_socket_;
   int nevents_;
@@ -73,12 +320,62 @@ private:
   std::shared_ptr<TCPServer> server_;
   // the session
   std::set<TCPSession*> sessions_;
+  // the sessions waiting for flush
+  std::vector<TCPSession*> flush_sessions_;
+  // the sessions waiting to be re-homed
+  std::vector<TCPSession*> rehome_sessions_;
+  // the rebalance asked by the listen thread, it is applied once the
+  // sessions of the loop iteration were dispatched, nullptr if none
+  TCPService* rebalance_target_;
+  // the retiring asked by the listen thread, applied as the rebalance
+  bool retire_pending_;
+  // the ready sessions below the high class waiting for dispatch, and
+  // the read budgets per loop iteration of the classes
+  std::deque<TCPSession*> ready_sessions_[SESSION_PRIORITY_COUNT];
+  int read_budget_[SESSION_PRIORITY_COUNT];
+  // the heap of the scheduled timers by their due time
+  std::vector<std::pair<int64_t, ServiceTimer*>> timers_;
+  // the arena of the service thread, it outlives the session pool
+  std::shared_ptr<MemoryArena> arena_;
+  // the temporaries of the handlers, its chunks come from the arena
+  ScratchArena scratch_arena_;
+  // the storage of the normal sessions
+  ObjectPool<TCPSession, kSessionPoolGranularity> session_pool_;
+  // the busy time accumulated in the current load window
+  int64_t busy_time_;
+  int64_t load_window_start_;
+  // the published load figures
+  std::atomic<int> active_sessions_;
+  std::atomic<int> pending_sessions_;
+  std::atomic<int64_t> recent_busy_time_;
+  std::atomic<int64_t> recent_busy_window_;
+  // the loop durations of the current load window, and those published
+  EventLoopStats window_loop_stats_;
+  std::mutex loop_stats_mutex_;
+  EventLoopStats loop_stats_;
+  // the transport sampling, the sweep goes through the sessions in their
+  // order in the set and resumes after the cursor, which is only compared
+  int64_t transport_interval_;
+  std::unique_ptr<ServiceTimer> transport_timer_;
+  TCPSession* transport_cursor_;
+  std::vector<TransportStats> transport_sweep_;
+  // the stall watchdog of the server, nullptr if disabled
+  StallWatchdog* watchdog_;
+  LoopWatch loop_watch_;
   // the connect pipe
   std::shared_ptr<Pipe> event_push_pipe_;
   std::shared_ptr<Pipe> event_pop_pipe_;
   // the event session 
   std::shared_ptr<TCPSession> event_writer_;
   std::shared_ptr<TCPSession> event_reader_;
+  // the message mesh between the normal services
+  MessageMesh* mesh_;
+  int mesh_node_;
+  std::shared_ptr<MeshMessageListener> mesh_listener_;
+  std::shared_ptr<TCPSession> mesh_reader_;
+  // the traffic capture of the server, and the records of this thread
+  TrafficCapture* capture_;
+  CaptureBuffer* capture_buffer_;
   DISALLOW_CONSTRUCTORS(TCPService);
 };
 
@@ -1,9 +1,18 @@
 #include <tcp_session.h>
 #include <tcp_service.h>
 #include <message_parser.h>
+#include <checksum.h>
+#include <tracing.h>
 
+#include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <atomic>
+
+// the id of the next started session
+static std::atomic<uint64_t> next_session_id(1);
 
 TCPSession::TCPSession(int socket, TCPSessionType type, int event)
   : socket_(socket)
@@ -11,11 +20,23 @@ TCPSession::TCPSession(int socket, TCPSessionType type, int event)
   , session_type_(type)
   , stopped_(true)
   , write_waiting_(false)
+  , flush_pending_(false)
+  , traced_(false)
+  , priority_(SESSION_PRIORITY_NORMAL)
+  , ready_events_(0)
   , last_actived_time_(0)
-  , write_offset_(0)
-  , send_buffer_(nullptr)
-  , wait_buffer_(nullptr){
-  //nothing
+  , service_(nullptr)
+  , received_bytes_(0)
+  , sent_bytes_(0)
+  , session_id_(0)
+  , rebalance_mark_(0)
+  , shutdown_pending_(false)
+  , outbound_(false)
+  , admission_tracked_(false)
+  , rehome_pending_(false)
+  , affinity_key_(0)
+  , trace_queued_time_(0) {
+  memset(&address_, 0, sizeof(address_));
 }
 
 
@@ -26,53 +47,139 @@ TCPSession::~TCPSession() {
 
 int TCPSession::Start() {
   message_parser_.reset(new MessageParser(this));
-  send_buffer_ = &buffers_[0];
-  wait_buffer_ = &buffers_[1];
   stopped_ = false;
+  shutdown_pending_ = false;
   last_actived_time_ = GetCurrentMicroseconds();
+  session_id_ = next_session_id.fetch_add(1, std::memory_order_relaxed);
   return 0;
 }
 
 void TCPSession::Stop() {
-  if (stopped_) {
-    return;
-  }
+  // the socket is owned by the session even if it was never started
   if (socket_ >= 0) {
     shutdown(socket_, SHUT_RDWR);
     close(socket_);
     socket_ = -1;
   }
+  if (stopped_) {
+    return;
+  }
   message_parser_.reset();
-  write_offset_ = 0;
-  send_buffer_->Clear();
-  wait_buffer_->Clear();
+  send_buffer_.Clear();
   write_waiting_ = false;
+  traced_ = false;
+  trace_queued_time_ = 0;
+  service_ = nullptr;
   stopped_ = true;
 }
 
-int TCPSession::DoReceive() {
+void TCPSession::TransferFrom(TCPSession* other) {
+  socket_ = other->socket_;
+  event_ = other->event_;
+  session_type_ = other->session_type_;
+  stopped_ = other->stopped_;
+  write_waiting_ = other->write_waiting_;
+  flush_pending_ = false;
+  traced_ = false;
+  priority_ = other->priority_;
+  ready_events_ = 0;
+  trace_queued_time_ = 0;
+  last_actived_time_ = other->last_actived_time_;
+  service_ = nullptr;
+  received_bytes_ = other->received_bytes_;
+  sent_bytes_ = other->sent_bytes_;
+  transport_stats_ = other->transport_stats_;
+  session_id_ = other->session_id_;
+  rebalance_mark_ = other->rebalance_mark_;
+  shutdown_pending_ = other->shutdown_pending_;
+  outbound_ = other->outbound_;
+  admission_tracked_ = other->admission_tracked_;
+  rehome_pending_ = false;
+  affinity_key_ = other->affinity_key_;
+  address_ = other->address_;
+  send_buffer_.Swap(&other->send_buffer_);
+  message_parser_.swap(other->message_parser_);
+  if (message_parser_) {
+    message_parser_->set_session(this);
+  }
+
+  other->socket_ = -1;
+  other->stopped_ = true;
+  other->flush_pending_ = false;
+  other->service_ = nullptr;
+  other->message_parser_.reset();
+}
+
+int TCPSession::SampleTransport(int64_t now) {
+  if (socket_ < 0) {
+    return EPOLL_FAIL;
+  }
+  transport_stats_.session_id = session_id_;
+  transport_stats_.address = address_;
+  transport_stats_.received_bytes = received_bytes_;
+  transport_stats_.sent_bytes = sent_bytes_;
+  transport_stats_.send_queue = static_cast<uint32_t>(send_buffer_.size());
+  CHECK_RESULT(::SampleTransport(socket_, &transport_stats_));
+  transport_stats_.sample_time = now;
+  return 0;
+}
+
+SessionHandle TCPSession::handle() const {
+  SessionHandle result;
+  result.node = service_ ? service_->mesh_node() : -1;
+  result.session = const_cast<TCPSession*>(this);
+  result.session_id = session_id_;
+  return result;
+}
+
+int TCPSession::DoReceive(int max_bytes) {
   if (socket_ < 0 || stopped_) {
     return 0;
   }
+  // one sampling decision per readiness, the reads and the messages
+  // handled until the socket drained are traced together
+  traced_ = Tracer::enabled() &&
+    session_type_ == TCP_SESSION_TYPE_NORMAL && Tracer::Sample();
+  int result = 0;
+  uint64_t received_limit = received_bytes_ + max_bytes;
   while (true) {
+    if (0 != max_bytes && received_bytes_ >= received_limit) {
+      result = EPOLL_BUSY;
+      break;
+    }
+    int64_t read_start = traced_ ? GetCurrentMicroseconds() : 0;
     int rst = 0;
     rst = read(socket_, recv_buffer_, kRecvBufferSize);
     if (rst == 0) {
-      return EPOLL_FAIL;
+      result = EPOLL_FAIL;
+      break;
     } else if (rst == -1) {
       int error_code = errno;
       if (error_code != EAGAIN && 
         error_code != EINTR &&
         error_code != EWOULDBLOCK) {
-        return EPOLL_FAIL;
+        result = EPOLL_FAIL;
       }
       break;
     } else {
       last_actived_time_ = GetCurrentMicroseconds();
-      message_parser_->Parser(recv_buffer_, rst);
+      received_bytes_ += rst;
+      if (traced_) {
+        Tracer::Record("recv", session_id_, read_start, last_actived_time_);
+      }
+      if (nullptr != service_ && service_->capturing()) {
+        service_->Capture(CAPTURE_RECORD_RECEIVE, session_id_,
+          last_actived_time_, recv_buffer_, rst);
+      }
+      TraceSpan span("parse", session_id_, traced_);
+      if (message_parser_->Parser(recv_buffer_, rst) != 0) {
+        result = EPOLL_FAIL;
+        break;
+      }
     }
   }
-  return 0;
+  traced_ = false;
+  return result;
 }
 
 int TCPSession::DoSend() {
@@ -81,12 +188,22 @@ int TCPSession::DoSend() {
   }
   int rst = 0;
   while ((rst = Write()) == 0) {
-    WriteFlush();
+    // continue until the socket blocked or no data left
   }
   if (rst == EPOLL_BUSY) {
     write_waiting_ = true;
+    WatchWritable(true);
   } else if(rst == EPOLL_NO_DATA) {
     write_waiting_ = false;
+    WatchWritable(false);
+    if (0 != trace_queued_time_) {
+      Tracer::Record("write", session_id_, trace_queued_time_,
+        GetCurrentMicroseconds());
+      trace_queued_time_ = 0;
+    }
+    if (shutdown_pending_) {
+      shutdown(socket_, SHUT_WR);
+    }
   }
   return rst;
 }
@@ -95,48 +212,96 @@ int TCPSession::Send(const uint8_t* buffer, int size) {
   if (socket_ < 0 || stopped_) {
     return 0;
   }
-  
-  if (write_waiting_) {
-    wait_buffer_->Write(buffer, size);
-  } else {
-    send_buffer_->Write(buffer, size);
-    return DoSend();
+  if (nullptr != service_ && service_->capturing()) {
+    service_->Capture(CAPTURE_RECORD_SEND, session_id_,
+      GetCurrentMicroseconds(), buffer, size);
+  }
+  if (traced_ && 0 == trace_queued_time_) {
+    trace_queued_time_ = GetCurrentMicroseconds();
+    Tracer::Instant("queued", session_id_, trace_queued_time_);
+  }
+  send_buffer_.Write(buffer, size);
+  // the data would be written when the socket is writable again
+  if (!write_waiting_) {
+    if (nullptr == service_ || session_type_ != TCP_SESSION_TYPE_NORMAL) {
+      return DoSend();
+    }
+    // corked, the service would flush it once per loop iteration
+    if (!flush_pending_) {
+      flush_pending_ = true;
+      service_->PendingFlush(this);
+    }
   }
   return 0;
 }
 
+void TCPSession::ShutdownAfterSend() {
+  if (socket_ < 0 || stopped_ || shutdown_pending_) {
+    return;
+  }
+  shutdown_pending_ = true;
+  // otherwise it is shut down by the pending flush or writable event
+  if (0 == send_buffer_.size()) {
+    shutdown(socket_, SHUT_WR);
+  }
+}
+
+int TCPSession::SendMessage(const uint8_t* buffer, int size) {
+  if (nullptr == message_parser_) {
+    return EPOLL_FAIL;
+  }
+  const MessageParserOptions& options = message_parser_->options();
+  CHECK_RESULT(Send(buffer, size));
+  if (options.checksum && options.framing != MESSAGE_FRAMING_NONE) {
+    char text[kCrc32cTextSize];
+    FormatCrc32c(Crc32c(0, buffer, size), text);
+    CHECK_RESULT(Send(reinterpret_cast<const uint8_t*>(text),
+      kCrc32cTextSize));
+  }
+  if (options.framing == MESSAGE_FRAMING_DELIMITER) {
+    CHECK_RESULT(Send(&options.delimiter, 1));
+  } else if (options.framing == MESSAGE_FRAMING_CRLF) {
+    CHECK_RESULT(Send(reinterpret_cast<const uint8_t*>("\r\n"), 2));
+  }
+  return 0;
+}
 
 int TCPSession::Write() {
-  int send_length = send_buffer_->size();
-  if (send_length == 0) {
+  // the content wraps around the ring at most once, so it could be
+  // written by one syscall
+  ByteSpan spans[2];
+  int span_count = send_buffer_.ReadableSpans(spans);
+  if (span_count == 0) {
     return EPOLL_NO_DATA;
   }
-  uint8_t* wirte_buffer = send_buffer_->begin();
-  while (write_offset_ < send_length) {
-    int rst = write(socket_, wirte_buffer + write_offset_,
-      send_length - write_offset_);
-
-    if (rst <= 0) {
-      int error_code = errno;
-      if (error_code != EAGAIN &&
-        error_code != EINTR &&
-        error_code != EWOULDBLOCK) {
-        return EPOLL_FAIL;
-      }
-      return EPOLL_BUSY;
-    } else {
-      write_offset_ += rst;
+  iovec iov[2];
+  for (int i = 0; i < span_count; ++i) {
+    iov[i].iov_base = spans[i].data;
+    iov[i].iov_len = spans[i].size;
+  }
+  int rst = writev(socket_, iov, span_count);
+  if (rst <= 0) {
+    int error_code = errno;
+    if (error_code != EAGAIN &&
+      error_code != EINTR &&
+      error_code != EWOULDBLOCK) {
+      return EPOLL_FAIL;
     }
+    return EPOLL_BUSY;
   }
+  send_buffer_.Consume(rst);
+  sent_bytes_ += rst;
   return 0;
 }
 
-void TCPSession::WriteFlush() {
-  // switch the waiting buffer with the send buffer
-  send_buffer_->Clear();
-  ByteArray* tmp = send_buffer_;
-  send_buffer_ = wait_buffer_;
-  wait_buffer_ = tmp;
-  write_offset_ = 0;
+void TCPSession::WatchWritable(bool watch) {
+  if (nullptr == service_ || session_type_ != TCP_SESSION_TYPE_NORMAL) {
+    return;
+  }
+  int event = watch ? (event_ | EPOLLOUT) : (event_ & ~EPOLLOUT);
+  if (event == event_) {
+    return;
+  }
+  event_ = event;
+  service_->ModifySession(this);
 }
-
@@ -10,14 +10,19 @@
 #ifndef TCP_SESSION_H__
 #define TCP_SESSION_H__
 
+#include <netinet/in.h>
 #include <common.h>
-#include <byte_array.h>
+#include <ring_buffer.h>
+#include <message_mesh.h>
+#include <session_priority.h>
+#include <transport_stats.h>
 #include <memory>
 
 enum TCPSessionType {
   TCP_SESSION_TYPE_EVENT,
   TCP_SESSION_TYPE_LISTEN,
-  TCP_SESSION_TYPE_NORMAL
+  TCP_SESSION_TYPE_NORMAL,
+  TCP_SESSION_TYPE_MESH
 };
 
 class TCPService;
@@ -32,6 +37,14 @@ public:
 
   void Stop();
 
+  // take over the socket, buffers and parser state of the other session,
+  // the other session is left stopped without closing the socket
+  void TransferFrom(TCPSession* other);
+
+  bool stopped() const {
+    return stopped_;
+  }
+
   int socket() {
     return socket_;
   }
@@ -47,37 +60,201 @@ public:
   TCPSessionType session_type() const {
     return session_type_;
   }
-  int DoReceive();
+
+  // the peer address
+  const sockaddr_in& address() const {
+    return address_;
+  }
+
+  void set_address(const sockaddr_in& address) {
+    address_ = address;
+  }
+
+  // whether the session was connected by the service rather than accepted
+  bool outbound() const {
+    return outbound_;
+  }
+
+  void set_outbound(bool outbound) {
+    outbound_ = outbound;
+  }
+
+  // whether the admission of the accepted connection counted it on its
+  // source, it is released the same way
+  bool admission_tracked() const {
+    return admission_tracked_;
+  }
+
+  void set_admission_tracked(bool admission_tracked) {
+    admission_tracked_ = admission_tracked;
+  }
+
+  // the priority class, a change takes effect from the next readiness of
+  // the session, called on the service thread
+  SessionPriority priority() const {
+    return static_cast<SessionPriority>(priority_);
+  }
+
+  void set_priority(SessionPriority priority) {
+    priority_ = static_cast<uint8_t>(priority);
+  }
+
+  // the events waiting in the ready queue of the service, 0 if not queued
+  int ready_events() const {
+    return ready_events_;
+  }
+
+  void set_ready_events(int ready_events) {
+    ready_events_ = ready_events;
+  }
+
+  // the routing key given by TCPService::RehomeSession, 0 while the
+  // session is routed by its address
+  uint64_t affinity_key() const {
+    return affinity_key_;
+  }
+
+  void set_affinity_key(uint64_t affinity_key) {
+    affinity_key_ = affinity_key;
+  }
+
+  // whether the session waits to move to the service of its key
+  bool rehome_pending() const {
+    return rehome_pending_;
+  }
+
+  void set_rehome_pending(bool rehome_pending) {
+    rehome_pending_ = rehome_pending;
+  }
+
+  // the parser of the received data, nullptr if not started
+  MessageParser* message_parser() const {
+    return message_parser_.get();
+  }
+
+  // the received bytes since the session started
+  uint64_t received_bytes() const {
+    return received_bytes_;
+  }
+
+  // the bytes written to the socket since the session started
+  uint64_t sent_bytes() const {
+    return sent_bytes_;
+  }
+
+  // the transport figures of the last sample
+  const TransportStats& transport_stats() const {
+    return transport_stats_;
+  }
+
+  // sample the transport figures of the socket
+  int SampleTransport(int64_t now);
+
+  // the received bytes when the service measured the session last time
+  uint64_t rebalance_mark() const {
+    return rebalance_mark_;
+  }
+
+  void set_rebalance_mark(uint64_t rebalance_mark) {
+    rebalance_mark_ = rebalance_mark;
+  }
+
+  // the owner service, sends are corked once it was set
+  TCPService* service() const {
+    return service_;
+  }
+
+  void set_service(TCPService* service) {
+    service_ = service;
+  }
+
+  // the unique id assigned when the session started
+  uint64_t session_id() const {
+    return session_id_;
+  }
+
+  // the handle to send messages to this session from any service
+  SessionHandle handle() const;
+
+  // whether the message being received is traced
+  bool traced() const {
+    return traced_;
+  }
+
+  bool flush_pending() const {
+    return flush_pending_;
+  }
+
+  void set_flush_pending(bool flush_pending) {
+    flush_pending_ = flush_pending;
+  }
+
+  // read until the socket drained, or max_bytes were read when it is not
+  // 0, returns EPOLL_BUSY when the data left was not read
+  int DoReceive(int max_bytes);
 
   int DoSend();
 
+  // queue data to send, the data of a corked session would be written
+  // when the owner service flushing at the end of the loop iteration
   int Send(const uint8_t* buffer, int size);
+
+  // send a message framed as the parser options, with its delimiter and
+  // checksum if enabled
+  int SendMessage(const uint8_t* buffer, int size);
+
+  // shut down the sending side of the socket after the queued data was
+  // written, the session is stopped when the peer closed
+  void ShutdownAfterSend();
 private:
   static const int kRecvBufferSize = 8196;
 
   int Write();
 
-  void WriteFlush();
+  // arm or disarm the EPOLLOUT interest of the session
+  void WatchWritable(bool watch);
 
-  bool stopped_;
-  bool write_waiting_;
+  // hot fields touched by the epoll dispatch, they are packed into the
+  // first cache line of the pooled session
   int socket_;
   int event_;
+  // the session type
+  TCPSessionType session_type_;
+  bool stopped_;
+  bool write_waiting_;
+  bool flush_pending_;
+  bool traced_;
+  // the priority class, and the events waiting in the ready queue
+  uint8_t priority_;
+  int ready_events_;
   int64_t last_actived_time_;
+  // the owner service
+  TCPService* service_;
+  // the data waiting for writing
+  RingBuffer send_buffer_;
+  uint64_t received_bytes_;
+  uint64_t sent_bytes_;
+
+  // cold fields
+  uint64_t session_id_;
+  uint64_t rebalance_mark_;
   // the message parser
   std::shared_ptr<MessageParser> message_parser_;
-  // the session type
-  TCPSessionType session_type_;
+  // the peer address
+  sockaddr_in address_;
+  // shut down the sending side when the queued data was written
+  bool shutdown_pending_;
+  bool outbound_;
+  bool admission_tracked_;
+  bool rehome_pending_;
+  // the routing key, 0 for the address
+  uint64_t affinity_key_;
+  // the time the traced message queued its first data, 0 if none
+  int64_t trace_queued_time_;
+  // the last transport sample
+  TransportStats transport_stats_;
   // the recv buffer
   uint8_t recv_buffer_[kRecvBufferSize];
-  // the send buffers
-  ByteArray buffers_[2];
-  // the current sending buffer
-  ByteArray* send_buffer_;
-  // the waiting buffer
-  ByteArray* wait_buffer_;
-  // the write offset
-  int write_offset_;
   DISALLOW_CONSTRUCTORS(TCPSession);
 };
 
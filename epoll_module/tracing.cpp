@@ -0,0 +1,192 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <tracing.h>
+
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// the max count of the rings whose threads have exited
+const size_t kMaxIdleBuffers = 64;
+
+struct TraceEvent {
+  const char* name;
+  uint64_t session_id;
+  int64_t start;
+  // -1 for an instant event
+  int64_t duration;
+};
+
+// The events of one thread. The sampled events are rare, so the ring is
+// guarded by a mutex only contended while dumping
+struct TraceBuffer {
+  std::mutex mutex;
+  std::vector<TraceEvent> events;
+  // the slot of the next event, the ring is full once it wrapped
+  size_t next;
+  bool wrapped;
+  int tid;
+};
+
+// the rings of all the threads, the rings of the exited threads are kept
+// for the next dump
+std::mutex buffers_mutex;
+std::vector<std::shared_ptr<TraceBuffer>> buffers;
+
+thread_local std::shared_ptr<TraceBuffer> current_buffer;
+thread_local int sample_count = 0;
+
+TraceBuffer* GetBuffer() {
+  if (current_buffer) {
+    return current_buffer.get();
+  }
+  std::shared_ptr<TraceBuffer> buffer(new TraceBuffer());
+  buffer->events.resize(Tracer::kBufferEvents);
+  buffer->next = 0;
+  buffer->wrapped = false;
+  buffer->tid = static_cast<int>(syscall(SYS_gettid));
+  std::lock_guard<std::mutex> lock(buffers_mutex);
+  size_t idle = 0;
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    idle += buffers[i].use_count() == 1 ? 1 : 0;
+  }
+  // forget the oldest rings of the exited threads
+  for (size_t i = 0; i < buffers.size() && idle > kMaxIdleBuffers;) {
+    if (buffers[i].use_count() == 1) {
+      buffers.erase(buffers.begin() + i);
+      --idle;
+    } else {
+      ++i;
+    }
+  }
+  buffers.push_back(buffer);
+  current_buffer = buffer;
+  return buffer.get();
+}
+
+void Append(const TraceEvent& event) {
+  TraceBuffer* buffer = GetBuffer();
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  buffer->events[buffer->next] = event;
+  if (++buffer->next == buffer->events.size()) {
+    buffer->next = 0;
+    buffer->wrapped = true;
+  }
+}
+
+void FormatEvent(const TraceEvent& event, int pid, int tid,
+  std::string* json) {
+  char text[256];
+  int size = 0;
+  if (event.duration < 0) {
+    size = snprintf(text, sizeof(text),
+      "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,"
+      "\"pid\":%d,\"tid\":%d,\"args\":{\"session\":%llu}}",
+      event.name, static_cast<long long>(event.start), pid, tid,
+      static_cast<unsigned long long>(event.session_id));
+  } else {
+    size = snprintf(text, sizeof(text),
+      "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+      "\"pid\":%d,\"tid\":%d,\"args\":{\"session\":%llu}}",
+      event.name, static_cast<long long>(event.start),
+      static_cast<long long>(event.duration), pid, tid,
+      static_cast<unsigned long long>(event.session_id));
+  }
+  if (size > 0) {
+    json->append(text, size < static_cast<int>(sizeof(text)) ?
+      size : static_cast<int>(sizeof(text)) - 1);
+  }
+}
+
+}  // namespace
+
+std::atomic<int> Tracer::sample_interval_(0);
+
+bool Tracer::Sample() {
+  int interval = sample_interval_.load(std::memory_order_relaxed);
+  if (++sample_count < interval) {
+    return false;
+  }
+  sample_count = 0;
+  return interval > 0;
+}
+
+void Tracer::Record(const char* name, uint64_t session_id, int64_t start,
+  int64_t end) {
+  TraceEvent event = { name, session_id, start, end - start };
+  Append(event);
+}
+
+void Tracer::Instant(const char* name, uint64_t session_id, int64_t time) {
+  TraceEvent event = { name, session_id, time, -1 };
+  Append(event);
+}
+
+void Tracer::Dump(std::string* json) {
+  std::vector<std::shared_ptr<TraceBuffer>> all;
+  {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    all = buffers;
+  }
+  int pid = static_cast<int>(getpid());
+  bool first = true;
+  json->assign("{\"traceEvents\":[");
+  std::vector<TraceEvent> events;
+  for (size_t i = 0; i < all.size(); ++i) {
+    TraceBuffer* buffer = all[i].get();
+    {
+      // copy the ring out, the owner only waits for the copy
+      std::lock_guard<std::mutex> lock(buffer->mutex);
+      if (buffer->wrapped) {
+        events.assign(buffer->events.begin() + buffer->next,
+          buffer->events.end());
+      } else {
+        events.clear();
+      }
+      events.insert(events.end(), buffer->events.begin(),
+        buffer->events.begin() + buffer->next);
+    }
+    for (size_t j = 0; j < events.size(); ++j) {
+      if (!first) {
+        json->push_back(',');
+      }
+      first = false;
+      FormatEvent(events[j], pid, buffer->tid, json);
+    }
+  }
+  json->append("],\"displayTimeUnit\":\"ns\"}");
+}
+
+int Tracer::DumpToFile(const char* path) {
+  std::string json;
+  Dump(&json);
+  FILE* file = fopen(path, "w");
+  if (nullptr == file) {
+    return EPOLL_FAIL;
+  }
+  size_t written = fwrite(json.data(), 1, json.size(), file);
+  if (fclose(file) != 0 || written != json.size()) {
+    return EPOLL_FAIL;
+  }
+  return 0;
+}
+
+void Tracer::Clear() {
+  std::lock_guard<std::mutex> lock(buffers_mutex);
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    std::lock_guard<std::mutex> buffer_lock(buffers[i]->mutex);
+    buffers[i]->next = 0;
+    buffers[i]->wrapped = false;
+  }
+}
@@ -0,0 +1,97 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the sampled tracing of the message lifecycle.
+
+#ifndef EPOLL_TRACING_H__
+#define EPOLL_TRACING_H__
+
+#include <atomic>
+#include <string>
+#include <common.h>
+
+/// The sampled tracer. A thread decides to sample one of every interval
+/// receives, the spans of the sampled message are kept in the ring of the
+/// thread, the oldest overwritten, and dumped on demand as the Chrome
+/// trace event JSON which Perfetto loads as well.
+///
+/// The spans of a message: recv (the read), parse, handler, queued (the
+/// first send of the handler), write (from queued until the send buffer
+/// was fully written, the blocked writes included), and pipe or migrate
+/// for the time a session waited in the pipe of its service. The
+/// epoll_wait of the sampled loop iterations is traced too.
+///
+/// When disabled every hook costs one predictable branch on a relaxed load.
+class Tracer {
+ public:
+  // the events kept per thread
+  static const int kBufferEvents = 16384;
+
+  // whether the tracing is enabled, checked by every hook
+  static bool enabled() {
+    return sample_interval_.load(std::memory_order_relaxed) != 0;
+  }
+
+  static int sample_interval() {
+    return sample_interval_.load(std::memory_order_relaxed);
+  }
+
+  // sample one of every interval events per thread, 0 to disable
+  static void set_sample_interval(int interval) {
+    sample_interval_.store(interval, std::memory_order_relaxed);
+  }
+
+  // whether the event of the calling thread is sampled, called when
+  // enabled
+  static bool Sample();
+
+  // Records a complete span, the name should be a string literal
+  static void Record(const char* name, uint64_t session_id, int64_t start,
+    int64_t end);
+
+  // Records an instant event, the name should be a string literal
+  static void Instant(const char* name, uint64_t session_id, int64_t time);
+
+  // Formats the events kept by all the threads as a Chrome trace
+  static void Dump(std::string* json);
+
+  // Writes the dump to the file, returns EPOLL_FAIL when it could not be
+  // written
+  static int DumpToFile(const char* path);
+
+  // Discards the events kept so far
+  static void Clear();
+
+ private:
+  static std::atomic<int> sample_interval_;
+};
+
+/// The span of a scope, recorded when the scope is traced
+class TraceSpan {
+ public:
+  TraceSpan(const char* name, uint64_t session_id, bool traced)
+    : name_(traced ? name : nullptr)
+    , session_id_(session_id)
+    , start_(traced ? GetCurrentMicroseconds() : 0) {
+  }
+
+  ~TraceSpan() {
+    if (nullptr != name_) {
+      Tracer::Record(name_, session_id_, start_, GetCurrentMicroseconds());
+    }
+  }
+
+ private:
+  const char* name_;
+  uint64_t session_id_;
+  int64_t start_;
+  // Disable copying of TraceSpan
+  DISALLOW_CONSTRUCTORS(TraceSpan);
+};
+
+#endif // EPOLL_TRACING_H__
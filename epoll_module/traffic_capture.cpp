@@ -0,0 +1,392 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <traffic_capture.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <logging.h>
+#include <tcp_service.h>
+
+const char kCaptureMagic[8] = { 'E', 'P', 'C', 'A', 'P', 0, 0, 1 };
+
+namespace {
+
+const uint32_t kCaptureVersion = 1;
+// the idle wait of the writer in milliseconds
+const int kCaptureIdleWait = 1;
+
+// write all the bytes, returns false on error
+bool WriteAll(int file, const uint8_t* data, size_t size) {
+  while (size > 0) {
+    ssize_t rst = write(file, data, size);
+    if (rst < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      return false;
+    }
+    data += rst;
+    size -= rst;
+  }
+  return true;
+}
+
+}  // namespace
+
+CaptureBuffer::CaptureBuffer(TrafficCapture* capture, TCPService* owner)
+  : capture_(capture)
+  , owner_(owner)
+  , current_(nullptr)
+  , chunk_count_(0)
+  , pending_(false)
+  , closed_(false)
+  , dropped_bytes_(0) {
+}
+
+CaptureBuffer::~CaptureBuffer() {
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    free(chunks_[i]->data);
+    delete chunks_[i];
+  }
+}
+
+void CaptureBuffer::Record(CaptureRecordType type, uint64_t session_id,
+  int64_t time, const uint8_t* data, int size) {
+  static const int kMaxPiece =
+    kChunkSize - static_cast<int>(sizeof(CaptureRecord));
+  do {
+    int piece = size < kMaxPiece ? size : kMaxPiece;
+    int record_size = CaptureRecordSize(piece);
+    Chunk* chunk = Reserve(record_size);
+    if (nullptr == chunk) {
+      dropped_bytes_.store(dropped_bytes_.load(std::memory_order_relaxed) +
+        size, std::memory_order_relaxed);
+      return;
+    }
+    uint8_t* memory = chunk->data + chunk->size;
+    CaptureRecord* record = reinterpret_cast<CaptureRecord*>(memory);
+    record->time = time;
+    record->session_id = session_id;
+    record->size = piece;
+    record->type = static_cast<uint8_t>(type);
+    memset(record->reserved, 0, sizeof(record->reserved));
+    if (piece > 0) {
+      memcpy(memory + sizeof(CaptureRecord), data, piece);
+    }
+    memset(memory + sizeof(CaptureRecord) + piece, 0,
+      record_size - sizeof(CaptureRecord) - piece);
+    chunk->size += record_size;
+    data += piece;
+    size -= piece;
+  } while (size > 0);
+  pending_.store(true, std::memory_order_relaxed);
+}
+
+CaptureBuffer::Chunk* CaptureBuffer::Reserve(int size) {
+  uint64_t generation = capture_->generation();
+  if (nullptr != current_ && current_->generation != generation) {
+    // left by a former capture
+    current_->size = 0;
+    current_->generation = generation;
+  }
+  if (nullptr != current_ && current_->size + size > kChunkSize) {
+    Flush();
+  }
+  if (nullptr == current_) {
+    Chunk* chunk = nullptr;
+    if (!written_.Read(&chunk)) {
+      if (chunk_count_ == kChunkCount) {
+        return nullptr;
+      }
+      chunk = new (std::nothrow) Chunk();
+      if (nullptr == chunk) {
+        return nullptr;
+      }
+      chunk->data = reinterpret_cast<uint8_t*>(malloc(kChunkSize));
+      if (nullptr == chunk->data) {
+        delete chunk;
+        return nullptr;
+      }
+      chunks_.push_back(chunk);
+      ++chunk_count_;
+    }
+    chunk->size = 0;
+    chunk->generation = generation;
+    current_ = chunk;
+  }
+  return current_;
+}
+
+void CaptureBuffer::Flush() {
+  if (nullptr == current_ || 0 == current_->size) {
+    return;
+  }
+  // the ring holds all the chunks, it is never full
+  filled_.Write(current_, false);
+  filled_.Flush();
+  current_ = nullptr;
+  pending_.store(false, std::memory_order_relaxed);
+}
+
+TrafficCapture::TrafficCapture()
+  : file_(-1)
+  , stopping_(false)
+  , active_(false)
+  , generation_(0)
+  , written_bytes_(0)
+  , dropped_bytes_(0) {
+}
+
+TrafficCapture::~TrafficCapture() {
+  Stop();
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    delete buffers_[i];
+  }
+}
+
+int TrafficCapture::Start(const char* path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (thread_.joinable()) {
+    return EPOLL_BUSY;
+  }
+  file_ = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+    0644);
+  if (file_ < 0) {
+    return EPOLL_FAIL;
+  }
+  CaptureFileHeader header;
+  memcpy(header.magic, kCaptureMagic, sizeof(header.magic));
+  header.version = kCaptureVersion;
+  header.reserved = 0;
+  header.start_time = GetCurrentMicroseconds();
+  if (!WriteAll(file_, reinterpret_cast<const uint8_t*>(&header),
+    sizeof(header))) {
+    close(file_);
+    file_ = -1;
+    return EPOLL_FAIL;
+  }
+  written_bytes_.store(sizeof(header), std::memory_order_relaxed);
+  generation_.fetch_add(1, std::memory_order_relaxed);
+  stopping_ = false;
+  thread_ = std::thread([this]() { Run(); });
+  active_.store(true, std::memory_order_relaxed);
+  return 0;
+}
+
+void TrafficCapture::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!thread_.joinable()) {
+      return;
+    }
+    active_.store(false, std::memory_order_relaxed);
+    // an idle service hands its records over in the next iteration
+    for (size_t i = 0; i < buffers_.size(); ++i) {
+      if (!buffers_[i]->closed_.load(std::memory_order_relaxed)) {
+        buffers_[i]->owner_->EventActivate();
+      }
+    }
+  }
+  int64_t deadline = GetCurrentMicroseconds() +
+    static_cast<int64_t>(kStopWait) * 1000;
+  for (;;) {
+    bool pending = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (size_t i = 0; i < buffers_.size(); ++i) {
+        pending |= buffers_[i]->pending_.load(std::memory_order_relaxed) &&
+          !buffers_[i]->closed_.load(std::memory_order_relaxed);
+      }
+    }
+    if (!pending || GetCurrentMicroseconds() > deadline) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+  thread_.join();
+  close(file_);
+  file_ = -1;
+}
+
+CaptureBuffer* TrafficCapture::Register(TCPService* owner) {
+  CaptureBuffer* buffer = new (std::nothrow) CaptureBuffer(this, owner);
+  if (nullptr == buffer || buffer->filled_.Init() != 0 ||
+    buffer->written_.Init() != 0) {
+    delete buffer;
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  buffers_.push_back(buffer);
+  return buffer;
+}
+
+void TrafficCapture::Close(CaptureBuffer* buffer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (thread_.joinable()) {
+    // the writer drains it before deleting
+    buffer->closed_.store(true, std::memory_order_release);
+    return;
+  }
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    if (buffers_[i] == buffer) {
+      dropped_bytes_ += buffer->dropped_bytes_.load(std::memory_order_relaxed);
+      buffers_[i] = buffers_.back();
+      buffers_.pop_back();
+      delete buffer;
+      break;
+    }
+  }
+}
+
+uint64_t TrafficCapture::dropped_bytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t dropped = dropped_bytes_;
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    dropped += buffers_[i]->dropped_bytes_.load(std::memory_order_relaxed);
+  }
+  return dropped;
+}
+
+void TrafficCapture::Run() {
+  std::vector<CaptureBuffer*> buffers;
+  std::vector<bool> closed;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    bool stopping = stopping_;
+    buffers = buffers_;
+    lock.unlock();
+
+    // read closed before draining, so the chunks handed over before the
+    // owner stopped are all written
+    closed.assign(buffers.size(), false);
+    for (size_t i = 0; i < buffers.size(); ++i) {
+      closed[i] = buffers[i]->closed_.load(std::memory_order_acquire);
+    }
+    bool written = false;
+    for (size_t i = 0; i < buffers.size(); ++i) {
+      written |= Drain(buffers[i]);
+    }
+
+    lock.lock();
+    for (size_t i = 0; i < buffers.size(); ++i) {
+      if (!closed[i]) {
+        continue;
+      }
+      for (size_t j = 0; j < buffers_.size(); ++j) {
+        if (buffers_[j] == buffers[i]) {
+          dropped_bytes_ +=
+            buffers[i]->dropped_bytes_.load(std::memory_order_relaxed);
+          buffers_[j] = buffers_.back();
+          buffers_.pop_back();
+          delete buffers[i];
+          break;
+        }
+      }
+    }
+    if (stopping) {
+      return;
+    }
+    if (!written && !stopping_) {
+      condition_.wait_for(lock, std::chrono::milliseconds(kCaptureIdleWait));
+    }
+  }
+}
+
+bool TrafficCapture::Drain(CaptureBuffer* buffer) {
+  CaptureBuffer::Chunk* chunks[CaptureBuffer::kChunkCount];
+  uint64_t generation = generation_.load(std::memory_order_relaxed);
+  bool written = false;
+  for (;;) {
+    int count = buffer->filled_.ReadBatch(chunks, CaptureBuffer::kChunkCount);
+    if (0 == count) {
+      break;
+    }
+    for (int i = 0; i < count; ++i) {
+      CaptureBuffer::Chunk* chunk = chunks[i];
+      if (chunk->generation == generation) {
+        if (WriteAll(file_, chunk->data, chunk->size)) {
+          written_bytes_.fetch_add(chunk->size, std::memory_order_relaxed);
+        } else {
+          EPOLL_LOG_RATE_LIMITED(LOG_LEVEL_ERROR, 1,
+            "capture write error, errno: {}", errno);
+        }
+      }
+      buffer->written_.Write(chunk, false);
+    }
+    buffer->written_.Flush();
+    written = true;
+  }
+  return written;
+}
+
+CaptureReader::CaptureReader()
+  : memory_(nullptr)
+  , size_(0)
+  , offset_(0) {
+}
+
+CaptureReader::~CaptureReader() {
+  if (nullptr != memory_) {
+    munmap(const_cast<uint8_t*>(memory_), size_);
+  }
+}
+
+int CaptureReader::Open(const char* path) {
+  int file = open(path, O_RDONLY | O_CLOEXEC);
+  if (file < 0) {
+    return EPOLL_FAIL;
+  }
+  struct stat status;
+  if (fstat(file, &status) != 0 ||
+    static_cast<size_t>(status.st_size) < sizeof(CaptureFileHeader)) {
+    close(file);
+    return EPOLL_INVALID;
+  }
+  void* memory = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE,
+    file, 0);
+  close(file);
+  if (MAP_FAILED == memory) {
+    return EPOLL_FAIL;
+  }
+  memory_ = reinterpret_cast<const uint8_t*>(memory);
+  size_ = status.st_size;
+  offset_ = sizeof(CaptureFileHeader);
+  if (memcmp(header()->magic, kCaptureMagic, sizeof(kCaptureMagic)) != 0 ||
+    header()->version != kCaptureVersion) {
+    return EPOLL_INVALID;
+  }
+  return 0;
+}
+
+bool CaptureReader::Next(const CaptureRecord** record,
+  const uint8_t** data) {
+  if (offset_ + sizeof(CaptureRecord) > size_) {
+    return false;
+  }
+  const CaptureRecord* next =
+    reinterpret_cast<const CaptureRecord*>(memory_ + offset_);
+  size_t record_size = CaptureRecordSize(next->size);
+  if (next->size > static_cast<uint32_t>(CaptureBuffer::kChunkSize) ||
+    offset_ + record_size > size_) {
+    return false;
+  }
+  *record = next;
+  *data = memory_ + offset_ + sizeof(CaptureRecord);
+  offset_ += record_size;
+  return true;
+}
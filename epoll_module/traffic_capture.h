@@ -0,0 +1,210 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the capture of the session traffic and its file format.
+
+#ifndef EPOLL_TRAFFIC_CAPTURE_H__
+#define EPOLL_TRAFFIC_CAPTURE_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <common.h>
+#include <spsc_ring.h>
+
+class TCPService;
+
+enum CaptureRecordType {
+  CAPTURE_RECORD_OPEN = 1,      // the payload is the peer sockaddr_in
+  CAPTURE_RECORD_RECEIVE = 2,   // the bytes received by the session
+  CAPTURE_RECORD_SEND = 3,      // the bytes sent by the session
+  CAPTURE_RECORD_CLOSE = 4
+};
+
+/// The capture file is the header followed by the records, in little
+/// endian. The records are 8 bytes aligned so that the file could be
+/// mapped and walked in place. The records of one session are in order,
+/// those of different sessions are only ordered by their time.
+struct CaptureFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  // the time the capture started, in microseconds
+  int64_t start_time;
+};
+static_assert(sizeof(CaptureFileHeader) == 24, "the header should be packed");
+
+/// The record header, followed by the payload padded to 8 bytes
+struct CaptureRecord {
+  // the time in microseconds
+  int64_t time;
+  uint64_t session_id;
+  uint32_t size;
+  uint8_t type;
+  uint8_t reserved[3];
+};
+static_assert(sizeof(CaptureRecord) == 24, "the record should be packed");
+
+extern const char kCaptureMagic[8];
+
+// the bytes taken by a record with the payload size
+inline int CaptureRecordSize(int size) {
+  return static_cast<int>(sizeof(CaptureRecord)) + ((size + 7) & ~7);
+}
+
+class TrafficCapture;
+
+/// The records of one service thread. They are appended to a chunk which
+/// is handed over to the writer when it is full or once per loop
+/// iteration, through a ring that never blocks: the records are dropped
+/// when the writer fell behind.
+class CaptureBuffer {
+ public:
+  // the size of one chunk
+  static const int kChunkSize = 256 * 1024;
+  // the chunks of one buffer, the capacity of the rings
+  static const int kChunkCount = 16;
+
+  CaptureBuffer(TrafficCapture* capture, TCPService* owner);
+  ~CaptureBuffer();
+
+  // Appends a record on the owner thread, a large payload is split into
+  // several records
+  void Record(CaptureRecordType type, uint64_t session_id, int64_t time,
+    const uint8_t* data, int size);
+
+  // Hands the records over to the writer, called by the owner thread
+  void Flush();
+
+ private:
+  friend class TrafficCapture;
+
+  struct Chunk {
+    uint8_t* data;
+    int size;
+    // the capture the records belong to
+    uint64_t generation;
+  };
+
+  // the chunk to append the bytes to, nullptr when none is free
+  Chunk* Reserve(int size);
+
+  TrafficCapture* capture_;
+  TCPService* owner_;
+  Chunk* current_;
+  // the chunks allocated by the owner
+  int chunk_count_;
+  // the filled chunks to the writer, and the written ones back
+  SpscRing<Chunk*, kChunkCount> filled_;
+  SpscRing<Chunk*, kChunkCount> written_;
+  // the chunks owned by the buffer, released with it
+  std::vector<Chunk*> chunks_;
+  // whether records wait in the current chunk
+  std::atomic<bool> pending_;
+  // the owner has stopped, the buffer is released by the writer
+  std::atomic<bool> closed_;
+  std::atomic<uint64_t> dropped_bytes_;
+  // Disable copying of CaptureBuffer
+  DISALLOW_CONSTRUCTORS(CaptureBuffer);
+};
+
+/// The capture of the traffic of the sessions of a server. The service
+/// threads append the received and sent bytes to their buffers, a
+/// background writer appends the chunks to the file, so the service
+/// threads never wait for the disk.
+class TrafficCapture {
+ public:
+  TrafficCapture();
+  ~TrafficCapture();
+
+  // Starts capturing into the file, it is truncated. Returns EPOLL_BUSY
+  // when capturing already
+  int Start(const char* path);
+
+  // Stops capturing, the records buffered by the services are written
+  // before the file is closed
+  void Stop();
+
+  // whether the traffic is being captured, checked on every receive
+  bool active() const {
+    return active_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t generation() const {
+    return generation_.load(std::memory_order_relaxed);
+  }
+
+  // Creates the buffer of a service thread
+  CaptureBuffer* Register(TCPService* owner);
+
+  // Releases the buffer of a stopping service, the writer deletes it
+  void Close(CaptureBuffer* buffer);
+
+  // the bytes written to the file since the capture started, and the
+  // bytes dropped by the services in total
+  uint64_t written_bytes() const {
+    return written_bytes_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t dropped_bytes();
+
+ private:
+  // the max time in milliseconds to wait for the services to hand over
+  // their records when stopping
+  static const int kStopWait = 1000;
+
+  void Run();
+
+  // writes the chunks handed over, returns whether any was written
+  bool Drain(CaptureBuffer* buffer);
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::thread thread_;
+  std::vector<CaptureBuffer*> buffers_;
+  int file_;
+  bool stopping_;
+  std::atomic<bool> active_;
+  std::atomic<uint64_t> generation_;
+  std::atomic<uint64_t> written_bytes_;
+  // the bytes dropped by the released buffers
+  uint64_t dropped_bytes_;
+  // Disable copying of TrafficCapture
+  DISALLOW_CONSTRUCTORS(TrafficCapture);
+};
+
+/// Walks the records of a capture file mapped into the memory
+class CaptureReader {
+ public:
+  CaptureReader();
+  ~CaptureReader();
+
+  // Returns EPOLL_FAIL when the file could not be mapped, EPOLL_INVALID
+  // when it is not a capture file
+  int Open(const char* path);
+
+  // Gets the next record and its payload, returns false at the end. A
+  // record cut by the end of the file is ignored
+  bool Next(const CaptureRecord** record, const uint8_t** data);
+
+  const CaptureFileHeader* header() const {
+    return reinterpret_cast<const CaptureFileHeader*>(memory_);
+  }
+
+ private:
+  const uint8_t* memory_;
+  size_t size_;
+  size_t offset_;
+  // Disable copying of CaptureReader
+  DISALLOW_CONSTRUCTORS(CaptureReader);
+};
+
+#endif // EPOLL_TRAFFIC_CAPTURE_H__
@@ -0,0 +1,114 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+#include <transport_stats.h>
+
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <algorithm>
+
+namespace {
+
+// the figure of the stats compared by the order
+uint64_t OrderKey(TransportOrder order, const TransportStats& stats) {
+  switch (order) {
+  case TRANSPORT_ORDER_RTT:
+    return stats.rtt;
+  case TRANSPORT_ORDER_RETRANSMITS:
+    return stats.total_retransmits;
+  default:
+    return stats.queue_depth();
+  }
+}
+
+class WorseThan {
+ public:
+  explicit WorseThan(TransportOrder order)
+    : order_(order) {
+  }
+
+  bool operator()(const TransportStats& a, const TransportStats& b) const {
+    return OrderKey(order_, a) > OrderKey(order_, b);
+  }
+
+ private:
+  TransportOrder order_;
+};
+
+}  // namespace
+
+TransportStats::TransportStats()
+  : session_id(0)
+  , sample_time(0)
+  , received_bytes(0)
+  , sent_bytes(0)
+  , send_queue(0)
+  , socket_queue(0)
+  , rtt(0)
+  , rtt_var(0)
+  , retransmits(0)
+  , total_retransmits(0)
+  , congestion_window(0) {
+  memset(&address, 0, sizeof(address));
+}
+
+int SampleTransport(int socket, TransportStats* stats) {
+  tcp_info info;
+  socklen_t size = sizeof(info);
+  memset(&info, 0, sizeof(info));
+  if (getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &size) != 0) {
+    return EPOLL_FAIL;
+  }
+  // the bytes not sent plus those not acknowledged
+  int socket_queue = 0;
+  if (ioctl(socket, TIOCOUTQ, &socket_queue) != 0 || socket_queue < 0) {
+    socket_queue = 0;
+  }
+  stats->socket_queue = static_cast<uint32_t>(socket_queue);
+  stats->rtt = info.tcpi_rtt;
+  stats->rtt_var = info.tcpi_rttvar;
+  stats->retransmits = info.tcpi_retrans;
+  stats->total_retransmits = info.tcpi_total_retrans;
+  stats->congestion_window = info.tcpi_snd_cwnd;
+  return 0;
+}
+
+void SelectWorstSessions(TransportOrder order, size_t count,
+  std::vector<TransportStats>* stats) {
+  if (count < stats->size()) {
+    std::partial_sort(stats->begin(), stats->begin() + count, stats->end(),
+      WorseThan(order));
+    stats->resize(count);
+  } else {
+    std::sort(stats->begin(), stats->end(), WorseThan(order));
+  }
+}
+
+void FormatTransportStats(const TransportStats& stats, std::string* text) {
+  char address[INET_ADDRSTRLEN];
+  if (nullptr == inet_ntop(AF_INET, &stats.address.sin_addr, address,
+    sizeof(address))) {
+    address[0] = '\0';
+  }
+  char line[256];
+  int size = snprintf(line, sizeof(line),
+    "session %llu %s:%u in %llu out %llu queued %u+%u rtt %u/%u us "
+    "retrans %u/%u cwnd %u",
+    static_cast<unsigned long long>(stats.session_id), address,
+    static_cast<unsigned>(ntohs(stats.address.sin_port)),
+    static_cast<unsigned long long>(stats.received_bytes),
+    static_cast<unsigned long long>(stats.sent_bytes), stats.send_queue,
+    stats.socket_queue, stats.rtt, stats.rtt_var, stats.retransmits,
+    stats.total_retransmits, stats.congestion_window);
+  text->assign(line, size < static_cast<int>(sizeof(line)) ?
+    (size > 0 ? size : 0) : static_cast<int>(sizeof(line)) - 1);
+}
@@ -0,0 +1,68 @@
+/**
+* epoll_module
+* Copyright (c) 2017 engwei, yang (437798348@qq.com).
+*
+* @version 1.0
+* @author engwei, yang
+*/
+
+/// @file Defines the transport statistics of the sessions.
+
+#ifndef EPOLL_TRANSPORT_STATS_H__
+#define EPOLL_TRANSPORT_STATS_H__
+
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+#include <common.h>
+
+/// The transport figures of a session, sampled from TCP_INFO by the
+/// service at a low rate
+struct TransportStats {
+  uint64_t session_id;
+  sockaddr_in address;
+  // the time of the sample in microseconds, 0 if never sampled
+  int64_t sample_time;
+  // the bytes received and sent since the session started
+  uint64_t received_bytes;
+  uint64_t sent_bytes;
+  // the bytes queued in the session, and those in the socket not sent or
+  // not acknowledged yet
+  uint32_t send_queue;
+  uint32_t socket_queue;
+  // the smoothed round trip time and its variation, in microseconds
+  uint32_t rtt;
+  uint32_t rtt_var;
+  // the segments being retransmitted, and those retransmitted in total
+  uint32_t retransmits;
+  uint32_t total_retransmits;
+  // the congestion window in segments
+  uint32_t congestion_window;
+
+  TransportStats();
+
+  // the bytes waiting to reach the peer
+  uint64_t queue_depth() const {
+    return static_cast<uint64_t>(send_queue) + socket_queue;
+  }
+};
+
+enum TransportOrder {
+  TRANSPORT_ORDER_QUEUE_DEPTH,     // the most bytes waiting first
+  TRANSPORT_ORDER_RTT,             // the slowest round trip first
+  TRANSPORT_ORDER_RETRANSMITS      // the most retransmitted first
+};
+
+// Samples the TCP_INFO and the send queue of the socket into the stats,
+// the counters of the session are left as they were
+int SampleTransport(int socket, TransportStats* stats);
+
+// Keeps the count worst sessions of the order in the stats, the worst
+// first
+void SelectWorstSessions(TransportOrder order, size_t count,
+  std::vector<TransportStats>* stats);
+
+// Formats the stats as one line
+void FormatTransportStats(const TransportStats& stats, std::string* text);
+
+#endif // EPOLL_TRANSPORT_STATS_H__